@@ -11,9 +11,10 @@
 static void main_print_usage(void)
 {
     static const char *usage =
-"Usage: dcast [OPTION] PATH\n"
+"Usage: dcast [OPTION] PATH...\n"
 "Open an interactive raycast window displaying a maximum-intensity perspective\n"
-"projection of DICOM RTDose file at PATH\n";
+"projection of DICOM RTDose file at PATH. Several files, such as the doses of\n"
+"each beam of a plan, are summed on the grid of the first\n";
 
     puts(usage);
     puts(rc_get_usage_opt());
@@ -31,7 +32,8 @@ int main(int argc, char *argv[])
         .mu_k   = (scal_t)1.0,
         .slow   = (scal_t)0.1,
         .speed  = (scal_t)0.5,
-        .turbo  = (scal_t)1.0
+        .turbo  = (scal_t)1.0,
+        .tile   = RC_SCHED_TILE
     };
     int res;
 
@@ -44,6 +46,18 @@ int main(int argc, char *argv[])
         main_print_usage();
         return 1;
     }
+    if (params.nweight && params.nweight != params.npath) {
+        fprintf(stderr, "Got %u weights for %u dose files\n",
+                params.nweight, params.npath);
+        main_print_usage();
+        return 1;
+    }
+    if (params.dvr > 0.0 && (params.step > 0.0 || params.adaptive)) {
+        fputs("--dvr composites once per voxel, without --step or "
+              "--adaptive\n", stderr);
+        main_print_usage();
+        return 1;
+    }
     res = rc_app_open(&app, &params);
     if (!res) {
         res = rc_app_run(&app);
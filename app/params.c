@@ -12,7 +12,22 @@ static const struct optspec opts[] = {
     { 'w', "width",  1, rc_opt_callback },
     { 'h', "height", 1, rc_opt_callback },
     { 0,   "res",    2, rc_opt_callback },
-    { 0,   "dim",    2, rc_opt_callback }
+    { 0,   "dim",    2, rc_opt_callback },
+    { 'f', "floor",  1, rc_opt_callback },
+    { 0,   "dda",    0, rc_opt_callback },
+    { 0,   "tile",   1, rc_opt_callback },
+    { 'p', "progressive", 1, rc_opt_callback },
+    { 0,   "reproject",   0, rc_opt_callback },
+    { 'o', "ortho",       1, rc_opt_callback },
+    { 0,   "dvr",         1, rc_opt_callback },
+    { 0,   "proj",        1, rc_opt_callback },
+    { 0,   "lod",         0, rc_opt_callback },
+    { 0,   "step",        1, rc_opt_callback },
+    { 0,   "adaptive",    0, rc_opt_callback },
+    { 0,   "storage",     1, rc_opt_callback },
+    { 0,   "bricked",     0, rc_opt_callback },
+    { 0,   "cache",       0, rc_opt_callback },
+    { 0,   "weight",      1, rc_opt_callback }
 };
 
 enum {
@@ -20,7 +35,22 @@ enum {
     RC_OPT_WIDTH,
     RC_OPT_HEIGHT,
     RC_OPT_RES,
-    RC_OPT_DIM
+    RC_OPT_DIM,
+    RC_OPT_FLOOR,
+    RC_OPT_DDA,
+    RC_OPT_TILE,
+    RC_OPT_PROGRESSIVE,
+    RC_OPT_REPROJECT,
+    RC_OPT_ORTHO,
+    RC_OPT_DVR,
+    RC_OPT_PROJ,
+    RC_OPT_LOD,
+    RC_OPT_STEP,
+    RC_OPT_ADAPTIVE,
+    RC_OPT_STORAGE,
+    RC_OPT_BRICKED,
+    RC_OPT_CACHE,
+    RC_OPT_WEIGHT
 };
 
 
@@ -31,7 +61,44 @@ const char *rc_get_usage_opt(void)
 "  -w, --width  X       Set the target size to X pixels in width\n"
 "  -h, --height Y       Set the target size to Y pixels in height\n"
 "      --res    X Y     Set the target size to X pixels in width and Y pixels in\n"
-"      --dim    X Y     height\n";
+"      --dim    X Y     height\n"
+"  -f, --floor  P       Skip empty space at or below proportion P of max\n"
+"                       dose\n"
+"      --dda            Visit every voxel crossed by each ray exactly once when\n"
+"                       using nearest interpolation\n"
+"      --tile   N       Balance N by N pixel tiles across threads, or whole\n"
+"                       scanlines if N is zero\n"
+"  -p, --progressive N  Draw one ray per N by N block first after the view\n"
+"                       changes, then refine to full resolution while idle.\n"
+"                       SDL only\n"
+"      --reproject      Start each ray at the max of the last frame moved into\n"
+"                       the new view, so that more of it is skipped. SDL only\n"
+"  -o, --ortho  W       Project orthographically onto a plane W wide instead\n"
+"                       of through a pinhole. The wheel zooms the plane. SDL\n"
+"                       only\n"
+"      --dvr    A       Draw translucent isodose shells at 50%, 80% and 95% of\n"
+"                       the max dose instead of the max, each with opacity A\n"
+"                       per voxel at its center. SDL only\n"
+"      --proj   NAME    Reduce each ray by NAME, one of max, min, mean or\n"
+"                       integral. The default is max\n"
+"      --lod            Sample coarser copies of the dose that keep its max\n"
+"                       when pixels are wider than its voxels\n"
+"      --step   MM      Sample each ray every MM millimetres instead of once\n"
+"                       per voxel. Not with --dvr, which always composites\n"
+"                       once per voxel\n"
+"      --adaptive       Lengthen the step where the dose is flat and shorten\n"
+"                       it near steep falloff. Not with --dvr\n"
+"      --storage NAME   Keep voxels as NAME, one of f64, f32, u16 or u32. The\n"
+"                       integer formats are scaled by DoseGridScaling. The\n"
+"                       default is f64\n"
+"      --bricked        Store voxels in 8x8x8 bricks, so that rays along any\n"
+"                       axis touch about as much memory\n"
+"      --cache          Keep the compacted dose in a file beside the DICOM\n"
+"                       file, and map that on later runs instead of loading\n"
+"                       it again\n"
+"      --weight W       Weigh a dose file by W in the sum. Give it once per\n"
+"                       file, in the order of the files, or not at all to\n"
+"                       weigh each by one\n";
 
     return usage;
 }
@@ -63,6 +130,62 @@ static int rc_opt_callback(int idx, unsigned count, char *args[], void *data)
     case RC_OPT_HEIGHT:
         p->height = atoi(args[0]);
         break;
+    case RC_OPT_FLOOR:
+        p->floor = atof(args[0]);
+        break;
+    case RC_OPT_DDA:
+        p->dda = 1;
+        break;
+    case RC_OPT_TILE:
+        p->tile = atoi(args[0]);
+        break;
+    case RC_OPT_PROGRESSIVE:
+        p->progressive = atoi(args[0]);
+        break;
+    case RC_OPT_REPROJECT:
+        p->reproject = 1;
+        break;
+    case RC_OPT_ORTHO:
+        p->ortho = atof(args[0]);
+        break;
+    case RC_OPT_DVR:
+        p->dvr = atof(args[0]);
+        break;
+    case RC_OPT_PROJ:
+        if (rc_raycast_proj_parse(args[0], &p->proj)) {
+            fprintf(stderr, "Unrecognized projection \"%s\"\n", args[0]);
+            return 1;
+        }
+        break;
+    case RC_OPT_LOD:
+        p->lod = 1;
+        break;
+    case RC_OPT_STEP:
+        p->step = atof(args[0]);
+        break;
+    case RC_OPT_ADAPTIVE:
+        p->adaptive = 1;
+        break;
+    case RC_OPT_STORAGE:
+        if (rc_dose_fmt_parse(args[0], &p->storage)) {
+            fprintf(stderr, "Unrecognized storage format \"%s\"\n", args[0]);
+            return 1;
+        }
+        break;
+    case RC_OPT_BRICKED:
+        p->bricked = 1;
+        break;
+    case RC_OPT_CACHE:
+        p->cache = 1;
+        break;
+    case RC_OPT_WEIGHT:
+        if (p->nweight == RC_APP_MAX_PATHS) {
+            fprintf(stderr, "Cannot weigh more than %d dose files\n",
+                    RC_APP_MAX_PATHS);
+            return 1;
+        }
+        p->weights[p->nweight++] = atof(args[0]);
+        break;
     }
     return 0;
 }
@@ -84,10 +207,19 @@ static int rc_opt_errorfn(int type, char shrt, char *lng, void *data)
 static int rc_opt_posfn(int idx, unsigned count, char *args[], void *data)
 {
     struct rc_app_params *p = data;
+    unsigned i;
 
     (void)idx;
-    if (count) {
-        p->path = args[0];
+    for (i = 0; i < count; i++) {
+        if (p->npath == RC_APP_MAX_PATHS) {
+            fprintf(stderr, "Cannot sum more than %d dose files\n",
+                    RC_APP_MAX_PATHS);
+            return 1;
+        }
+        p->paths[p->npath++] = args[i];
+    }
+    if (p->npath) {
+        p->path = p->paths[0];
     }
     return 0;
 }
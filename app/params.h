@@ -4,6 +4,11 @@
 #define RC_APP_PARAMS_H
 
 #include "rcmath.h"
+#include "raycast.h"
+
+
+/** The most dose files that can be summed */
+#define RC_APP_MAX_PATHS 64
 
 
 struct rc_app_params {
@@ -12,13 +17,34 @@ struct rc_app_params {
     int        height;      /* Window height */
 
     const char *path;       /* The path to the initial file */
+    const char *paths[RC_APP_MAX_PATHS];    /* Every dose file, the initial
+                                            one first. More than one are
+                                            summed, e.g. the beams of a plan */
+    unsigned    npath;      /* Dose file count */
+    double      weights[RC_APP_MAX_PATHS];  /* Weight of each dose file in the
+                                            sum, in the same order */
+    unsigned    nweight;    /* Weight count, zero to weigh each by one */
 
     scal_t mu_k;
     scal_t speed;
     scal_t turbo;
     scal_t slow;
 
-    int linear; /* If nonzero, use linear interpolation instead */
+    int    linear;  /* If nonzero, use linear interpolation instead */
+    int    dda;     /* If nonzero, walk the voxel grid with nearest */
+    int    tile;    /* Tile size for the scheduler, or zero for scanlines */
+    int    progressive; /* First pass block size, zero for full resolution */
+    int    reproject;   /* If nonzero, seed each frame with the last */
+    double ortho;       /* Orthographic view width, or zero for perspective */
+    double dvr;         /* Isodose shell opacity, or zero for MIP */
+    enum rc_raycast_proj proj;  /* Reduction applied to each ray */
+    int    lod;     /* If nonzero, pick a mip level from the pixel footprint */
+    double step;    /* Ambient sample spacing, or zero for one per voxel */
+    int    adaptive;    /* If nonzero, adapt the step to the dose gradient */
+    enum rc_dose_fmt storage;   /* Precision the voxels are kept in */
+    int    bricked;     /* If nonzero, keep the voxels in bricks */
+    int    cache;       /* If nonzero, map a dose cache beside the file */
+    double floor;   /* Proportion of max dose at or below which rays skip */
 };
 
 
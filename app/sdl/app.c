@@ -128,26 +128,63 @@ static int rc_app_start_sdl(struct rc_app              *app,
 }
 
 
-/** @brief Load the dose
+/** @brief View the box of the dose above the current threshold
+ *  @param app
+ *      Application state buffer, with the dose loaded
+ */
+static void rc_app_view_dose(struct rc_app *app)
+{
+    if (rc_dose_view(&app->view, &app->dose, app->threshold)) {
+        fputs("Not enough memory for the mip levels of the view\n", stderr);
+    }
+    printf("Viewing %u x %u x %u voxels above %.0f%% of the max dose\n",
+           app->view.dim[0], app->view.dim[1], app->view.dim[2],
+           100.0 * app->threshold);
+}
+
+
+/** @brief Load the dose. It is kept whole, and only viewed above the
+ *      threshold, so that the threshold can be changed while running
  *  @param app
  *      Application state buffer
- *  @param path
- *      Path to the dose file
+ *  @param params
+ *      App parameters, for the paths to the dose files and their weights,
+ *      their storage format and layout, the proportion of max dose at or
+ *      below which rays skip bricks and whether to go through a dose cache
  *  @returns Nonzero on error. Failing to load a dose file will cease to be an
  *      error at some point in the future
  */
-static int rc_app_init_dose(struct rc_app *app, const char *path)
+static int rc_app_init_dose(struct rc_app              *app,
+                            const struct rc_app_params *params)
 {
-    const double threshold = 0.05;
-
-    if (rc_dose_load(&app->dose, path)) {
+    const char *path = params->path;
+
+    app->threshold = 0.05;
+    app->dose.floor = params->floor;
+    app->dose.fmt = params->storage;
+    app->dose.layout = params->bricked ? RC_DOSE_BRICKED : RC_DOSE_LINEAR;
+    if (params->npath > 1 || params->nweight) {
+        /* Sums are not cached */
+        if (rc_dose_load_sum(&app->dose,
+                             params->paths,
+                             params->nweight ? params->weights : NULL,
+                             params->npath)) {
+            fputs("Couldn't sum the dose files\n", stderr);
+            return 1;
+        }
+    } else if (params->cache && path) {
+        /* The cache only holds the dose above the threshold, so the view
+        cannot grow past that */
+        if (rc_dose_load_cached(&app->dose, path, app->threshold)) {
+            fprintf(stderr, "Couldn't load dose file at %s\n", path);
+            return 1;
+        }
+    } else if (rc_dose_load(&app->dose, path)) {
         fprintf(stderr, "Couldn't load dose file at %s\n",
                 path ? path : "NULL");
         return 1;
     }
-    if (rc_dose_compact(&app->dose, threshold)) {
-        fputs("Couldn't compact the dose\n", stderr);
-    }
+    rc_app_view_dose(app);
     return 0;
 }
 
@@ -166,6 +203,29 @@ static int rc_app_init_target(struct rc_app *app)
     app->target.tex.dim[0] = w;
     app->target.tex.dim[1] = h;
     app->target.tex.stride = 4;
+    /* Refining passes keep the pixels of the passes before them, so the target
+    cannot be a write-only texture lock */
+    app->target.tex.pixels = malloc((size_t)w * h * app->target.tex.stride);
+    if (!app->target.tex.pixels) {
+        fputs("Cannot allocate the target buffer\n", stderr);
+        return 1;
+    }
+    /* Rays write their doses here, so changing the colormap does not need
+    another raycast */
+    app->dosetex.dim[0] = w;
+    app->dosetex.dim[1] = h;
+    app->dosetex.stride = sizeof (float);
+    app->dosetex.pixels = malloc((size_t)w * h * app->dosetex.stride);
+    if (!app->dosetex.pixels) {
+        fputs("Cannot allocate the dose buffer\n", stderr);
+        return 1;
+    }
+    app->gbuf.depth = malloc((size_t)w * h * sizeof *app->gbuf.depth);
+    app->gbuf.voxel = malloc((size_t)w * h * sizeof *app->gbuf.voxel);
+    if (!app->gbuf.depth || !app->gbuf.voxel) {
+        fputs("Cannot allocate the depth buffers\n", stderr);
+        return 1;
+    }
     return 0;
 }
 
@@ -227,13 +287,15 @@ static void rc_app_awaken(struct rc_app *app)
 }
 
 
-/** @brief Mark the viewport for a redraw and force the event loop to unblock
+/** @brief Mark the viewport for a redraw and force the event loop to unblock.
+ *      Progressive rendering restarts from its coarsest pass
  *  @param app
  *      Application state
  */
 static void rc_app_mark_dirty(struct rc_app *app)
 {
     app->dirty = true;
+    app->block = app->coarse;
     //rc_app_awaken(app);
 }
 
@@ -253,9 +315,11 @@ static void rc_app_screen_updated(struct rc_app *app)
 /** @brief Initialize the screen buffer context
  *  @param app
  *      Application state buffer
+ *  @param ortho
+ *      Width of the orthographic view, or zero for perspective
  *  @returns Nonzero on error
  */
-static int rc_app_init_screen(struct rc_app *app)
+static int rc_app_init_screen(struct rc_app *app, double ortho)
 {
     int w, h;
 
@@ -263,19 +327,49 @@ static int rc_app_init_screen(struct rc_app *app)
     app->screen.dim[0] = w;
     app->screen.dim[1] = h;
     app->screen.fov = 90.0;
+    app->screen.width = ortho;
     rc_app_screen_updated(app);
     return 0;
 }
 
 
-/** @brief Initialize the colormap
+/** @brief Initialize the colormap for the projection, and the isodose shells
+ *      if requested
  *  @param app
  *      Application state buffer
+ *  @param params
+ *      Passed parameters
  *  @returns Nonzero on error
  */
-static int rc_app_init_colormap(struct rc_app *app)
+static int rc_app_init_colormap(struct rc_app              *app,
+                                const struct rc_app_params *params)
 {
-    dose_cmap_init(&app->cmap, app->dose.dmax);
+    static const double levels[] = { 0.5, 0.8, 0.95 };
+    const double width = 0.04;
+    const double dmax = rc_raycast_proj_max(&app->view, params->proj);
+
+    app->opts.proj = params->proj;
+    app->window = dmax;
+    dose_cmap_init(&app->cmap, dmax);
+    if (rc_cmap_lut_bake(&app->lut, &app->cmap.base, dmax)) {
+        fprintf(stderr, "Cannot allocate the colormap table\n");
+        return 1;
+    }
+    app->opts.dosetex = &app->dosetex;
+    app->opts.gbuf = &app->gbuf;
+    if (params->dvr > 0.0) {
+        if (rc_transfer_shells(&app->transfer,
+                               &app->cmap.base,
+                               app->dose.dmax,
+                               levels,
+                               sizeof levels / sizeof *levels,
+                               width,
+                               params->dvr)) {
+            fprintf(stderr, "Cannot allocate the transfer function\n");
+            return 1;
+        }
+        app->opts.transfer = &app->transfer;
+    }
     return 0;
 }
 
@@ -288,11 +382,11 @@ static int rc_app_init_colormap(struct rc_app *app)
 static int rc_app_init_view(struct rc_app              *app,
                             const struct rc_app_params *params)
 {
-    return rc_app_init_dose(app, params->path)
+    return rc_app_init_dose(app, params)
         || rc_app_init_target(app)
         || rc_app_init_camera(app)
-        || rc_app_init_screen(app)
-        || rc_app_init_colormap(app);
+        || rc_app_init_screen(app, params->ortho)
+        || rc_app_init_colormap(app, params);
 }
 
 
@@ -314,6 +408,18 @@ static int rc_app_init_settings(struct rc_app              *app,
     app->slowmult  = mult * params->slow;
     app->keystate = SDL_GetKeyboardState(&app->nkeys);
     app->interpfn = params->linear ? rc_dose_linear : rc_dose_nearest;
+    app->opts.dda = params->dda;
+    app->opts.autolod = params->lod;
+    app->opts.step = params->step;
+    app->opts.adaptive = params->adaptive;
+    rc_sched_init(&app->sched, params->tile);
+    app->opts.sched = params->tile > 0 ? &app->sched : NULL;
+    rc_reproj_init(&app->reproj);
+    app->opts.reproj = params->reproject ? &app->reproj : NULL;
+    for (app->coarse = 1; (int)(2 * app->coarse) <= params->progressive;) {
+        app->coarse *= 2;
+    }
+    rc_app_mark_dirty(app);
     return 0;
 }
 
@@ -559,15 +665,65 @@ static int rc_app_motion(struct rc_app *app, SDL_MouseMotionEvent *e)
  */
 static int rc_app_wheel(struct rc_app *app, SDL_MouseWheelEvent *e)
 {
-    const double lo = 0.1, hi = 179.0;
+    const double lo = 0.1, hi = 179.0, zoom = 1.05;
 
-    app->screen.fov = rc_fclamp(app->screen.fov - e->preciseY, lo, hi);
+    if (app->screen.width > 0.0) {
+        app->screen.width *= pow(zoom, -e->preciseY);
+    } else {
+        app->screen.fov = rc_fclamp(app->screen.fov - e->preciseY, lo, hi);
+    }
     rc_target_update(&app->target, &app->screen);
     rc_app_mark_dirty(app);
     return 0;
 }
 
 
+/** @brief Print the dose under the cursor and where it was found, from the
+ *      last frame
+ *  @param app
+ *      Application state
+ *  @param x
+ *      Cursor position in window coordinates
+ *  @param y
+ *      Cursor position in window coordinates
+ */
+static void rc_app_probe(struct rc_app *app, int x, int y)
+{
+    const struct rc_texture *tex = &app->dosetex;
+    const struct rc_dose *lev;
+    RC_ALIGN scal_t pos[4];
+    const float *dose;
+    size_t n;
+    long vox;
+    int w, h;
+
+    if (app->opts.transfer) {
+        return;
+    }
+    SDL_GetWindowSize(app->wnd, &w, &h);
+    x = (int)((long)x * tex->dim[0] / w);
+    y = (int)((long)y * tex->dim[1] / h);
+    if (x < 0 || y < 0 || x >= (int)tex->dim[0] || y >= (int)tex->dim[1]) {
+        return;
+    }
+    n = (size_t)y * tex->dim[0] + (size_t)x;
+    dose = tex->pixels;
+    vox = app->gbuf.voxel[n];
+    if (vox < 0) {
+        printf("(%d, %d): %.4f\n", x, y, dose[n]);
+        return;
+    }
+    lev = rc_raycast_lod(&app->view, &app->target, &app->camera, &app->opts);
+    rc_spill(pos, rc_mvmul4(lev->mat,
+                            rc_set((scal_t)(vox % lev->dim[0]),
+                                   (scal_t)(vox / lev->dim[0] % lev->dim[1]),
+                                   (scal_t)(vox / lev->dim[0] / lev->dim[1]),
+                                   1.0)));
+    printf("(%d, %d): %.4f at (%.2f, %.2f, %.2f), depth %.2f\n",
+           x, y, dose[n], pos[0], pos[1], pos[2], app->gbuf.depth[n]);
+}
+
+
 /** @brief Handle a mouse click
  *  @param app
  *      Application state
@@ -581,6 +737,8 @@ static int rc_app_button(struct rc_app *app, SDL_MouseButtonEvent *e)
         rc_app_lookat_dose(app);
         app->autotarget = !app->autotarget;
         rc_app_mark_dirty(app);
+    } else if (e->button == SDL_BUTTON_MIDDLE) {
+        rc_app_probe(app, e->x, e->y);
     }
     return 0;
 }
@@ -606,6 +764,60 @@ static void rc_app_toggle_fullscreen(struct rc_app *app)
 }
 
 
+/** @brief Scale the dose at the top of the colormap. Only the colormap is
+ *      applied again, the rays are not
+ *  @param app
+ *      Application state
+ *  @param scale
+ *      Factor by which to multiply the window
+ */
+static void rc_app_rewindow(struct rc_app *app, double scale)
+{
+    if (app->opts.transfer) {
+        return;
+    }
+    app->window *= scale;
+    dose_cmap_init(&app->cmap, app->window);
+    if (rc_cmap_lut_bake(&app->lut, &app->cmap.base, app->window)) {
+        fputs("Cannot allocate the colormap table\n", stderr);
+        rc_app_postquit();
+        return;
+    }
+    app->recolor = true;
+}
+
+
+/** @brief Move the threshold below which the dose is left out of the view.
+ *      Only the bounds of the view are found again, the dose is not reloaded.
+ *      Projections other than the max are windowed by the size of the view,
+ *      so their colormap follows it
+ *  @param app
+ *      Application state
+ *  @param delta
+ *      Change in the threshold, as a PROPORTION of max dose
+ */
+static void rc_app_rethreshold(struct rc_app *app, double delta)
+{
+    const double next = rc_fclamp(app->threshold + delta, 0.0, 0.95);
+    double prev;
+
+    if (next == app->threshold) {
+        return;
+    }
+    prev = rc_raycast_proj_max(&app->view, app->opts.proj);
+    app->threshold = next;
+    rc_app_view_dose(app);
+    if (app->opts.proj != RC_PROJ_MAX && prev > 0.0) {
+        /* Keep any change the user made to the window */
+        rc_app_rewindow(app,
+                        rc_raycast_proj_max(&app->view, app->opts.proj) / prev);
+    }
+    /* The last frame was cast through the old view */
+    rc_reproj_reset(&app->reproj);
+    rc_app_mark_dirty(app);
+}
+
+
 /** @brief Handle a keypress
  *  @param app
  *      Application state
@@ -624,6 +836,18 @@ static int rc_app_keydown(struct rc_app *app, SDL_KeyboardEvent *e)
     case SDLK_F11:
         rc_app_toggle_fullscreen(app);
         break;
+    case SDLK_LEFTBRACKET:
+        rc_app_rewindow(app, 1.0 / 1.1);
+        break;
+    case SDLK_RIGHTBRACKET:
+        rc_app_rewindow(app, 1.1);
+        break;
+    case SDLK_COMMA:
+        rc_app_rethreshold(app, -0.01);
+        break;
+    case SDLK_PERIOD:
+        rc_app_rethreshold(app, 0.01);
+        break;
     default:
         break;
     }
@@ -669,24 +893,45 @@ static int rc_app_process(struct rc_app *app)
 }
 
 
-/** @brief Redraw the dose to the target texture
+/** @brief Colormap the doses of the last frame if they need it, and present
+ *      the target texture
  *  @param app
  *      Application state buffer
  */
-static void rc_app_redraw(struct rc_app *app)
+static void rc_app_recolor(struct rc_app *app)
 {
-    int pitch;
+    const int pitch = app->target.tex.dim[0] * app->target.tex.stride;
 
-    SDL_LockTexture(app->tex, NULL, &app->target.tex.pixels, &pitch);
-    rc_raycast_dose(&app->dose,
-                    &app->target,
-                    &app->cmap.base,
-                    &app->camera,
-                    app->interpfn);
-    SDL_UnlockTexture(app->tex);
+    if (app->recolor) {
+        rc_raycast_recolor(&app->dosetex, &app->target, &app->lut.base);
+        app->recolor = false;
+    }
+    SDL_UpdateTexture(app->tex, NULL, app->target.tex.pixels, pitch);
     SDL_RenderCopy(app->rend, app->tex, NULL, NULL);
     SDL_RenderPresent(app->rend);
-    app->dirty = false;
+}
+
+
+/** @brief Redraw the dose to the target texture. With progressive rendering,
+ *      this draws the next pass and leaves the viewport dirty until the pass at
+ *      full resolution is drawn
+ *  @param app
+ *      Application state buffer
+ */
+static void rc_app_redraw(struct rc_app *app)
+{
+    app->opts.block = app->block;
+    app->opts.refine = app->block < app->coarse;
+    rc_raycast_dose(&app->view,
+                    &app->target,
+                    &app->lut.base,
+                    &app->camera,
+                    app->interpfn,
+                    &app->opts);
+    app->recolor = !app->opts.transfer;
+    rc_app_recolor(app);
+    app->block >>= 1;
+    app->dirty = app->block > 0;
 }
 
 
@@ -708,6 +953,8 @@ int rc_app_run(struct rc_app *app)
     do {
         if (app->dirty) {
             rc_app_redraw(app);
+        } else if (app->recolor) {
+            rc_app_recolor(app);
         }
         //rc_app_await(app, NULL);
         rc_process_input(app);
@@ -723,7 +970,20 @@ void rc_app_close(struct rc_app *app)
         SDL_DestroyTexture(app->tex);
         SDL_DestroyRenderer(app->rend);
         SDL_DestroyWindow(app->wnd);
+        rc_dose_clear(&app->view);
         rc_dose_clear(&app->dose);
+        rc_sched_clear(&app->sched);
+        rc_reproj_clear(&app->reproj);
+        rc_transfer_clear(&app->transfer);
+        rc_cmap_lut_clear(&app->lut);
+        free(app->target.tex.pixels);
+        app->target.tex.pixels = NULL;
+        free(app->dosetex.pixels);
+        app->dosetex.pixels = NULL;
+        free(app->gbuf.depth);
+        app->gbuf.depth = NULL;
+        free(app->gbuf.voxel);
+        app->gbuf.voxel = NULL;
     }
     SDL_Quit();
 }
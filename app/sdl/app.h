@@ -20,13 +20,29 @@ struct rc_app {
     bool autotarget;    /* Override camera look on move */
     bool capture;
 
-    struct rc_target target;
+    struct rc_target  target;
+    struct rc_texture dosetex;  /* Projected doses of the last frame */
+    struct rc_gbuf    gbuf;     /* Depths and voxels of the last frame */
     struct rc_cam    camera;
     struct rc_screen screen;
     struct dose_cmap cmap;
-    struct rc_dose   dose;
-
-    rc_dose_interpfn_t *interpfn;
+    struct rc_cmap_lut lut;
+    struct rc_dose   dose;      /* As loaded */
+    struct rc_dose   view;      /* The box of the dose above the threshold,
+                                which is what is drawn */
+    double           threshold; /* PROPORTION of max dose outside the view */
+
+    rc_dose_interpfn_t    *interpfn;
+    struct rc_raycast_opts opts;
+    struct rc_sched        sched;
+    struct rc_reproj       reproj;
+    struct rc_transfer     transfer;
+
+    double window;      /* Dose at the top of the colormap */
+    bool   recolor;     /* If true, colormap the last frame again */
+
+    unsigned coarse;    /* Block size of the first progressive pass */
+    unsigned block;     /* Block size of the next pass, zero when complete */
 
     /* Rotation quaternions for moving the camera */
     vec_t pitch;    /* Pitch the camera up and down about ITS x-axis */
@@ -346,7 +346,8 @@ static int rc_app_init_window(struct rc_app              *app,
 }
 
 
-/** @brief Load the dose that was provided on the command line
+/** @brief Load the dose that was provided on the command line, or the
+ *      weighted sum of the doses if there were several or any weights
  *  @param app
  *      Application state
  *  @param params
@@ -359,7 +360,26 @@ static int rc_app_load_dose(struct rc_app              *app,
     static const wchar_t *failfmt = L"Cannot load the dose file at %S";
     const double threshold = 0.01;
 
-    if (rc_dose_load(&app->dose, params->path)) {
+    app->dose.floor = params->floor;
+    app->dose.fmt = params->storage;
+    app->dose.layout = params->bricked ? RC_DOSE_BRICKED : RC_DOSE_LINEAR;
+    /* Sums are not cached */
+    if (params->cache && params->npath < 2 && !params->nweight) {
+        if (rc_dose_load_cached(&app->dose, params->path, threshold)) {
+            rc_error_raise(RC_ERROR_USER, NULL, failfmt, params->path);
+            return -1;
+        }
+        return 0;
+    }
+    if (params->npath > 1 || params->nweight) {
+        if (rc_dose_load_sum(&app->dose,
+                             params->paths,
+                             params->nweight ? params->weights : NULL,
+                             params->npath)) {
+            rc_error_raise(RC_ERROR_USER, NULL, L"Cannot sum the dose files");
+            return -1;
+        }
+    } else if (rc_dose_load(&app->dose, params->path)) {
         rc_error_raise(RC_ERROR_USER, NULL, failfmt, params->path);
         return -1;
     }
@@ -459,14 +479,22 @@ static int rc_app_init_camera(struct rc_app *app)
 }
 
 
-/** @brief Initialize the colormap
+/** @brief Initialize the colormap for the projection
  *  @param app
  *      Application state
+ *  @param proj
+ *      Projection
  *  @returns Nonzero on error
  */
-static int rc_app_init_colormap(struct rc_app *app)
-{
-    rc_win32_cmap_init(&app->cmap, app->dose.dmax);
+static int rc_app_init_colormap(struct rc_app *app, enum rc_raycast_proj proj)
+{
+    app->opts.proj = proj;
+    rc_win32_cmap_init(&app->cmap, rc_raycast_proj_max(&app->dose, proj));
+    if (rc_cmap_lut_bake(&app->lut,
+                         &app->cmap.base.base,
+                         rc_raycast_proj_max(&app->dose, proj))) {
+        return 1;
+    }
     return 0;
 }
 
@@ -504,6 +532,12 @@ static int rc_app_copy_params(struct rc_app              *app,
     app->slow  = mult * params->slow;
     app->turbo = mult * params->turbo;
     app->linear = params->linear;
+    app->opts.dda = params->dda;
+    app->opts.autolod = params->lod;
+    app->opts.step = params->step;
+    app->opts.adaptive = params->adaptive;
+    rc_sched_init(&app->sched, params->tile);
+    app->opts.sched = params->tile > 0 ? &app->sched : NULL;
     return 0;
 }
 
@@ -522,15 +556,38 @@ static int rc_app_init_view(struct rc_app              *app,
         || rc_app_init_target(app)
         || rc_app_init_bmpinfo(app)
         || rc_app_init_camera(app)
-        || rc_app_init_colormap(app)
+        || rc_app_init_colormap(app, params->proj)
         || rc_app_copy_params(app, params);
 }
 
 
+/** @brief Refuse the options that only the SDL front end implements, rather
+ *      than silently ignoring them
+ *  @param params
+ *      App parameters
+ *  @returns Nonzero on error
+ */
+static int rc_app_check_params(const struct rc_app_params *params)
+{
+    if (params->progressive
+     || params->reproject
+     || params->ortho > 0.0
+     || params->dvr > 0.0) {
+        rc_error_raise(RC_ERROR_USER,
+                       NULL,
+                       L"--progressive, --reproject, --ortho and --dvr are "
+                       L"only supported by the SDL front end");
+        return -1;
+    }
+    return 0;
+}
+
+
 int rc_app_open(struct rc_app *app, const struct rc_app_params *params)
 {
     app->hinst = GetModuleHandle(NULL);
-    return rc_app_init_window(app, params)
+    return rc_app_check_params(params)
+        || rc_app_init_window(app, params)
         || rc_app_init_view(app, params);
 }
 
@@ -685,9 +742,10 @@ static void rc_app_update(struct rc_app *app)
     if (app->dirty) {
         rc_raycast_dose(&app->dose,
                         &app->target,
-                        &app->cmap,
+                        &app->lut.base,
                         &app->camera,
-                        app->linear ? rc_dose_linear : rc_dose_nearest);
+                        app->linear ? rc_dose_linear : rc_dose_nearest,
+                        &app->opts);
         InvalidateRect(app->hwnd, NULL, FALSE);
         app->dirty = false;
     }
@@ -714,5 +772,7 @@ void rc_app_close(struct rc_app *app)
         return;
     }
     rc_dose_clear(&app->dose);
+    rc_sched_clear(&app->sched);
+    rc_cmap_lut_clear(&app->lut);
     free(app->target.tex.pixels);
 }
@@ -36,6 +36,10 @@ struct rc_app {
     struct rc_screen screen;
     struct rc_dose   dose;
     struct rc_win32_cmap cmap;
+    struct rc_cmap_lut   lut;
+
+    struct rc_raycast_opts opts;
+    struct rc_sched        sched;
 
     POINT lastpos;  /* Last cursor position */
     POINT mupdate;  /* Accumulated mouse deflections */
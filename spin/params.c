@@ -21,6 +21,19 @@ static struct optspec opts[] = {
     { .shrt = 'h', .lng = "height",  .args = 1, .func = main_optcb },
     { .shrt = 0,   .lng = "dim",     .args = 2, .func = main_optcb },
     { .shrt = 0,   .lng = "res",     .args = 2, .func = main_optcb },
+    { .shrt = 's', .lng = "floor",   .args = 1, .func = main_optcb },
+    { .shrt = 0,   .lng = "dda",     .args = 0, .func = main_optcb },
+    { .shrt = 0,   .lng = "tile",    .args = 1, .func = main_optcb },
+    { .shrt = 0,   .lng = "reproject", .args = 0, .func = main_optcb },
+    { .shrt = 0,   .lng = "ortho",   .args = 1, .func = main_optcb },
+    { .shrt = 0,   .lng = "dvr",     .args = 1, .func = main_optcb },
+    { .shrt = 0,   .lng = "proj",    .args = 1, .func = main_optcb },
+    { .shrt = 0,   .lng = "shearwarp", .args = 0, .func = main_optcb },
+    { .shrt = 0,   .lng = "step",    .args = 1, .func = main_optcb },
+    { .shrt = 0,   .lng = "adaptive", .args = 0, .func = main_optcb },
+    { .shrt = 0,   .lng = "storage", .args = 1, .func = main_optcb },
+    { .shrt = 0,   .lng = "bricked", .args = 0, .func = main_optcb },
+    { .shrt = 0,   .lng = "cache",   .args = 0, .func = main_optcb },
 };
 
 enum {
@@ -35,7 +48,20 @@ enum {
     OPT_WIDTH,
     OPT_HEIGHT,
     OPT_DIM,
-    OPT_RES
+    OPT_RES,
+    OPT_FLOOR,
+    OPT_DDA,
+    OPT_TILE,
+    OPT_REPROJECT,
+    OPT_ORTHO,
+    OPT_DVR,
+    OPT_PROJ,
+    OPT_SHEARWARP,
+    OPT_STEP,
+    OPT_ADAPTIVE,
+    OPT_STORAGE,
+    OPT_BRICKED,
+    OPT_CACHE
 };
 
 
@@ -55,7 +81,38 @@ const char *spin_get_usage_opt(void)
 "  -w, --width   X          Set the image width to X pixels\n"
 "  -h, --height  Y          Set the image height to Y pixels\n"
 "      --res     X Y        Set the image dimensions to X horizontal pixels and Y\n"
-"      --dim     X Y        vertical pixels\n";
+"      --dim     X Y        vertical pixels\n"
+"  -s, --floor   P          Skip empty space at or below proportion P of max\n"
+"                           dose\n"
+"      --dda                Visit every voxel crossed by each ray exactly once\n"
+"                           when using nearest interpolation\n"
+"      --tile    N          Balance N by N pixel tiles across threads, or whole\n"
+"                           scanlines if N is zero\n"
+"      --reproject          Start each ray at the max of the last frame moved\n"
+"                           into the new view, so that more of it is skipped\n"
+"      --ortho   WIDTH      Project orthographically onto a plane WIDTH wide\n"
+"                           instead of through a pinhole\n"
+"      --dvr     OPACITY    Draw translucent isodose shells at 50%, 80% and 95%\n"
+"                           of the max dose instead of the max, each with\n"
+"                           OPACITY per voxel at its center\n"
+"      --proj    NAME       Reduce each ray by NAME, one of max, min, mean or\n"
+"                           integral. The default is max\n"
+"      --shearwarp          Render each frame by shear-warp instead of casting\n"
+"                           rays. This needs --ortho and only draws the max,\n"
+"                           so it cannot be combined with the ray options\n"
+"      --step    MM         Sample each ray every MM millimetres instead of\n"
+"                           once per voxel. Not with --dvr, which always\n"
+"                           composites once per voxel\n"
+"      --adaptive           Lengthen the step where the dose is flat and\n"
+"                           shorten it near steep falloff. Not with --dvr\n"
+"      --storage NAME       Keep voxels as NAME, one of f64, f32, u16 or u32.\n"
+"                           The integer formats are scaled by\n"
+"                           DoseGridScaling. The default is f64\n"
+"      --bricked            Store voxels in 8x8x8 bricks, so that rays along\n"
+"                           any axis touch about as much memory\n"
+"      --cache              Keep the compacted dose in a file beside the DICOM\n"
+"                           file, and map that on later runs instead of\n"
+"                           loading it again\n";
 
     return options;
 }
@@ -109,6 +166,51 @@ static int main_optcb(int idx, unsigned count, char *args[], void *data)
     case OPT_HEIGHT:
         p->height = atoi(args[0]);
         break;
+    case OPT_FLOOR:
+        p->floor = atof(args[0]);
+        break;
+    case OPT_DDA:
+        p->dda = 1;
+        break;
+    case OPT_TILE:
+        p->tile = atoi(args[0]);
+        break;
+    case OPT_REPROJECT:
+        p->reproject = 1;
+        break;
+    case OPT_ORTHO:
+        p->ortho = atof(args[0]);
+        break;
+    case OPT_DVR:
+        p->dvr = atof(args[0]);
+        break;
+    case OPT_PROJ:
+        if (rc_raycast_proj_parse(args[0], &p->proj)) {
+            fprintf(stderr, "Unrecognized projection \"%s\"\n", args[0]);
+            return 1;
+        }
+        break;
+    case OPT_SHEARWARP:
+        p->shearwarp = 1;
+        break;
+    case OPT_STEP:
+        p->step = atof(args[0]);
+        break;
+    case OPT_ADAPTIVE:
+        p->adaptive = 1;
+        break;
+    case OPT_STORAGE:
+        if (rc_dose_fmt_parse(args[0], &p->storage)) {
+            fprintf(stderr, "Unrecognized storage format \"%s\"\n", args[0]);
+            return 1;
+        }
+        break;
+    case OPT_BRICKED:
+        p->bricked = 1;
+        break;
+    case OPT_CACHE:
+        p->cache = 1;
+        break;
     default:
         break;
     }
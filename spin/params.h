@@ -4,6 +4,7 @@
 #define SPIN_PARAMS_H
 
 #include "rcmath.h"
+#include "raycast.h"
 
 
 struct params {
@@ -17,6 +18,19 @@ struct params {
     int         width;      /* -w, --width; also --dim WIDTH HEIGHT */
     int         height;     /* -h, --height; also --dim WIDTH HEIGHT */
     int         linear;     /* -l, --linear (use linear interpolation?) */
+    double      floor;      /* -s, --floor (skip at or below this proportion) */
+    int         dda;        /* --dda (walk the voxel grid with nearest?) */
+    int         tile;       /* --tile (scheduler tile size, zero for rows) */
+    int         reproject;  /* --reproject (seed frames with the last?) */
+    double      ortho;      /* --ortho (orthographic view width, or zero) */
+    double      dvr;        /* --dvr (isodose shell opacity, or zero for MIP) */
+    enum rc_raycast_proj proj;  /* --proj (reduction applied to each ray) */
+    int         shearwarp;  /* --shearwarp (shear-warp instead of raycasting?) */
+    double      step;       /* --step (sample spacing in mm, or zero) */
+    int         adaptive;   /* --adaptive (adapt the step to the gradient?) */
+    enum rc_dose_fmt storage;   /* --storage (precision of the voxels) */
+    int         bricked;    /* --bricked (keep the voxels in bricks?) */
+    int         cache;      /* --cache (map a dose cache beside the file?) */
     const char *file;       /* The input file (positional argument zero) */
     const char *output;     /* The output path (positional argument one) */
 };
@@ -3,6 +3,7 @@
 #include "params.h"
 #include "anim.h"
 #include "raycast.h"
+#include "shearwarp.h"
 
 
 /** hackin again */
@@ -26,9 +27,14 @@ void spin_cmapfn(struct rc_colormap *this, double dose, void *pixel)
 struct scene {
     struct rc_dose   dose;
     struct dose_cmap cmap;
+    struct rc_cmap_lut lut;
     struct rc_screen screen;
     struct rc_target target;
     struct rc_cam    camera;
+    struct rc_sched  sched;
+    struct rc_reproj reproj;
+    struct rc_transfer transfer;
+    struct rc_shearwarp shearwarp;
 };
 
 
@@ -36,17 +42,47 @@ struct scene {
 static int main_prepare_scene(struct scene *sc, const struct params *p)
 {
     const scal_t angle = RC_PI / 4.0;
+    const double threshold = 0.05;
     const int stride = 4;
 
-    if (rc_dose_load(&sc->dose, p->file)) {
+    sc->dose.floor = p->floor;
+    sc->dose.fmt = p->storage;
+    sc->dose.layout = p->bricked ? RC_DOSE_BRICKED : RC_DOSE_LINEAR;
+    rc_sched_init(&sc->sched, p->tile);
+    rc_reproj_init(&sc->reproj);
+    rc_shearwarp_init(&sc->shearwarp);
+    if (p->cache) {
+        if (rc_dose_load_cached(&sc->dose, p->file, threshold)) {
+            return 1;
+        }
+    } else {
+        if (rc_dose_load(&sc->dose, p->file)) {
+            return 1;
+        }
+        rc_dose_compact(&sc->dose, threshold);
+    }
+    dose_cmap_init(&sc->cmap, rc_raycast_proj_max(&sc->dose, p->proj));
+    if (p->dvr > 0.0 && rc_transfer_shells(&sc->transfer,
+                                           &sc->cmap.base,
+                                           sc->dose.dmax,
+                                           (const double []){ 0.5, 0.8, 0.95 },
+                                           3,
+                                           0.04,
+                                           p->dvr)) {
+        perror("Failed to allocate the transfer function");
         return 1;
     }
-    rc_dose_compact(&sc->dose, 0.05);
-    dose_cmap_init(&sc->cmap, sc->dose.dmax);
     sc->cmap.base.func = spin_cmapfn;
+    if (rc_cmap_lut_bake(&sc->lut,
+                         &sc->cmap.base,
+                         rc_raycast_proj_max(&sc->dose, p->proj))) {
+        perror("Failed to allocate the colormap table");
+        return 1;
+    }
     sc->screen.dim[0] = sc->target.tex.dim[0] = p->width;
     sc->screen.dim[1] = sc->target.tex.dim[1] = p->height;
     sc->screen.fov = p->fov;
+    sc->screen.width = p->ortho;
     sc->target.tex.stride = stride;
     sc->target.tex.pixels = malloc((size_t)p->width * p->height * stride);
     rc_target_update(&sc->target, &sc->screen);
@@ -63,6 +99,11 @@ static int main_prepare_scene(struct scene *sc, const struct params *p)
 static void main_clear_scene(struct scene *sc)
 {
     rc_dose_clear(&sc->dose);
+    rc_sched_clear(&sc->sched);
+    rc_reproj_clear(&sc->reproj);
+    rc_transfer_clear(&sc->transfer);
+    rc_shearwarp_clear(&sc->shearwarp);
+    rc_cmap_lut_clear(&sc->lut);
     free(sc->target.tex.pixels);
 }
 
@@ -72,6 +113,16 @@ static int main_create_frames(struct scene        *sc,
                               const struct params *p,
                               struct anim         *anim)
 {
+    const struct rc_raycast_opts opts = {
+        .dda      = p->dda,
+        .sched    = p->tile > 0 ? &sc->sched : NULL,
+        .reproj   = p->reproject ? &sc->reproj : NULL,
+        .transfer = p->dvr > 0.0 ? &sc->transfer : NULL,
+        .proj     = p->proj,
+        .step     = p->step,
+        .adaptive = p->adaptive
+    };
+    rc_dose_interpfn_t *dosefn = p->linear ? rc_dose_linear : rc_dose_nearest;
     double sect = (RC_PI * 2.0) / (double)p->fcnt;
     double phi, theta = p->lat * (RC_PI / 180.0);
     double costheta, sintheta, cosphi, sinphi;
@@ -89,11 +140,22 @@ static int main_create_frames(struct scene        *sc,
         disp = rc_set(costheta * sinphi, -costheta * cosphi, sintheta, 0.0);
         sc->camera.org = rc_fmadd(disp, radius, centr);
         rc_cam_lookat(&sc->camera, centr);
-        rc_raycast_dose(&sc->dose,
-                        &sc->target,
-                        &sc->cmap.base,
-                        &sc->camera,
-                        p->linear ? rc_dose_linear : rc_dose_nearest);
+        if (!p->shearwarp) {
+            rc_raycast_dose(&sc->dose,
+                            &sc->target,
+                            &sc->lut.base,
+                            &sc->camera,
+                            dosefn,
+                            &opts);
+        } else if (rc_shearwarp_dose(&sc->dose,
+                                     &sc->target,
+                                     &sc->lut.base,
+                                     &sc->camera,
+                                     dosefn,
+                                     &sc->shearwarp)) {
+            perror("Shear-warp failed");
+            return 1;
+        }
         if (anim_add_frame(anim, sc->target.tex.pixels)) {
             return 1;
         }
@@ -146,6 +208,7 @@ int main(int argc, char *argv[])
         .ftime   = 1000 / params.fcnt,
         .width   = 512,
         .height  = 512,
+        .tile    = RC_SCHED_TILE,
         .file    = NULL,
         .output  = "output.webp"
     };
@@ -159,6 +222,30 @@ int main(int argc, char *argv[])
         main_print_usage();
         return 1;
     }
+    if (params.shearwarp && params.ortho <= 0.0) {
+        fputs("Shear-warp needs an orthographic view\n", stderr);
+        main_print_usage();
+        return 1;
+    }
+    if (params.shearwarp && (params.proj != RC_PROJ_MAX
+                             || params.dvr > 0.0
+                             || params.floor > 0.0
+                             || params.step > 0.0
+                             || params.adaptive
+                             || params.dda
+                             || params.reproject)) {
+        fputs("Shear-warp only draws a plain maximum-intensity projection, "
+              "without --proj,\n--dvr, --floor, --step, --adaptive, --dda or "
+              "--reproject\n", stderr);
+        main_print_usage();
+        return 1;
+    }
+    if (params.dvr > 0.0 && (params.step > 0.0 || params.adaptive)) {
+        fputs("--dvr composites once per voxel, without --step or "
+              "--adaptive\n", stderr);
+        main_print_usage();
+        return 1;
+    }
     printf("Creating an image with the following parameters:\n"
            "  Latitude:    %g degrees\n"
            "  Distance:    %g units\n"
@@ -0,0 +1,325 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "brick.h"
+#include "dose.h"
+
+
+/** @brief Find the maximum dose in the brick at brick coordinates @p b
+ *  @param dose
+ *      Dose volume
+ *  @param b
+ *      Brick coordinates
+ *  @returns The largest pixel in the brick, including its upper faces
+ */
+static float rc_bricks_pxmax(const struct rc_dose *dose, const unsigned b[])
+{
+    unsigned org[3], end[3], i, j, k, n;
+    double res = 0.0, px;
+
+    for (n = 0; n < 3; n++) {
+        org[n] = b[n] << RC_BRICK_LOG2;
+        end[n] = org[n] + RC_BRICK_LEN + 1;
+        end[n] = end[n] < dose->dim[n] ? end[n] : dose->dim[n];
+    }
+    for (k = org[2]; k < end[2]; k++) {
+        for (j = org[1]; j < end[1]; j++) {
+            for (i = org[0]; i < end[0]; i++) {
+                px = rc_dose_voxel(dose, rc_dose_offset(dose, i, j, k));
+                res = rc_fmax(px, res);
+            }
+        }
+    }
+    return (float)res;
+}
+
+
+/** @brief Relax the distance at brick @p n against its neighbor at offset
+ *      (@p di, @p dj, @p dk), if there is one
+ *  @param bricks
+ *      Brick map
+ *  @param b
+ *      Coordinates of brick @p n
+ *  @param n
+ *      Linear brick index
+ *  @param di
+ *      First offset
+ *  @param dj
+ *      Second offset
+ *  @param dk
+ *      Third offset
+ */
+static void rc_bricks_relax(struct rc_bricks *bricks,
+                            const unsigned    b[],
+                            size_t            n,
+                            int               di,
+                            int               dj,
+                            int               dk)
+{
+    const long ni = (long)b[0] + di, nj = (long)b[1] + dj, nk = (long)b[2] + dk;
+    long offs;
+    unsigned d;
+
+    if (ni < 0 || nj < 0 || nk < 0
+     || ni >= (long)bricks->dim[0]
+     || nj >= (long)bricks->dim[1]
+     || nk >= (long)bricks->dim[2]) {
+        return;
+    }
+    offs = di + (long)bricks->dim[0] * (dj + (long)bricks->dim[1] * dk);
+    d = bricks->dist[n + offs];
+    d = d < UINT8_MAX ? d + 1 : d;
+    bricks->dist[n] = d < bricks->dist[n] ? d : bricks->dist[n];
+}
+
+
+/** @brief Make one chamfer pass over the distance map
+ *  @param bricks
+ *      Brick map
+ *  @param dir
+ *      1 for the forward pass, -1 for the backward pass. Each pass looks at
+ *      the 13 neighbors that precede a brick in its own direction, and the two
+ *      together compute exact Chebyshev distances
+ */
+static void rc_bricks_chamfer(struct rc_bricks *bricks, int dir)
+{
+    const size_t len = (size_t)bricks->dim[0] * bricks->dim[1] * bricks->dim[2];
+    unsigned b[3];
+    size_t i, n;
+    int di, dj;
+
+    for (i = 0; i < len; i++) {
+        n = dir > 0 ? i : len - 1 - i;
+        b[0] = n % bricks->dim[0];
+        b[1] = n / bricks->dim[0] % bricks->dim[1];
+        b[2] = n / bricks->dim[0] / bricks->dim[1];
+        for (dj = -1; dj <= 1; dj++) {
+            for (di = -1; di <= 1; di++) {
+                rc_bricks_relax(bricks, b, n, di * dir, dj * dir, -dir);
+            }
+        }
+        for (di = -1; di <= 1; di++) {
+            rc_bricks_relax(bricks, b, n, di * dir, -dir, 0);
+        }
+        rc_bricks_relax(bricks, b, n, -dir, 0, 0);
+    }
+}
+
+
+/** @brief Find the maximum of the (up to) eight children of node @p c
+ *  @param src
+ *      Maxima of the finer level
+ *  @param sdim
+ *      Dimensions of the finer level
+ *  @param c
+ *      Node coordinates in the coarser level
+ *  @returns The largest child maximum
+ */
+static float rc_bricks_nodemax(const float    *src,
+                               const unsigned  sdim[],
+                               const unsigned  c[])
+{
+    unsigned org[3], end[3], i, j, k, n;
+    float res = 0.0f;
+
+    for (n = 0; n < 3; n++) {
+        org[n] = c[n] << 1;
+        end[n] = org[n] + 2 < sdim[n] ? org[n] + 2 : sdim[n];
+    }
+    for (k = org[2]; k < end[2]; k++) {
+        for (j = org[1]; j < end[1]; j++) {
+            for (i = org[0]; i < end[0]; i++) {
+                res = rc_fmaxf(src[i + sdim[0] * ((size_t)j + sdim[1] * k)],
+                              res);
+            }
+        }
+    }
+    return res;
+}
+
+
+/** @brief Build the max pyramid above the brick maxima, halving each dimension
+ *      (rounding up) until a single node is left
+ *  @param bricks
+ *      Brick map with its maxima filled
+ *  @returns Nonzero if there is not enough memory
+ */
+static int rc_bricks_pyramid(struct rc_bricks *bricks)
+{
+    const unsigned *sdim = bricks->dim;
+    const float *src = bricks->max;
+    struct rc_brick_level *lev;
+    unsigned c[3];
+    size_t n;
+    int k, kend;
+
+    while ((sdim[0] > 1 || sdim[1] > 1 || sdim[2] > 1)
+        && bricks->nlev < RC_BRICK_LEVELS) {
+        lev = &bricks->lev[bricks->nlev];
+        lev->dim[0] = (sdim[0] + 1) >> 1;
+        lev->dim[1] = (sdim[1] + 1) >> 1;
+        lev->dim[2] = (sdim[2] + 1) >> 1;
+        n = (size_t)lev->dim[0] * lev->dim[1] * lev->dim[2];
+        lev->max = malloc(sizeof *lev->max * n);
+        if (!lev->max) {
+            return 1;
+        }
+        bricks->nlev++;
+        kend = (int)lev->dim[2];
+
+#if _OPENMP
+#   pragma omp parallel for private(c, n)
+#endif /* _OPENMP */
+        for (k = 0; k < kend; k++) {
+            c[2] = k;
+            n = (size_t)lev->dim[0] * lev->dim[1] * k;
+            for (c[1] = 0; c[1] < lev->dim[1]; c[1]++) {
+                for (c[0] = 0; c[0] < lev->dim[0]; c[0]++, n++) {
+                    lev->max[n] = rc_bricks_nodemax(src, sdim, c);
+                }
+            }
+        }
+        sdim = lev->dim;
+        src = lev->max;
+    }
+    return 0;
+}
+
+
+/** @brief Size @p bricks for @p dose and allocate the brick maxima and
+ *      distances. Any previous contents of @p bricks are freed first
+ *  @param bricks
+ *      Brick map
+ *  @param dose
+ *      Dose volume with dimensions set
+ *  @param floor
+ *      Dose at or below which a brick is considered empty
+ *  @param[out] len
+ *      Brick count, which is zero if @p dose is empty. Then nothing is
+ *      allocated
+ *  @returns Nonzero if there is not enough memory, in which case @p bricks is
+ *      left empty and errno(3) is set
+ */
+static int rc_bricks_alloc(struct rc_bricks     *bricks,
+                           const struct rc_dose *dose,
+                           double                floor,
+                           size_t               *len)
+{
+    const unsigned mask = RC_BRICK_LEN - 1;
+
+    rc_bricks_clear(bricks);
+    bricks->floor = floor;
+    bricks->dim[0] = (dose->dim[0] + mask) >> RC_BRICK_LOG2;
+    bricks->dim[1] = (dose->dim[1] + mask) >> RC_BRICK_LOG2;
+    bricks->dim[2] = (dose->dim[2] + mask) >> RC_BRICK_LOG2;
+    *len = (size_t)bricks->dim[0] * bricks->dim[1] * bricks->dim[2];
+    if (!*len) {
+        rc_bricks_clear(bricks);
+        return 0;
+    }
+    bricks->max = malloc(sizeof *bricks->max * *len);
+    /* Padded so that the packet raycaster can gather 32 bits at a time */
+    bricks->dist = malloc(*len + sizeof (int32_t) - 1);
+    if (!bricks->max || !bricks->dist) {
+        rc_bricks_clear(bricks);
+        errno = ENOMEM;
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Mark the empty bricks by their maxima, find the distance from each
+ *      to the nearest nonempty one and build the max pyramid
+ *  @param bricks
+ *      Brick map with its maxima filled
+ *  @param len
+ *      Brick count
+ *  @returns Nonzero if there is not enough memory, in which case @p bricks is
+ *      left empty and errno(3) is set
+ */
+static int rc_bricks_finish(struct rc_bricks *bricks, size_t len)
+{
+    size_t n;
+
+    for (n = 0; n < len; n++) {
+        bricks->dist[n] = bricks->max[n] > bricks->floor ? 0 : UINT8_MAX;
+    }
+    memset(bricks->dist + len, 0, sizeof (int32_t) - 1);
+    rc_bricks_chamfer(bricks, 1);
+    rc_bricks_chamfer(bricks, -1);
+    if (rc_bricks_pyramid(bricks)) {
+        rc_bricks_clear(bricks);
+        errno = ENOMEM;
+        return 1;
+    }
+    return 0;
+}
+
+
+int rc_bricks_build(struct rc_bricks     *bricks,
+                    const struct rc_dose *dose,
+                    double                floor)
+{
+    unsigned b[3];
+    size_t len, n;
+    int k, kend;
+
+    if (rc_bricks_alloc(bricks, dose, floor, &len)) {
+        return 1;
+    }
+    if (!dose->data || !len) {
+        rc_bricks_clear(bricks);
+        return 0;
+    }
+    kend = (int)bricks->dim[2];
+
+#if _OPENMP
+#   pragma omp parallel for private(b, n)
+#endif /* _OPENMP */
+    for (k = 0; k < kend; k++) {
+        b[2] = k;
+        n = (size_t)bricks->dim[0] * bricks->dim[1] * k;
+        for (b[1] = 0; b[1] < bricks->dim[1]; b[1]++) {
+            for (b[0] = 0; b[0] < bricks->dim[0]; b[0]++, n++) {
+                bricks->max[n] = rc_bricks_pxmax(dose, b);
+            }
+        }
+    }
+    return rc_bricks_finish(bricks, len);
+}
+
+
+int rc_bricks_load(struct rc_bricks     *bricks,
+                   const struct rc_dose *dose,
+                   const float          *max,
+                   double                floor)
+{
+    size_t len;
+
+    if (rc_bricks_alloc(bricks, dose, floor, &len)) {
+        return 1;
+    }
+    if (!len) {
+        return 0;
+    }
+    memcpy(bricks->max, max, sizeof *bricks->max * len);
+    return rc_bricks_finish(bricks, len);
+}
+
+
+void rc_bricks_clear(struct rc_bricks *bricks)
+{
+    while (bricks->nlev) {
+        bricks->nlev--;
+        free(bricks->lev[bricks->nlev].max);
+        bricks->lev[bricks->nlev].max = NULL;
+    }
+    free(bricks->max);
+    free(bricks->dist);
+    bricks->max = NULL;
+    bricks->dist = NULL;
+    bricks->dim[0] = 0;
+    bricks->dim[1] = 0;
+    bricks->dim[2] = 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef RC_BRICK_H
+#define RC_BRICK_H
+
+#include <stdint.h>
+
+#if defined(__cplusplus) && __cplusplus
+extern "C" {
+#endif
+
+
+/** Base-two logarithm of the brick edge length */
+#define RC_BRICK_LOG2 3
+
+/** Brick edge length in pixels */
+#define RC_BRICK_LEN (1 << RC_BRICK_LOG2)
+
+/** Maximum number of levels in the max pyramid above the bricks themselves.
+ *  This is enough for any volume that can be addressed with 32-bit indices */
+#define RC_BRICK_LEVELS 29
+
+
+struct rc_dose;
+
+
+/** One level of the max pyramid. Node (i, j, k) of level l (counting from
+ *  zero) covers bricks 2^(l + 1) * (i, j, k) up to 2^(l + 1) * (i + 1, j + 1,
+ *  k + 1), and holds the largest of their maxima
+ */
+struct rc_brick_level {
+    unsigned dim[3];    /* Node grid dimensions */
+    float   *max;       /* Maximum dose in each node */
+};
+
+
+/** A coarse grid of cubic bricks over a dose volume, used by rays to leap over
+ *  empty space. Brick (i, j, k) covers pixel coordinates from LEN * (i, j, k)
+ *  up to (but not including) LEN * (i + 1, j + 1, k + 1). Its maximum also
+ *  includes the pixels on those upper faces, which is every pixel that either
+ *  interpolator might read for a sample taken inside of it
+ */
+struct rc_bricks {
+    unsigned dim[3];    /* Brick grid dimensions */
+    double   floor;     /* Bricks with a maximum at or below this are empty */
+    float   *max;       /* Maximum dose in each brick */
+    uint8_t *dist;      /* Chebyshev distance to the nearest nonempty brick,
+                        saturating at 255 */
+
+    unsigned              nlev;                     /* Pyramid level count */
+    struct rc_brick_level lev[RC_BRICK_LEVELS];     /* Max pyramid, finest
+                                                    first. The last level is a
+                                                    single node */
+};
+
+
+/** @brief Build the brick map of @p dose and its max pyramid. Any previous
+ *      contents of @p bricks are freed first
+ *  @param bricks
+ *      Brick map
+ *  @param dose
+ *      Dose volume with pixel data
+ *  @param floor
+ *      Dose (NOT a proportion) at or below which a brick is considered empty
+ *  @returns Nonzero if there is not enough memory, in which case @p bricks is
+ *      left empty and errno(3) is set
+ */
+int rc_bricks_build(struct rc_bricks     *bricks,
+                    const struct rc_dose *dose,
+                    double                floor);
+
+
+/** @brief Build the brick map of @p dose from brick maxima found before, e.g.
+ *      by a cache, without reading any voxels. Any previous contents of
+ *      @p bricks are freed first
+ *  @param bricks
+ *      Brick map
+ *  @param dose
+ *      Dose volume with dimensions set
+ *  @param max
+ *      Maximum dose in each brick, in the order of rc_bricks::max
+ *  @param floor
+ *      Dose (NOT a proportion) at or below which a brick is considered empty
+ *  @returns Nonzero if there is not enough memory, in which case @p bricks is
+ *      left empty and errno(3) is set
+ */
+int rc_bricks_load(struct rc_bricks     *bricks,
+                   const struct rc_dose *dose,
+                   const float          *max,
+                   double                floor);
+
+
+/** @brief Free the brick map
+ *  @param bricks
+ *      Brick map. This is left empty, and rays will not skip with it
+ */
+void rc_bricks_clear(struct rc_bricks *bricks);
+
+
+#if defined(__cplusplus) && __cplusplus
+}
+#endif
+
+#endif /* RC_BRICK_H */
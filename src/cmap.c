@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <stdlib.h>
 #include "cmap.h"
 #include "rcmath.h"
 
@@ -48,3 +50,71 @@ void dose_cmap_init(struct dose_cmap *cmap, double dosemax)
     cmap->base.func = dose_cmapfn;
     cmap->norm = 1.0 / dosemax;
 }
+
+
+/** @brief Look up a single dose. This is the rc_colormap function of every
+ *      table
+ */
+static void rc_cmap_lutfn(struct rc_colormap *this, double dose, void *pixel)
+{
+    const struct rc_cmap_lut *lut = (struct rc_cmap_lut *)this;
+    double idx;
+
+    idx = rc_fclamp(dose * lut->scale + 0.5, 0.0, (double)lut->len - 1.0);
+    *(uint32_t *)pixel = lut->px[isnan(idx) ? 0 : (unsigned)idx];
+}
+
+
+int rc_cmap_lut_bake(struct rc_cmap_lut *lut,
+                     struct rc_colormap *cmap,
+                     double              dosemax)
+{
+    const unsigned len = RC_CMAP_LUT_LEN;
+    unsigned i;
+
+    rc_cmap_lut_clear(lut);
+    lut->px = malloc(sizeof *lut->px * len);
+    if (!lut->px) {
+        errno = ENOMEM;
+        return 1;
+    }
+    lut->base.func = rc_cmap_lutfn;
+    lut->len = len;
+    lut->scale = (float)((len - 1) / dosemax);
+    for (i = 0; i < len; i++) {
+        cmap->func(cmap, (double)i / lut->scale, &lut->px[i]);
+    }
+    return 0;
+}
+
+
+struct rc_cmap_lut *rc_cmap_lut_cast(struct rc_colormap *cmap)
+{
+    return cmap->func == rc_cmap_lutfn ? (struct rc_cmap_lut *)cmap : NULL;
+}
+
+
+void rc_cmap_lut_map(const struct rc_cmap_lut *lut,
+                     const float               dose[],
+                     size_t                    count,
+                     void                     *pixels)
+{
+    uint32_t *px = pixels;
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i *)(px + i),
+                            rc_cmap_lut_map8(lut, _mm256_loadu_ps(dose + i)));
+    }
+    for (; i < count; i++) {
+        rc_cmap_lutfn((struct rc_colormap *)lut, dose[i], px + i);
+    }
+}
+
+
+void rc_cmap_lut_clear(struct rc_cmap_lut *lut)
+{
+    free(lut->px);
+    lut->px = NULL;
+    lut->len = 0;
+}
@@ -3,9 +3,15 @@
 #ifndef RC_CMAP_H
 #define RC_CMAP_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "dose.h"
 
 
+/** Default number of table entries */
+#define RC_CMAP_LUT_LEN 2048
+
+
 /** Colormap base class. You know what to do with this.
  *  Do note that the raycasting function is aggressively multithreaded, so
  *  contentious actions within the callback should be fenced and sparse
@@ -32,4 +38,84 @@ struct dose_cmap {
 void dose_cmap_init(struct dose_cmap *cmap, double dosemax);
 
 
+/** Any colormap baked into a table of four-byte pixels. Doses are rounded to
+ *  the nearest entry and clamped to the range of the table. The raycaster
+ *  recognizes this and colormaps whole packets with it
+ */
+struct rc_cmap_lut {
+    struct rc_colormap base;
+
+    unsigned  len;      /* Number of entries */
+    float     scale;    /* Entries per unit dose */
+    uint32_t *px;       /* The table */
+};
+
+
+/** @brief Bake @p cmap into @p lut
+ *  @param lut
+ *      Table. Any previous table is freed
+ *  @param cmap
+ *      Colormap to sample. Its pixels must be four bytes wide
+ *  @param dosemax
+ *      The table spans zero to this
+ *  @returns Nonzero if there is not enough memory, in which case errno(3) is
+ *      set and @p lut is empty
+ */
+int rc_cmap_lut_bake(struct rc_cmap_lut *lut,
+                     struct rc_colormap *cmap,
+                     double              dosemax);
+
+
+/** @brief Check if @p cmap is a table
+ *  @param cmap
+ *      Colormap
+ *  @returns @p cmap as a table, or NULL if it is something else
+ */
+struct rc_cmap_lut *rc_cmap_lut_cast(struct rc_colormap *cmap);
+
+
+/** @brief Look up eight doses at once
+ *  @param lut
+ *      Table
+ *  @param dose
+ *      Doses
+ *  @returns The pixels
+ */
+static inline __m256i rc_cmap_lut_map8(const struct rc_cmap_lut *lut,
+                                       __m256                    dose)
+{
+    const __m256i last = _mm256_set1_epi32((int)lut->len - 1);
+    __m256i idx;
+
+    /* NaN converts to INT_MIN and lands on the first entry */
+    idx = _mm256_cvtps_epi32(_mm256_mul_ps(dose, _mm256_set1_ps(lut->scale)));
+    idx = _mm256_max_epi32(idx, _mm256_setzero_si256());
+    idx = _mm256_min_epi32(idx, last);
+    return _mm256_i32gather_epi32((const int *)lut->px, idx, 4);
+}
+
+
+/** @brief Colormap an array of doses to packed pixels
+ *  @param lut
+ *      Table
+ *  @param dose
+ *      Doses
+ *  @param count
+ *      Number of @p dose
+ *  @param pixels
+ *      Destination, @p count four-byte pixels
+ */
+void rc_cmap_lut_map(const struct rc_cmap_lut *lut,
+                     const float               dose[],
+                     size_t                    count,
+                     void                     *pixels);
+
+
+/** @brief Free the table
+ *  @param lut
+ *      Table
+ */
+void rc_cmap_lut_clear(struct rc_cmap_lut *lut);
+
+
 #endif /* RC_CMAP_H */
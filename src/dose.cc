@@ -1,7 +1,18 @@
+#include <algorithm>
 #include <array>
+#include <cerrno>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcfilefo.h>
+#include <dcmtk/dcmdata/dcxfer.h>
 #include <dcmtk/dcmrt/drmdose.h>
 #include "dose.h"
+#include "mapfile.h"
 
 
 /** @brief Throw @p stat if stat.bad()
@@ -30,6 +41,136 @@ static void rc_dose_update_bounds(struct rc_dose *dose)
 }
 
 
+/** @brief Count the voxels of storage of @p dose
+ *  @param dose
+ *      Dose with stored dimensions, layout and brick counts set
+ *  @returns The number of voxels of storage the layout needs, including the
+ *      border and the padding of partial bricks
+ */
+static size_t rc_dose_storage(const struct rc_dose *dose)
+    noexcept
+{
+    if (dose->layout == RC_DOSE_BRICKED) {
+        return (size_t)dose->bdim[0] * dose->bdim[1] * dose->bdim[2]
+            << 3 * RC_BRICK_LOG2;
+    }
+    return (size_t)(dose->sdim[0] + RC_DOSE_PAD)
+        * (dose->sdim[1] + RC_DOSE_PAD)
+        * (dose->sdim[2] + RC_DOSE_PAD);
+}
+
+
+/** @brief Store @p dose whole for its dimensions, rather than as a view, and
+ *      update its brick counts
+ *  @param dose
+ *      Dose with dimensions array and layout set
+ *  @returns rc_dose_storage
+ */
+static size_t rc_dose_update_storage(struct rc_dose *dose)
+    noexcept
+{
+    unsigned a;
+
+    for (a = 0; a < 3; a++) {
+        dose->sdim[a] = dose->dim[a];
+        dose->org[a] = 0;
+        dose->bdim[a] = (dose->dim[a] + RC_DOSE_PAD + RC_BRICK_LEN - 1)
+                     >> RC_BRICK_LOG2;
+    }
+    return rc_dose_storage(dose);
+}
+
+
+/** @brief Call @p fn with a value of the voxel type of @p fmt, so that it can
+ *      be specialized on it
+ *  @param fmt
+ *      Storage format
+ *  @param fn
+ *      Generic callable
+ *  @returns Whatever @p fn returns
+ */
+template <class Fn>
+static auto rc_dose_dispatch(enum rc_dose_fmt fmt, Fn &&fn)
+{
+    switch (fmt) {
+    case RC_DOSE_F32:
+        return fn(float());
+    case RC_DOSE_U16:
+        return fn(uint16_t());
+    case RC_DOSE_U32:
+        return fn(uint32_t());
+    default:
+        return fn(double());
+    }
+}
+
+
+/** @brief Get the size of one voxel
+ *  @param fmt
+ *      Storage format
+ *  @returns The size of a voxel in bytes
+ */
+static size_t rc_dose_fmt_size(enum rc_dose_fmt fmt)
+    noexcept
+{
+    return rc_dose_dispatch(fmt, [](auto t) { return sizeof t; });
+}
+
+
+/** @brief Allocate pixel data
+ *  @param fmt
+ *      Storage format
+ *  @param len
+ *      Voxel count
+ *  @returns The zeroed pixel data, or NULL if there is not enough memory.
+ *      There is one voxel of padding at the end, so that packets can gather
+ *      16-bit voxels four bytes at a time. The padding of partial bricks is
+ *      never sampled, but zeroing it means nothing uninitialized is ever read
+ */
+static void *rc_dose_alloc(enum rc_dose_fmt fmt, size_t len)
+    noexcept
+{
+    const size_t size = (len + 1) * rc_dose_fmt_size(fmt);
+
+    return new (std::nothrow) unsigned char[size]();
+}
+
+
+/** @brief Free the pixel data of @p dose if it was allocated by rc_dose_alloc
+ *      for it rather than shared
+ *  @param dose
+ *      Dose, whose pixel data may be NULL. It is left NULL
+ */
+static void rc_dose_free(struct rc_dose *dose)
+    noexcept
+{
+    if (!dose->shared) {
+        delete[] static_cast<unsigned char *>(dose->data);
+    }
+    dose->data = NULL;
+    dose->shared = 0;
+}
+
+
+/** @brief Convert a dose to voxel type T
+ *  @param px
+ *      Dose
+ *  @param scale
+ *      Dose of one unit of integer types
+ *  @returns The voxel closest to @p px
+ */
+template <class T>
+static T rc_dose_quantize(double px, double scale)
+    noexcept
+{
+    if constexpr (std::is_integral_v<T>) {
+        px = std::rint(px / scale);
+        px = std::clamp(px, 0.0, (double)std::numeric_limits<T>::max());
+    }
+    return static_cast<T>(px);
+}
+
+
 /** @brief Load image dimensions
  *  @param dose
  *      Dose container
@@ -134,410 +275,2597 @@ static std::ostream &operator<<(std::ostream &os, vec_t v)
 }
 
 
-/** @brief Compute the centroid of the dose
+/** @brief Set the centroid of @p dose from its dose-weighted sums
  *  @param dose
- *      Dose
+ *      Dose with its affine matrix set
+ *  @param sum
+ *      Sums of each pixel coordinate times the dose there, then of the dose
  */
-static void rc_dose_get_centroid(struct rc_dose *dose)
+static void rc_dose_set_centroid(struct rc_dose *dose, const double sum[])
     noexcept
 {
-    union {
-        __m128i  idx;
-        unsigned xmm[4];
-    } u = { .xmm = { 0, 0, 0, 1 } };
-    vec_t sum, pos;
-    size_t i = 0;
-
-    sum = rc_zero();
-    for (u.xmm[2] = 0; u.xmm[2] < dose->dim[2]; u.xmm[2]++) {
-        for (u.xmm[1] = 0; u.xmm[1] < dose->dim[1]; u.xmm[1]++) {
-            for (u.xmm[0] = 0; u.xmm[0] < dose->dim[0]; u.xmm[0]++, i++) {
-                pos = rc_cvtep(u.idx);
-                sum = rc_fmadd(pos, rc_set1((scal_t)dose->data[i]), sum);
-            }
-        }
-    }
-    dose->centr = rc_vhproj(sum);
+    const double w = sum[3] > 0.0 ? sum[3] : 1.0;
+
+    dose->centr = rc_set((scal_t)(sum[0] / w),
+                         (scal_t)(sum[1] / w),
+                         (scal_t)(sum[2] / w),
+                         1.0);
     std::cout << "Centroid in pixel coordinates:   " << dose->centr << '\n';
     dose->centr = rc_mvmul4(dose->mat, dose->centr);
     std::cout << "Centroid in ambient coordinates: " << dose->centr << '\n';
 }
 
 
-/** @brief Fetch the pixel data
- *  @param dose
- *      Dose container
- *  @param rd
- *      RTDose
+/** Cell count of the histogram sketch, one for each exponent and top eight
+ *  bits of mantissa of a positive float */
+#define RC_DOSE_SKETCH (1 << 16)
+
+
+/** @brief Find the cell of the histogram sketch that @p px falls in
+ *  @param px
+ *      Dose
+ *  @returns The top bits of @p px as a float below the sign, or zero if @p px
+ *      is not positive
  */
-static void rc_dose_get_pixels(struct rc_dose *dose, const DRTDose &rd)
+static unsigned rc_dose_sketch_cell(double px)
+    noexcept
 {
-    const size_t framelen = (size_t)dose->dim[0] * dose->dim[1];
-    const size_t len = framelen * dose->dim[2];
-    std::unique_ptr<double[]> data;
-    std::vector<Float64> image;
-    unsigned long k;
-    double *dest;
+    const float f = static_cast<float>(px);
+    uint32_t bits;
 
-    dose->dmax = 0.0;
-    dose->centr = rc_set(0, 0, 0, 1);
-    data.reset(new (std::nothrow) double[len]);
-    if (!data) {
-        throw OFCondition(0,
-                          0,
-                          OF_error,
-                          len ? "Not enough memory" : "Empty image");
-    }
-    dest = data.get();
-    for (k = 0; k < dose->dim[2]; k++) {
-        ofthrow(rd.getDoseImage(image, k));
-        for (double px: image) {
-            dose->dmax = std::max(dose->dmax, px);
-            *dest++ = px;
-        }
+    if (!(px > 0.0)) {
+        return 0;
     }
-    dose->data = data.release();
+    std::memcpy(&bits, &f, sizeof bits);
+    return bits >> 15;
 }
 
 
-/** @brief Load all of the relevant data from @p rd
- *  @param dose
- *      Dose container
- *  @param rd
- *      RTDose
- */
-static void rc_dose_get_data(struct rc_dose *dose, const DRTDose &rd)
-{
-    rc_dose_get_dimensions(dose, rd);
-    rc_dose_get_origin(dose, rd);
-    rc_dose_get_ortho(dose, rd);
-    rc_dose_get_spacing(dose, rd);
-    if (rc_matrix_invert(dose->mat, dose->inv)) {
-        throw OFCondition(0, 0, OF_error, "Dose matrix is singular");
+/** Statistics of the frames of a dose decoded by one thread */
+struct rc_dose_stats {
+    double              dmax = 0.0;
+    double              sum[4] = { 0.0, 0.0, 0.0, 0.0 };    /* Dose-weighted
+                                                        coordinate sums, then
+                                                        the total dose */
+    std::vector<double> prof;   /* Plane maxima along the first two axes */
+    std::vector<size_t> sketch; /* Voxel counts by rc_dose_sketch_cell */
+
+    explicit rc_dose_stats(const struct rc_dose *dose)
+        : prof(dose->dim[0] + dose->dim[1],
+               -std::numeric_limits<double>::infinity()),
+          sketch(RC_DOSE_SKETCH)
+    {
     }
-    rc_dose_get_pixels(dose, rd);
-    rc_dose_get_centroid(dose);
-}
+
+    void merge(const rc_dose_stats &part);
+    void finish(struct rc_dose *dose, double *prof) const;
+};
 
 
-extern "C" int rc_dose_load(struct rc_dose *dose, const char *dcm)
+/** @brief Add the statistics of another thread into these
+ *  @param part
+ *      Statistics of other frames of the same dose
+ */
+void rc_dose_stats::merge(const rc_dose_stats &part)
 {
-    OFCondition stat;
-    DRTDose rd;
-    int res = 0;
+    size_t c;
 
-    try {
-        stat = rd.loadFile(dcm);
-        if (stat.bad()) {
-            throw stat;
-        }
-        rc_dose_get_data(dose, rd);
-    } catch (const OFCondition &ofc) {
-        std::cerr << "dose error: " << ofc.text() << '\n';
-        res = 1;
+    dmax = std::max(dmax, part.dmax);
+    for (c = 0; c < 4; c++) {
+        sum[c] += part.sum[c];
+    }
+    for (c = 0; c < prof.size(); c++) {
+        prof[c] = std::max(prof[c], part.prof[c]);
+    }
+    for (c = 0; c < sketch.size(); c++) {
+        sketch[c] += part.sketch[c];
     }
-    return res;
 }
 
 
-extern "C" void rc_dose_clear(struct rc_dose *dose)
+/** @brief Store the merged statistics in @p dose
+ *  @param dose
+ *      Dose with its affine matrix set
+ *  @param prof
+ *      Storage for rc_dose::prof, whose plane maxima along the third axis are
+ *      already set. The rest are copied from these
+ */
+void rc_dose_stats::finish(struct rc_dose *dose, double *prof) const
 {
-    delete[] dose->data;
-    dose->data = NULL;
-    dose->dim[0] = 0;
-    dose->dim[1] = 0;
-    dose->dim[2] = 0;
+    uint32_t bits;
+    size_t b, c;
+    float f;
+
+    dose->dmax = dmax;
+    rc_dose_set_centroid(dose, sum);
+    std::fill_n(dose->hist, RC_DOSE_HIST, 0);
+    for (c = 0; c < sketch.size(); c++) {
+        bits = static_cast<uint32_t>(c) << 15;
+        std::memcpy(&f, &bits, sizeof f);
+        b = dmax > 0.0 ? static_cast<size_t>(f / dmax * RC_DOSE_HIST) : 0;
+        dose->hist[std::min<size_t>(b, RC_DOSE_HIST - 1)] += sketch[c];
+    }
+    std::copy(this->prof.begin(), this->prof.end(), prof);
+    dose->prof = prof;
 }
 
 
-/** @brief Check if @p idx is within the bounds of @p dose
- *  @param dose
- *      Dose volume
- *  @param idx
- *      Index vector
- *  @returns true if @p idx can safely index a pixel in @p dose, false othewise
+/** @brief Load four pixels of a decoded frame
+ *  @param src
+ *      Doses
+ *  @returns The doses
  */
-static bool rc_dose_bounds_check(const struct rc_dose *dose, __m128i idx)
+static __m256d rc_dose_load4(const Float64 *src)
     noexcept
 {
-    __m128i cmp;
-    
-    cmp = _mm_cmplt_epi32(idx, _mm_setzero_si128());
-    cmp = _mm_or_si128(cmp, _mm_cmpgt_epi32(idx, dose->ubnd));
-    return _mm_testz_si128(cmp, cmp);
+    return _mm256_loadu_pd(src);
 }
 
 
-/** @brief Access the dose at coordinates @p idx
- *  @param dose
- *      Dose volume
- *  @param idx
- *      Index vector
- *  @returns The dose value at @p idx. This includes zero if @p idx is out-of-
- *      bounds
+/** @brief Load four raw 16-bit pixels
+ *  @param src
+ *      Unsigned pixels
+ *  @returns The pixels, exactly
  */
-static double rc_dose_access(const struct rc_dose *dose, __m128i idx)
+static __m256d rc_dose_load4(const Uint16 *src)
     noexcept
 {
-    union {
-        __m128i idx;
-        int     xmm[4];
-    } u;
-    unsigned n;
+    const __m128i u = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src));
 
-    u.idx = idx;
-    n = u.xmm[0] + dose->dim[0] * (u.xmm[1] + dose->dim[1] * u.xmm[2]);
-    return rc_dose_bounds_check(dose, idx) ? dose->data[n] : 0.0;
+    return _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(u));
 }
 
 
-extern "C" double rc_dose_nearest(const struct rc_dose *dose, vec_t pos)
+/** @brief Load four raw 32-bit pixels
+ *  @param src
+ *      Unsigned pixels
+ *  @returns The pixels, exactly
+ */
+static __m256d rc_dose_load4(const Uint32 *src)
+    noexcept
 {
-    __m128i idx;
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
 
-    /* Use the default rounding mode on cvtps_epi32 */
-    //pos = rc_round(pos, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
-    idx = _mm_cvtps_epi32(pos);
-    return rc_dose_access(dose, idx);
+    /* There is no unsigned conversion, so shift them into signed range and
+    back */
+    u = _mm_xor_si128(u, bias);
+    return _mm256_add_pd(_mm256_cvtepi32_pd(u), _mm256_set1_pd(0x1p31));
 }
 
 
-union interpolant {
-    __m256d ymm[2];
-    __m128d xmm[4];
-    double  mm[8];
-
-
-    /** @brief Load the interpolant using cell origin coordinates @p org
-     *  @param dose
-     *      Dose from which to load
-     *  @param org
-     *      Origin coordinates of the interpolant cell
-     *  @note This prepares coefficients for repeated application of Horner's
-     *      rule. If you are only interpolating a single value before destroying
-     *      this object, this is overkill---use single()
-     */
-    void load(const struct rc_dose *dose, __m128i org) noexcept;
-
-    /** @brief Evaluate the interpolate at real unit-relative position @p pos
-     *  @param pos
-     *      Unitized cell coordinates within which to interpolate. These can
-     *      safely be out-of-range, but the result may not make much sense
-     *  @returns The interpolated value, always
-     */
-    double evaluate(vec_t pos) noexcept;
-
-    /** @brief Interpolate the dose at a single point, without computing/storing
-     *      polynomial coefficients
-     *  @param dose
-     *      Dose to be interpolated
-     *  @param org
-     *      Origin coordinates of the cell
-     *  @param pos
-     *      Sublattice pixel coordinates within the cell at @p org
-     *  @returns The interpolated value without fail
-     */
-    double single(const struct rc_dose *dose, __m128i org, vec_t pos) noexcept;
-
-private:
-    /** @brief Load the values of the dose function at the corners of a cell
-     *  @param dose
-     *      Dose from which to load
-     *  @param org
-     *      Origin coordinates of the cell to load
-     */
-    void load_corners(const struct rc_dose *dose, __m128i org) noexcept;
-};
-
-
-void interpolant::load(const struct rc_dose *dose, __m128i org)
+/** @brief Store four doses as voxel type T, the same as rc_dose_quantize
+ *  @param dest
+ *      Destination voxels
+ *  @param px
+ *      Doses
+ *  @param scale
+ *      Dose of one unit of integer types
+ */
+template <class T>
+static void rc_dose_store4(T *dest, __m256d px, double scale)
     noexcept
 {
-    load_corners(dose, org);
-    ymm[1] = _mm256_sub_pd(ymm[1], ymm[0]);
-    xmm[3] = _mm_sub_pd(xmm[3], xmm[2]);
-    xmm[1] = _mm_sub_pd(xmm[1], xmm[0]);
-    mm[7] -= mm[6];
-    mm[5] -= mm[4];
-    mm[3] -= mm[2];
-    mm[1] -= mm[0];
+    const __m256d top = _mm256_set1_pd(std::numeric_limits<T>::max());
+    const int round = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+    __m128i q;
+
+    if constexpr (std::is_same_v<T, double>) {
+        _mm256_storeu_pd(dest, px);
+    } else if constexpr (std::is_same_v<T, float>) {
+        _mm_storeu_ps(dest, _mm256_cvtpd_ps(px));
+    } else {
+        px = _mm256_round_pd(_mm256_div_pd(px, _mm256_set1_pd(scale)), round);
+        px = _mm256_min_pd(_mm256_max_pd(px, _mm256_setzero_pd()), top);
+        if constexpr (sizeof (T) == sizeof (uint16_t)) {
+            q = _mm256_cvtpd_epi32(px);
+            q = _mm_packus_epi32(q, q);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(dest), q);
+        } else {
+            px = _mm256_sub_pd(px, _mm256_set1_pd(0x1p31));
+            q = _mm_xor_si128(_mm256_cvtpd_epi32(px),
+                              _mm_set1_epi32(INT32_MIN));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dest), q);
+        }
+    }
 }
 
 
-double interpolant::evaluate(vec_t pos)
+/** @brief Convert a row of pixels of type S to voxel type T, four at a time
+ *  @param dest
+ *      Destination voxels
+ *  @param src
+ *      Source pixels
+ *  @param n
+ *      Pixel count
+ *  @param scaling
+ *      Dose of one unit of @p src
+ *  @param scale
+ *      Dose of one unit of integer types T
+ */
+template <class T, class S>
+static void rc_dose_convert_row(T        *dest,
+                                const S  *src,
+                                unsigned  n,
+                                double    scaling,
+                                double    scale)
     noexcept
 {
-    RC_ALIGN scal_t x[4];
+    const __m256d s = _mm256_set1_pd(scaling);
+    unsigned i;
 
-    rc_spill(x, pos);
-    ymm[0] = _mm256_fmadd_pd(ymm[1], _mm256_set1_pd(x[2]), ymm[0]);
-    xmm[0] = _mm_fmadd_pd(xmm[1], _mm_set1_pd(x[1]), xmm[0]);
-    return std::fma(mm[1], x[0], mm[0]);
+    for (i = 0; i + 4 <= n; i += 4) {
+        rc_dose_store4(dest + i, _mm256_mul_pd(rc_dose_load4(src + i), s),
+                       scale);
+    }
+    for (; i < n; i++) {
+        dest[i] = rc_dose_quantize<T>(src[i] * scaling, scale);
+    }
 }
 
 
-double interpolant::single(const struct rc_dose *dose, __m128i org, vec_t pos)
+/** @brief Store frame @p k of a dose in voxel type T and gather its statistics
+ *  @param dose
+ *      Dose container with dimensions, format and scale set
+ *  @param data
+ *      Its pixel data
+ *  @param src
+ *      The frame, either decoded into doses or raw pixels, a whole plane long
+ *  @param scaling
+ *      Dose of one unit of @p src
+ *  @param k
+ *      Frame index
+ *  @param st
+ *      Statistics of the frames decoded by this thread
+ *  @param zprof
+ *      Plane maxima along the third axis, of which this sets the @p k th
+ */
+template <class T, class S>
+static void rc_dose_put_frame(const struct rc_dose *dose,
+                              unsigned char        *data,
+                              const S              *src,
+                              double                scaling,
+                              unsigned              k,
+                              struct rc_dose_stats &st,
+                              double               *zprof)
     noexcept
 {
-    RC_ALIGN scal_t x[4];
-
-    load_corners(dose, org);
-    rc_spill(x, pos);
-    ymm[0] = _mm256_add_pd(_mm256_mul_pd(ymm[0], _mm256_set1_pd(1.0 - x[2])),
-                           _mm256_mul_pd(ymm[1], _mm256_set1_pd(x[2])));
-    xmm[0] = _mm_add_pd(_mm_mul_pd(xmm[0], _mm_set1_pd(1.0 - x[1])),
-                        _mm_mul_pd(xmm[1], _mm_set1_pd(x[1])));
-    return mm[0] * (1.0 - x[0]) + mm[1] * x[0];
+    const double lowest = -std::numeric_limits<double>::infinity();
+    double *xprof = st.prof.data(), *yprof = xprof + dose->dim[0];
+    double px, rmax, rsum, rmom, fmax = lowest;
+    unsigned i, j;
+    T *dest;
+
+    for (j = 0; j < dose->dim[1]; j++, src += dose->dim[0]) {
+        /* Rows land inside the border */
+        dest = reinterpret_cast<T *>(data) + rc_dose_offset(dose, 0, j, k);
+        rc_dose_convert_row(dest, src, dose->dim[0], scaling, dose->scale);
+        rmax = lowest;
+        rsum = 0.0;
+        rmom = 0.0;
+        for (i = 0; i < dose->dim[0]; i++) {
+            px = std::is_integral_v<T> ? dest[i] * dose->scale : dest[i];
+            rmax = std::max(rmax, px);
+            xprof[i] = std::max(xprof[i], px);
+            rsum += px;
+            rmom += i * px;
+            st.sketch[rc_dose_sketch_cell(px)]++;
+        }
+        yprof[j] = std::max(yprof[j], rmax);
+        fmax = std::max(fmax, rmax);
+        st.sum[0] += rmom;
+        st.sum[1] += j * rsum;
+        st.sum[2] += k * rsum;
+        st.sum[3] += rsum;
+    }
+    zprof[k] = fmax;
+    st.dmax = std::max(st.dmax, fmax);
 }
 
 
-void interpolant::load_corners(const struct rc_dose *dose, __m128i org)
-    noexcept
-{
-    __m128i up, xoffs, yoffs, loffs;
+/** Pixel data of an uncompressed little-endian RTDose, read in place */
+struct rc_dose_raw {
+    const void *data;       /* First pixel, or NULL if the frames have to be
+                            decoded by DCMTK */
+    Uint16      bits;       /* Bits allocated, 16 or 32 */
+    double      scaling;    /* DoseGridScaling */
+};
 
-    up = _mm_add_epi32(org, _mm_set_epi32(0, 1, 0, 0));
-    xoffs = _mm_set_epi32(0, 0, 0, 1);
-    yoffs = _mm_set_epi32(0, 0, 1, 0);
-    loffs = _mm_set_epi32(0, 0, 1, 1);
 
-    mm[0] = rc_dose_access(dose, org);
-    mm[1] = rc_dose_access(dose, _mm_add_epi32(org, xoffs));
-    mm[2] = rc_dose_access(dose, _mm_add_epi32(org, yoffs));
-    mm[3] = rc_dose_access(dose, _mm_add_epi32(org, loffs));
-    mm[4] = rc_dose_access(dose, up);
-    mm[5] = rc_dose_access(dose, _mm_add_epi32(up, xoffs));
-    mm[6] = rc_dose_access(dose, _mm_add_epi32(up, yoffs));
-    mm[7] = rc_dose_access(dose, _mm_add_epi32(up, loffs));
+/** @brief Find the pixel data of @p rd in @p dataset, if it can be converted
+ *      in place. That takes unsigned 16- or 32-bit pixels that use every bit
+ *      they are allocated, in a little-endian transfer syntax, without
+ *      compression, on a little-endian machine, so that the bytes are as they
+ *      were in the file and DCMTK would not mask any of them
+ *  @param dose
+ *      Dose container with dimensions set
+ *  @param rd
+ *      RTDose
+ *  @param dataset
+ *      The dataset @p rd was read from
+ *  @returns The raw pixel data, whose data is NULL if there is no fast path
+ */
+static struct rc_dose_raw rc_dose_get_raw(const struct rc_dose *dose,
+                                          const DRTDose        &rd,
+                                          DcmDataset           &dataset)
+{
+    const size_t len = (size_t)dose->dim[0] * dose->dim[1] * dose->dim[2];
+    const DcmXfer xfer(dataset.getOriginalXfer());
+    struct rc_dose_raw raw = { NULL, 0, 0.0 };
+    const Uint16 *words = NULL;
+    unsigned long count = 0;
+    Float64 scaling = 0.0;
+    Uint16 bits = 0, stored = 0, high = 0, repr = 1;
+
+    if (xfer.isEncapsulated()
+     || xfer.getByteOrder() != EBO_LittleEndian
+     || gLocalByteOrder != EBO_LittleEndian
+     || rd.getBitsAllocated(bits).bad()
+     || (bits != 16 && bits != 32)
+     || rd.getBitsStored(stored).bad()
+     || stored != bits
+     || rd.getHighBit(high).bad()
+     || high != bits - 1
+     || rd.getPixelRepresentation(repr).bad()
+     || repr
+     || rd.getDoseGridScaling(scaling).bad()
+     || !(scaling > 0.0)
+     || dataset.findAndGetUint16Array(DCM_PixelData, words, &count).bad()
+     || !words
+     || count < len * (bits / 16)) {
+        return raw;
+    }
+    raw.data = words;
+    raw.bits = bits;
+    raw.scaling = scaling;
+    return raw;
 }
 
 
-extern "C" double rc_dose_linear(const struct rc_dose *dose, vec_t pos)
+/** @brief Find the largest raw 32-bit pixel
+ *  @param dose
+ *      Dose container with dimensions set
+ *  @param raw
+ *      Raw pixel data of 32 bits
+ *  @returns The largest pixel, times DoseGridScaling
+ */
+static double rc_dose_raw_max(const struct rc_dose     *dose,
+                              const struct rc_dose_raw &raw)
+    noexcept
 {
-    union interpolant interp;
-    __m128i org;
-
-    pos = rc_vdecomp(pos, &org);
-    return interp.single(dose, org, pos);
+    const size_t plane = (size_t)dose->dim[0] * dose->dim[1];
+    const int kend = static_cast<int>(dose->dim[2]);
+    const Uint32 *src;
+    Uint32 max = 0;
+    size_t n;
+    int k;
+
+#if _OPENMP
+#   pragma omp parallel for private(src, n) reduction(max: max)
+#endif /* _OPENMP */
+    for (k = 0; k < kend; k++) {
+        src = static_cast<const Uint32 *>(raw.data) + plane * k;
+        for (n = 0; n < plane; n++) {
+            max = std::max(max, src[n]);
+        }
+    }
+    return max * raw.scaling;
 }
 
 
-/** @brief Find the indices in each dimension of the last dose point above
- *      @p threshold
+/** @brief Pick the dose of one unit of an integer storage format. This is the
+ *      DoseGridScaling of @p rd, unless the stored integers are wider than the
+ *      format, in which case the doses are requantized over their max
  *  @param dose
- *      Dose volume
- *  @param threshold
- *      Threshold dose
- *  @param org
- *      Origin indices of the rectangle
- *  @param end
- *      Ending indices of the rectangle
+ *      Dose container with dimensions and format set
+ *  @param rd
+ *      RTDose
+ *  @param raw
+ *      Its raw pixel data, if they can be read in place
+ *  @note The frames may be decoded by several threads at once, so the pixel
+ *      data of @p rd must already be in memory
  */
-static void rc_dose_findbounds(const struct rc_dose *dose,
-                               double                threshold,
-                               unsigned              org[],
-                               unsigned              end[])
+static void rc_dose_get_scale(struct rc_dose           *dose,
+                              const DRTDose            &rd,
+                              const struct rc_dose_raw &raw)
+{
+    const double limit = dose->fmt == RC_DOSE_U16 ? UINT16_MAX : UINT32_MAX;
+    const int kend = static_cast<int>(dose->dim[2]);
+    std::vector<Float64> image;
+    OFCondition stat;
+    Float64 scaling = 0.0;
+    double max = 0.0;
+    Uint16 bits = 0;
+    int k;
+
+    if (rd.getDoseGridScaling(scaling).bad() || !(scaling > 0.0)) {
+        scaling = 1.0;
+    }
+    if (dose->fmt == RC_DOSE_U16 && raw.data) {
+        max = raw.bits > 16 ? rc_dose_raw_max(dose, raw) : 0.0;
+    } else if (dose->fmt == RC_DOSE_U16
+            && (rd.getBitsAllocated(bits).bad() || bits > 16)) {
+
+#if _OPENMP
+#   pragma omp parallel for private(image) reduction(max: max) \
+                            schedule(dynamic)
+#endif /* _OPENMP */
+        for (k = 0; k < kend; k++) {
+            OFCondition res = rd.getDoseImage(image, k);
+
+            if (res.bad()) {
+#if _OPENMP
+#   pragma omp critical(rc_dose_ingest)
+#endif /* _OPENMP */
+                stat = res;
+                continue;
+            }
+            for (double px: image) {
+                max = std::max(max, px);
+            }
+        }
+        ofthrow(stat);
+    }
+    dose->scale = std::max(scaling, max / limit);
+}
+
+
+/** @brief Fetch the pixel data in the storage format of @p dose. Frames are
+ *      converted in parallel straight into the pixel data, and the max,
+ *      centroid, histogram and plane maxima are reduced along the way
+ *  @param dose
+ *      Dose container with dimensions and affine matrix set
+ *  @param rd
+ *      RTDose
+ *  @param dataset
+ *      The dataset @p rd was read from, with all of its data in memory. If
+ *      its pixel data can be read in place, the frames are converted from it
+ *      rather than decoded by @p rd
+ */
+static void rc_dose_get_pixels(struct rc_dose *dose,
+                               const DRTDose  &rd,
+                               DcmDataset     &dataset)
+{
+    const size_t plane = (size_t)dose->dim[0] * dose->dim[1];
+    const struct rc_dose_raw raw = rc_dose_get_raw(dose, rd, dataset);
+    const Uint16 *raw16 = static_cast<const Uint16 *>(raw.data);
+    const Uint32 *raw32 = static_cast<const Uint32 *>(raw.data);
+    std::unique_ptr<unsigned char[]> data;
+    std::unique_ptr<double[]> prof;
+    std::vector<Float64> image;
+    rc_dose_stats total(dose);
+    OFCondition stat;
+    double *zprof;
+    size_t len;
+    int k, kend;
+
+    dose->scale = 1.0;
+    dose->layout = RC_DOSE_LINEAR;
+    len = rc_dose_update_storage(dose);
+    data.reset(static_cast<unsigned char *>(rc_dose_alloc(dose->fmt, len)));
+    prof.reset(new (std::nothrow) double[dose->dim[0]
+                                         + dose->dim[1]
+                                         + dose->dim[2]]);
+    if (!data || !prof) {
+        throw OFCondition(0,
+                          0,
+                          OF_error,
+                          len ? "Not enough memory" : "Empty image");
+    }
+    kend = static_cast<int>(dose->dim[2]);
+    zprof = prof.get() + dose->dim[0] + dose->dim[1];
+    if (dose->fmt == RC_DOSE_U16 || dose->fmt == RC_DOSE_U32) {
+        rc_dose_get_scale(dose, rd, raw);
+    }
+
+#if _OPENMP
+#   pragma omp parallel private(image)
+#endif /* _OPENMP */
+    {
+        rc_dose_stats part(dose);
+
+#if _OPENMP
+#   pragma omp for schedule(dynamic)
+#endif /* _OPENMP */
+        for (k = 0; k < kend; k++) {
+            OFCondition res;
+
+            if (raw.data) {
+                rc_dose_dispatch(dose->fmt, [&](auto t) {
+                    using T = decltype(t);
+
+                    if (raw.bits == 16) {
+                        rc_dose_put_frame<T>(dose, data.get(),
+                                             raw16 + plane * k, raw.scaling,
+                                             k, part, zprof);
+                    } else {
+                        rc_dose_put_frame<T>(dose, data.get(),
+                                             raw32 + plane * k, raw.scaling,
+                                             k, part, zprof);
+                    }
+                });
+                continue;
+            }
+            res = rd.getDoseImage(image, k);
+            if (res.good()
+             && image.size() < plane) {
+                res = OFCondition(0, 0, OF_error, "Short frame");
+            }
+            if (res.bad()) {
+#if _OPENMP
+#   pragma omp critical(rc_dose_ingest)
+#endif /* _OPENMP */
+                stat = res;
+                continue;
+            }
+            rc_dose_dispatch(dose->fmt, [&](auto t) {
+                rc_dose_put_frame<decltype(t)>(dose, data.get(),
+                                               image.data(), 1.0,
+                                               k, part, zprof);
+            });
+        }
+
+#if _OPENMP
+#   pragma omp critical(rc_dose_ingest)
+#endif /* _OPENMP */
+        total.merge(part);
+    }
+    ofthrow(stat);
+    total.finish(dose, prof.release());
+    dose->data = data.release();
+}
+
+
+/** @brief Rebuild the brick map after the pixel data changes. Failure is not
+ *      fatal, rays will just march through empty space
+ *  @param dose
+ *      Dose with pixel data and max set
+ */
+static void rc_dose_update_bricks(struct rc_dose *dose)
     noexcept
 {
-    const double *dptr = dose->data;
-    unsigned i, j, k;
+    if (rc_dose_set_floor(dose, dose->floor)) {
+        std::cerr << "Not enough memory for the brick map\n";
+    }
+}
 
-    org[0] = dose->dim[0] - 1;
-    org[1] = dose->dim[1] - 1;
-    org[2] = dose->dim[2] - 1;
-    end[0] = 0;
-    end[1] = 0;
-    end[2] = 0;
-    for (k = 0; k < dose->dim[2]; k++) {
-        for (j = 0; j < dose->dim[1]; j++) {
-            for (i = 0; i < dose->dim[0]; i++) {
-                if (*dptr > threshold) {
-                    org[0] = std::min(org[0], i);
-                    org[1] = std::min(org[1], j);
-                    org[2] = std::min(org[2], k);
-                    end[0] = std::max(end[0], i);
-                    end[1] = std::max(end[1], j);
-                    end[2] = std::max(end[2], k);
+
+/** @brief Reorder the pixel data after loading. Failure is not fatal, the
+ *      voxels just stay in linear order
+ *  @param dose
+ *      Dose with pixel data
+ *  @param layout
+ *      Requested voxel order
+ */
+static void rc_dose_update_layout(struct rc_dose      *dose,
+                                  enum rc_dose_layout  layout)
+    noexcept
+{
+    if (rc_dose_set_layout(dose, layout)) {
+        std::cerr << "Not enough memory to reorder the dose\n";
+    }
+}
+
+
+/** @brief Rebuild the mip levels after the pixel data changes. Failure is not
+ *      fatal, rays will just sample the finer levels
+ *  @param dose
+ *      Dose with pixel data and max set
+ */
+static void rc_dose_update_mips(struct rc_dose *dose)
+    noexcept
+{
+    if (rc_dose_build_mips(dose)) {
+        std::cerr << "Not enough memory for the mip levels\n";
+    }
+}
+
+
+/** @brief Load the dimensions and affine matrix from @p rd
+ *  @param dose
+ *      Dose container
+ *  @param rd
+ *      RTDose
+ */
+static void rc_dose_get_grid(struct rc_dose *dose, const DRTDose &rd)
+{
+    rc_dose_get_dimensions(dose, rd);
+    rc_dose_get_origin(dose, rd);
+    rc_dose_get_ortho(dose, rd);
+    rc_dose_get_spacing(dose, rd);
+    if (rc_matrix_invert(dose->mat, dose->inv)) {
+        throw OFCondition(0, 0, OF_error, "Dose matrix is singular");
+    }
+}
+
+
+/** @brief Read the grid and pixel data of the DICOM file @p dcm. The voxels are
+ *      left in linear order, without a brick map or mip levels
+ *  @param dose
+ *      Dose container with its storage format set
+ *  @param dcm
+ *      Path to DICOM file
+ */
+static void rc_dose_read(struct rc_dose *dose, const char *dcm)
+{
+    DcmFileFormat file;
+    DRTDose rd;
+
+    /* This is what DRTDose::loadFile does, but keeping the dataset around
+    means the pixel data can be read straight out of it. DCMTK leaves large
+    elements on disk until they are first accessed, so everything is loaded
+    up front, before rd copies it: the frames are decoded by several threads
+    at once, and none of them may be the one to go back to the file */
+    ofthrow(file.loadFile(dcm));
+    ofthrow(file.loadAllDataIntoMemory());
+    ofthrow(rd.read(*file.getDataset()));
+    rc_dose_get_grid(dose, rd);
+    rc_dose_get_pixels(dose, rd, *file.getDataset());
+}
+
+
+/** @brief Read only the grid of the DICOM file @p dcm
+ *  @param dose
+ *      Dose container
+ *  @param dcm
+ *      Path to DICOM file
+ */
+static void rc_dose_read_grid(struct rc_dose *dose, const char *dcm)
+{
+    DRTDose rd;
+
+    /* The pixel data are left on disk until they are accessed, and they never
+    are here */
+    ofthrow(rd.loadFile(dcm));
+    rc_dose_get_grid(dose, rd);
+}
+
+
+/** @brief Reorder a dose that was just read and build its brick map and mip
+ *      levels
+ *  @param dose
+ *      Dose with pixel data in linear order
+ *  @param layout
+ *      Requested voxel order
+ */
+static void rc_dose_finish(struct rc_dose *dose, enum rc_dose_layout layout)
+    noexcept
+{
+    rc_dose_update_layout(dose, layout);
+    rc_dose_update_bricks(dose);
+    rc_dose_update_mips(dose);
+}
+
+
+extern "C" int rc_dose_fmt_parse(const char *name, enum rc_dose_fmt *fmt)
+{
+    /* In enum order */
+    static const char *names[] = { "f64", "f32", "u16", "u32" };
+    unsigned i;
+
+    for (i = 0; i < sizeof names / sizeof *names; i++) {
+        if (!std::strcmp(name, names[i])) {
+            *fmt = static_cast<enum rc_dose_fmt>(i);
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return 1;
+}
+
+
+extern "C" int rc_dose_load(struct rc_dose *dose, const char *dcm)
+{
+    const enum rc_dose_layout layout = dose->layout;
+
+    try {
+        rc_dose_read(dose, dcm);
+    } catch (const OFCondition &ofc) {
+        std::cerr << "dose error: " << ofc.text() << '\n';
+        return 1;
+    }
+    rc_dose_finish(dose, layout);
+    return 0;
+}
+
+
+extern "C" int rc_dose_set_floor(struct rc_dose *dose, double floor)
+{
+    int res;
+    unsigned l;
+
+    dose->floor = floor;
+    res = rc_bricks_build(&dose->bricks, dose, floor * dose->dmax);
+    for (l = 0; l < dose->nmip; l++) {
+        res |= rc_dose_set_floor(&dose->mip[l], floor);
+    }
+    return res;
+}
+
+
+/** @brief Take the max of each 2x2x2 block of voxels, whose type is T
+ *  @param coarse
+ *      Coarse dose, with dimensions, layout and pixel data set
+ *  @param fine
+ *      Fine dose
+ */
+template <class T>
+static void rc_dose_halve_data(struct rc_dose       *coarse,
+                               const struct rc_dose *fine)
+    noexcept
+{
+    const T *src = static_cast<const T *>(fine->data);
+    T *dest = static_cast<T *>(coarse->data);
+    unsigned i, j, k, di, dj, dk, c[3];
+    T px;
+
+    for (k = 0; k < coarse->dim[2]; k++) {
+        for (j = 0; j < coarse->dim[1]; j++) {
+            for (i = 0; i < coarse->dim[0]; i++) {
+                px = 0;
+                for (dk = 0; dk < 2; dk++) {
+                    c[2] = std::min(2 * k + dk, fine->dim[2] - 1);
+                    for (dj = 0; dj < 2; dj++) {
+                        c[1] = std::min(2 * j + dj, fine->dim[1] - 1);
+                        for (di = 0; di < 2; di++) {
+                            c[0] = std::min(2 * i + di, fine->dim[0] - 1);
+                            px = std::max(px, src[rc_dose_offset(fine,
+                                                                 c[0],
+                                                                 c[1],
+                                                                 c[2])]);
+                        }
+                    }
                 }
-                dptr++;
+                dest[rc_dose_offset(coarse, i, j, k)] = px;
             }
         }
     }
-    end[0]++;
-    end[1]++;
-    end[2]++;
 }
 
 
-/** @brief Copy a rectangular portion of @p dose to @p dest
- *  @param dose
- *      Dose
+/** @brief Halve the resolution of @p fine into @p coarse, keeping the max of
+ *      each 2x2x2 block
+ *  @param coarse
+ *      Empty dose container
+ *  @param fine
+ *      Dose with pixel data
+ *  @returns Nonzero if there is not enough memory
+ */
+static int rc_dose_halve(struct rc_dose *coarse, const struct rc_dose *fine)
+    noexcept
+{
+    const vec_t two = rc_set1(2.0), half = rc_set1(0.5);
+    unsigned a;
+    size_t len;
+
+    for (a = 0; a < 3; a++) {
+        coarse->dim[a] = (fine->dim[a] + 1) / 2;
+    }
+    coarse->fmt = fine->fmt;
+    coarse->scale = fine->scale;
+    coarse->layout = fine->layout;
+    len = rc_dose_update_storage(coarse);
+    coarse->data = rc_dose_alloc(coarse->fmt, len);
+    if (!coarse->data) {
+        return 1;
+    }
+    rc_dose_dispatch(coarse->fmt, [&](auto t) {
+        rc_dose_halve_data<decltype(t)>(coarse, fine);
+    });
+    rc_dose_update_bounds(coarse);
+    coarse->mat[3] = fine->mat[3];
+    for (a = 0; a < 3; a++) {
+        coarse->mat[a] = rc_mul(fine->mat[a], two);
+        coarse->mat[3] = rc_fmadd(fine->mat[a], half, coarse->mat[3]);
+    }
+    rc_matrix_invert(coarse->mat, coarse->inv);
+    coarse->centr = fine->centr;
+    coarse->dmax = fine->dmax;
+    coarse->floor = fine->floor;
+    rc_dose_update_bricks(coarse);
+    return 0;
+}
+
+
+/** @brief Copy the voxels of @p src starting at @p org into @p dest, in the
+ *      layout of each
  *  @param dest
- *      Destination buffer
+ *      Destination, with dimensions, brick counts and pixel data set. Its
+ *      dimensions are the extent of the copy
+ *  @param src
+ *      Source dose, in the same storage format
  *  @param org
- *      Origin coordinates of the rectangle
- *  @param end
- *      Endpoint coordinates of the rectangle
+ *      Indices of the voxel of @p src copied to the origin of @p dest
  */
-static void rc_dose_cubecpy(const struct rc_dose *dose,
-                            double               *dest,
-                            const unsigned        org[],
-                            const unsigned        end[])
+static void rc_dose_blit(struct rc_dose       *dest,
+                         const struct rc_dose *src,
+                         const unsigned        org[])
     noexcept
 {
-    size_t framelen = (size_t)dose->dim[0] * dose->dim[1];
-    double *frame, *scan;
-    unsigned i, j, k;
-
-    for (k = org[2]; k < end[2]; k++) {
-        frame = dose->data + framelen * k;
-        for (j = org[1]; j < end[1]; j++) {
-            scan = frame + dose->dim[0] * j;
-            for (i = org[0]; i < end[0]; i++) {
-                *dest = scan[i];
-                dest++;
+    const unsigned mask = RC_BRICK_LEN - 1;
+    const size_t size = rc_dose_fmt_size(src->fmt);
+    const unsigned char *from = static_cast<const unsigned char *>(src->data);
+    unsigned char *to = static_cast<unsigned char *>(dest->data);
+    unsigned i, j, k, run;
+
+    for (k = 0; k < dest->dim[2]; k++) {
+        for (j = 0; j < dest->dim[1]; j++) {
+            /* Runs along the first axis are contiguous in both layouts, up to
+            the edge of a brick */
+            for (i = 0; i < dest->dim[0]; i += run) {
+                run = dest->dim[0] - i;
+                if (dest->layout == RC_DOSE_BRICKED) {
+                    run = std::min(run, RC_BRICK_LEN
+                                      - ((RC_DOSE_PAD_LO + dest->org[0] + i)
+                                         & mask));
+                }
+                if (src->layout == RC_DOSE_BRICKED) {
+                    run = std::min(run, RC_BRICK_LEN
+                                      - ((RC_DOSE_PAD_LO + src->org[0]
+                                          + org[0] + i) & mask));
+                }
+                std::memcpy(to + rc_dose_offset(dest, i, j, k) * size,
+                            from + rc_dose_offset(src,
+                                                  org[0] + i,
+                                                  org[1] + j,
+                                                  org[2] + k) * size,
+                            run * size);
             }
         }
     }
 }
 
 
-extern "C" int rc_dose_compact(struct rc_dose *dose, double threshold)
+extern "C" int rc_dose_set_layout(struct rc_dose      *dose,
+                                  enum rc_dose_layout  layout)
 {
-    unsigned org[3], end[3], xlen, ylen, zlen;
-    double *next;
+    static const unsigned org[3] = { 0, 0, 0 };
+    struct rc_dose next;
     size_t len;
-    vec_t offs;
+    unsigned l;
+    int res = 0;
 
-    rc_dose_findbounds(dose, threshold * dose->dmax, org, end);
-    xlen = std::max(end[0] - org[0], 0u);
-    ylen = std::max(end[1] - org[1], 0u);
-    zlen = std::max(end[2] - org[2], 0u);
-    len = (size_t)xlen * ylen * zlen;
-    next = new (std::nothrow) double[len];
-    if (!next && len) {
-        /* I don't know if operator new() properly sets errno... Probably
-        implementation-defined */
+    for (l = 0; l < dose->nmip; l++) {
+        res |= rc_dose_set_layout(&dose->mip[l], layout);
+    }
+    if (!dose->data) {
+        dose->layout = layout;
+        rc_dose_update_storage(dose);
+        return res;
+    }
+    if (dose->layout == layout) {
+        return res;
+    }
+    std::copy_n(dose->dim, 3, next.dim);
+    next.fmt = dose->fmt;
+    next.layout = layout;
+    len = rc_dose_update_storage(&next);
+    next.data = rc_dose_alloc(next.fmt, len);
+    if (!next.data) {
         errno = ENOMEM;
         return 1;
     }
+    /* A view becomes a dose of its own */
+    rc_dose_blit(&next, dose, org);
+    rc_dose_free(dose);
+    dose->data = next.data;
+    dose->layout = layout;
+    std::copy_n(next.sdim, 3, dose->sdim);
+    std::copy_n(next.org, 3, dose->org);
+    std::copy_n(next.bdim, 3, dose->bdim);
+    return res;
+}
 
-    printf("Compacted dose from %u x %u x %u\n"
-           "                 to %u x %u x %u\n",
-           dose->dim[0], dose->dim[1], dose->dim[2],
-           xlen, ylen, zlen);
-
-    rc_dose_cubecpy(dose, next, org, end);
-    delete[] dose->data;
-    dose->data = next;
-    dose->dim[0] = xlen;
-    dose->dim[1] = ylen;
-    dose->dim[2] = zlen;
-    rc_dose_update_bounds(dose);
 
-    offs = rc_set((float)org[0], (float)org[1], (float)org[2], 1.0);
-    dose->mat[3] = rc_mvmul4(dose->mat, offs);
-    rc_matrix_invert(dose->mat, dose->inv);
+extern "C" int rc_dose_build_mips(struct rc_dose *dose)
+{
+    const struct rc_dose *fine = dose;
+    unsigned l;
 
+    for (l = 0; l < dose->nmip; l++) {
+        rc_dose_clear(&dose->mip[l]);
+    }
+    dose->nmip = 0;
+    if (!dose->mip) {
+        dose->mip = new (std::nothrow) struct rc_dose[RC_DOSE_MIPS]();
+        if (!dose->mip) {
+            errno = ENOMEM;
+            return 1;
+        }
+    }
+    while (dose->nmip < RC_DOSE_MIPS
+        && fine->dim[0] > 1 && fine->dim[1] > 1 && fine->dim[2] > 1) {
+        if (rc_dose_halve(&dose->mip[dose->nmip], fine)) {
+            errno = ENOMEM;
+            return 1;
+        }
+        fine = &dose->mip[dose->nmip++];
+    }
     return 0;
 }
+
+
+extern "C" void rc_dose_clear(struct rc_dose *dose)
+{
+    unsigned l;
+
+    for (l = 0; l < dose->nmip; l++) {
+        rc_dose_clear(&dose->mip[l]);
+    }
+    delete[] dose->mip;
+    dose->mip = NULL;
+    dose->nmip = 0;
+    rc_bricks_clear(&dose->bricks);
+    rc_dose_free(dose);
+    delete[] dose->prof;
+    dose->prof = NULL;
+    rc_mapfile_close(dose->map, dose->maplen);
+    dose->map = NULL;
+    dose->maplen = 0;
+    dose->dim[0] = 0;
+    dose->dim[1] = 0;
+    dose->dim[2] = 0;
+}
+
+
+/** @brief Check if @p idx is within the bounds of @p dose
+ *  @param dose
+ *      Dose volume
+ *  @param idx
+ *      Index vector
+ *  @returns true if @p idx can safely index a pixel in @p dose, false othewise
+ */
+static bool rc_dose_bounds_check(const struct rc_dose *dose, __m128i idx)
+    noexcept
+{
+    __m128i cmp;
+    
+    cmp = _mm_cmplt_epi32(idx, _mm_setzero_si128());
+    cmp = _mm_or_si128(cmp, _mm_cmpgt_epi32(idx, dose->ubnd));
+    return _mm_testz_si128(cmp, cmp);
+}
+
+
+/** @brief Access the dose at coordinates @p idx
+ *  @param dose
+ *      Dose volume, whose voxels are of type T
+ *  @param idx
+ *      Index vector. Unless Checked, this must be within the border
+ *  @returns The dose value at @p idx. This includes zero if @p idx is out-of-
+ *      bounds
+ */
+template <class T, bool Checked>
+static double rc_dose_access(const struct rc_dose *dose, __m128i idx)
+    noexcept
+{
+    union {
+        __m128i  idx;
+        unsigned xmm[4];
+    } u;
+    double px;
+
+    if (Checked && !rc_dose_bounds_check(dose, idx)) {
+        return 0.0;
+    }
+    u.idx = idx;
+    px = static_cast<const T *>(dose->data)[rc_dose_offset(dose,
+                                                           u.xmm[0],
+                                                           u.xmm[1],
+                                                           u.xmm[2])];
+    return std::is_integral_v<T> ? px * dose->scale : px;
+}
+
+
+/** @brief Find the nearest dose value to @p pos
+ *  @param dose
+ *      Dose
+ *  @param pos
+ *      Real-valued pixel position. Unless Checked, this must be in the box
+ *      from 0 to dim up to a voxel
+ *  @returns The nearest @p dose value to @p pos
+ */
+template <bool Checked>
+static double rc_dose_nearest_impl(const struct rc_dose *dose, vec_t pos)
+    noexcept
+{
+    __m128i idx;
+
+    /* Use the default rounding mode on cvtps_epi32 */
+    //pos = rc_round(pos, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    idx = _mm_cvtps_epi32(pos);
+    return rc_dose_dispatch(dose->fmt, [&](auto t) {
+        return rc_dose_access<decltype(t), Checked>(dose, idx);
+    });
+}
+
+
+extern "C" double rc_dose_nearest(const struct rc_dose *dose, vec_t pos)
+{
+    return rc_dose_nearest_impl<true>(dose, pos);
+}
+
+
+extern "C" double rc_dose_nearest_unchecked(const struct rc_dose *dose,
+                                            vec_t                 pos)
+{
+    return rc_dose_nearest_impl<false>(dose, pos);
+}
+
+
+union interpolant {
+    __m256d ymm[2];
+    __m128d xmm[4];
+    double  mm[8];
+
+
+    /** @brief Load the interpolant using cell origin coordinates @p org
+     *  @param dose
+     *      Dose from which to load
+     *  @param org
+     *      Origin coordinates of the interpolant cell
+     *  @note This prepares coefficients for repeated application of Horner's
+     *      rule. If you are only interpolating a single value before destroying
+     *      this object, this is overkill---use single()
+     */
+    template <class T, bool Checked>
+    void load(const struct rc_dose *dose, __m128i org) noexcept;
+
+    /** @brief Evaluate the interpolate at real unit-relative position @p pos
+     *  @param pos
+     *      Unitized cell coordinates within which to interpolate. These can
+     *      safely be out-of-range, but the result may not make much sense
+     *  @returns The interpolated value, always
+     */
+    double evaluate(vec_t pos) noexcept;
+
+    /** @brief Interpolate the dose at a single point, without computing/storing
+     *      polynomial coefficients
+     *  @param dose
+     *      Dose to be interpolated
+     *  @param org
+     *      Origin coordinates of the cell
+     *  @param pos
+     *      Sublattice pixel coordinates within the cell at @p org
+     *  @returns The interpolated value without fail
+     */
+    template <class T, bool Checked>
+    double single(const struct rc_dose *dose, __m128i org, vec_t pos) noexcept;
+
+private:
+    /** @brief Load the values of the dose function at the corners of a cell
+     *  @param dose
+     *      Dose from which to load
+     *  @param org
+     *      Origin coordinates of the cell to load. Unless Checked, the cell
+     *      must be within the border
+     */
+    template <class T, bool Checked>
+    void load_corners(const struct rc_dose *dose, __m128i org) noexcept;
+};
+
+
+template <class T, bool Checked>
+void interpolant::load(const struct rc_dose *dose, __m128i org)
+    noexcept
+{
+    load_corners<T, Checked>(dose, org);
+    ymm[1] = _mm256_sub_pd(ymm[1], ymm[0]);
+    xmm[3] = _mm_sub_pd(xmm[3], xmm[2]);
+    xmm[1] = _mm_sub_pd(xmm[1], xmm[0]);
+    mm[7] -= mm[6];
+    mm[5] -= mm[4];
+    mm[3] -= mm[2];
+    mm[1] -= mm[0];
+}
+
+
+double interpolant::evaluate(vec_t pos)
+    noexcept
+{
+    RC_ALIGN scal_t x[4];
+
+    rc_spill(x, pos);
+    ymm[0] = _mm256_fmadd_pd(ymm[1], _mm256_set1_pd(x[2]), ymm[0]);
+    xmm[0] = _mm_fmadd_pd(xmm[1], _mm_set1_pd(x[1]), xmm[0]);
+    return std::fma(mm[1], x[0], mm[0]);
+}
+
+
+template <class T, bool Checked>
+double interpolant::single(const struct rc_dose *dose, __m128i org, vec_t pos)
+    noexcept
+{
+    RC_ALIGN scal_t x[4];
+
+    load_corners<T, Checked>(dose, org);
+    rc_spill(x, pos);
+    ymm[0] = _mm256_add_pd(_mm256_mul_pd(ymm[0], _mm256_set1_pd(1.0 - x[2])),
+                           _mm256_mul_pd(ymm[1], _mm256_set1_pd(x[2])));
+    xmm[0] = _mm_add_pd(_mm_mul_pd(xmm[0], _mm_set1_pd(1.0 - x[1])),
+                        _mm_mul_pd(xmm[1], _mm_set1_pd(x[1])));
+    return mm[0] * (1.0 - x[0]) + mm[1] * x[0];
+}
+
+
+template <class T, bool Checked>
+void interpolant::load_corners(const struct rc_dose *dose, __m128i org)
+    noexcept
+{
+    const size_t sx = 1, sy = dose->sdim[0] + RC_DOSE_PAD;
+    const size_t sz = sy * (dose->sdim[1] + RC_DOSE_PAD);
+    const double scale = std::is_integral_v<T> ? dose->scale : 1.0;
+    const T *px;
+    union {
+        __m128i  idx;
+        unsigned xmm[4];
+    } u;
+    __m128i up, xoffs, yoffs, loffs;
+
+    if (!Checked && dose->layout == RC_DOSE_LINEAR) {
+        /* The corners are a fixed distance apart */
+        u.idx = org;
+        px = static_cast<const T *>(dose->data)
+           + rc_dose_offset(dose, u.xmm[0], u.xmm[1], u.xmm[2]);
+        mm[0] = px[0] * scale;
+        mm[1] = px[sx] * scale;
+        mm[2] = px[sy] * scale;
+        mm[3] = px[sy + sx] * scale;
+        mm[4] = px[sz] * scale;
+        mm[5] = px[sz + sx] * scale;
+        mm[6] = px[sz + sy] * scale;
+        mm[7] = px[sz + sy + sx] * scale;
+        return;
+    }
+    up = _mm_add_epi32(org, _mm_set_epi32(0, 1, 0, 0));
+    xoffs = _mm_set_epi32(0, 0, 0, 1);
+    yoffs = _mm_set_epi32(0, 0, 1, 0);
+    loffs = _mm_set_epi32(0, 0, 1, 1);
+
+    mm[0] = rc_dose_access<T, Checked>(dose, org);
+    mm[1] = rc_dose_access<T, Checked>(dose, _mm_add_epi32(org, xoffs));
+    mm[2] = rc_dose_access<T, Checked>(dose, _mm_add_epi32(org, yoffs));
+    mm[3] = rc_dose_access<T, Checked>(dose, _mm_add_epi32(org, loffs));
+    mm[4] = rc_dose_access<T, Checked>(dose, up);
+    mm[5] = rc_dose_access<T, Checked>(dose, _mm_add_epi32(up, xoffs));
+    mm[6] = rc_dose_access<T, Checked>(dose, _mm_add_epi32(up, yoffs));
+    mm[7] = rc_dose_access<T, Checked>(dose, _mm_add_epi32(up, loffs));
+}
+
+
+/** @brief Linearly interpolate the dose at @p pos
+ *  @param dose
+ *      Dose volume
+ *  @param pos
+ *      Pixel position over the reals. Unless Checked, this must be in the box
+ *      from 0 to dim up to a voxel
+ *  @returns The interpolated dose at @p pos
+ */
+template <bool Checked>
+static double rc_dose_linear_impl(const struct rc_dose *dose, vec_t pos)
+    noexcept
+{
+    union interpolant interp;
+    __m128i org;
+
+    pos = rc_vdecomp(pos, &org);
+    return rc_dose_dispatch(dose->fmt, [&](auto t) {
+        return interp.single<decltype(t), Checked>(dose, org, pos);
+    });
+}
+
+
+extern "C" double rc_dose_linear(const struct rc_dose *dose, vec_t pos)
+{
+    return rc_dose_linear_impl<true>(dose, pos);
+}
+
+
+extern "C" double rc_dose_linear_unchecked(const struct rc_dose *dose,
+                                           vec_t                 pos)
+{
+    return rc_dose_linear_impl<false>(dose, pos);
+}
+
+
+/** @brief Gather eight voxels of type T
+ *  @param dose
+ *      Dose volume
+ *  @param n
+ *      Linear index of each lane
+ *  @param mask
+ *      Active lanes, which must be in bounds
+ *  @returns The doses at each lane, or zero in inactive lanes
+ */
+template <class T>
+static __m256 rc_dose_gather(const struct rc_dose *dose, __m256i n, __m256 mask)
+    noexcept
+{
+    const __m256 scale = _mm256_set1_ps(dose->scale);
+    __m256i lo, hi, px;
+    __m256d dlo, dhi;
+    __m256 res;
+
+    if constexpr (std::is_same_v<T, double>) {
+        /* The gathers want 64-bit masks */
+        px = _mm256_castps_si256(mask);
+        lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(px));
+        hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(px, 1));
+        dlo = _mm256_mask_i32gather_pd(_mm256_setzero_pd(),
+                                       static_cast<const double *>(dose->data),
+                                       _mm256_castsi256_si128(n),
+                                       _mm256_castsi256_pd(lo),
+                                       sizeof (T));
+        dhi = _mm256_mask_i32gather_pd(_mm256_setzero_pd(),
+                                       static_cast<const double *>(dose->data),
+                                       _mm256_extracti128_si256(n, 1),
+                                       _mm256_castsi256_pd(hi),
+                                       sizeof (T));
+        return _mm256_set_m128(_mm256_cvtpd_ps(dhi), _mm256_cvtpd_ps(dlo));
+    } else if constexpr (std::is_same_v<T, float>) {
+        return _mm256_mask_i32gather_ps(_mm256_setzero_ps(),
+                                        static_cast<const float *>(dose->data),
+                                        n,
+                                        mask,
+                                        sizeof (T));
+    } else {
+        /* 16-bit voxels are read four bytes at a time, which the allocation
+        pads for at the end of the volume */
+        px = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+                                         static_cast<const int *>(dose->data),
+                                         n,
+                                         _mm256_castps_si256(mask),
+                                         sizeof (T));
+        if constexpr (sizeof (T) == 2) {
+            px = _mm256_and_si256(px, _mm256_set1_epi32(0xFFFF));
+            res = _mm256_cvtepi32_ps(px);
+        } else {
+            /* There is no unsigned conversion until AVX-512, so the top bit
+            is added back in separately */
+            lo = _mm256_and_si256(px, _mm256_set1_epi32(0x7FFFFFFF));
+            res = _mm256_cvtepi32_ps(lo);
+            hi = _mm256_srai_epi32(px, 31);
+            res = _mm256_add_ps(res, _mm256_and_ps(_mm256_castsi256_ps(hi),
+                                                   _mm256_set1_ps(0x1p31f)));
+        }
+        return _mm256_mul_ps(res, scale);
+    }
+}
+
+
+extern "C" __m256 rc_dose_gather8(const struct rc_dose *dose,
+                                  __m256i               n,
+                                  __m256                mask)
+{
+    return rc_dose_dispatch(dose->fmt, [&](auto t) {
+        return rc_dose_gather<decltype(t)>(dose, n, mask);
+    });
+}
+
+
+/** @brief Access the dose at eight index vectors at once
+ *  @param dose
+ *      Dose volume, whose voxels are of type T
+ *  @param x
+ *      First index of each lane
+ *  @param y
+ *      Second index of each lane
+ *  @param z
+ *      Third index of each lane
+ *  @param mask
+ *      Active lanes. Unless Checked, these must be within the border
+ *  @returns The dose values at each lane. Lanes that are out-of-bounds or
+ *      inactive are zero
+ */
+template <class T, bool Checked>
+static __m256 rc_dose_access8(const struct rc_dose *dose,
+                              __m256i               x,
+                              __m256i               y,
+                              __m256i               z,
+                              __m256                mask)
+    noexcept
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i xmax = _mm256_set1_epi32(dose->dim[0] - 1);
+    const __m256i ymax = _mm256_set1_epi32(dose->dim[1] - 1);
+    const __m256i zmax = _mm256_set1_epi32(dose->dim[2] - 1);
+    __m256i oob, n;
+
+    if constexpr (!Checked) {
+        n = rc_dose_offset8(dose, x, y, z);
+        return rc_dose_gather<T>(dose, n, mask);
+    }
+    oob = _mm256_cmpgt_epi32(zero, x);
+    oob = _mm256_or_si256(oob, _mm256_cmpgt_epi32(zero, y));
+    oob = _mm256_or_si256(oob, _mm256_cmpgt_epi32(zero, z));
+    oob = _mm256_or_si256(oob, _mm256_cmpgt_epi32(x, xmax));
+    oob = _mm256_or_si256(oob, _mm256_cmpgt_epi32(y, ymax));
+    oob = _mm256_or_si256(oob, _mm256_cmpgt_epi32(z, zmax));
+    oob = _mm256_andnot_si256(oob, _mm256_castps_si256(mask));
+    n = rc_dose_offset8(dose, x, y, z);
+    return rc_dose_gather<T>(dose, n, _mm256_castsi256_ps(oob));
+}
+
+
+/** @brief Packet version of rc_dose_nearest_impl */
+template <bool Checked>
+static __m256 rc_dose_nearest8_impl(const struct rc_dose   *dose,
+                                    const struct rc_packet *pos,
+                                    __m256                  mask)
+    noexcept
+{
+    __m256i x, y, z;
+
+    /* Default rounding mode, same as rc_dose_nearest */
+    x = _mm256_cvtps_epi32(pos->x);
+    y = _mm256_cvtps_epi32(pos->y);
+    z = _mm256_cvtps_epi32(pos->z);
+    return rc_dose_dispatch(dose->fmt, [&](auto t) {
+        return rc_dose_access8<decltype(t), Checked>(dose, x, y, z, mask);
+    });
+}
+
+
+extern "C" __m256 rc_dose_nearest8(const struct rc_dose   *dose,
+                                   const struct rc_packet *pos,
+                                   __m256                  mask)
+{
+    return rc_dose_nearest8_impl<true>(dose, pos, mask);
+}
+
+
+extern "C" __m256 rc_dose_nearest8_unchecked(const struct rc_dose   *dose,
+                                             const struct rc_packet *pos,
+                                             __m256                  mask)
+{
+    return rc_dose_nearest8_impl<false>(dose, pos, mask);
+}
+
+
+/** @brief Linearly interpolate between @p a and @p b
+ *  @param a
+ *      Value at zero
+ *  @param b
+ *      Value at one
+ *  @param t
+ *      Parameter
+ *  @returns a * (1 - t) + b * t
+ */
+static __m256 rc_lerp8(__m256 a, __m256 b, __m256 t)
+    noexcept
+{
+    return _mm256_fmadd_ps(_mm256_sub_ps(b, a), t, a);
+}
+
+
+/** @brief Packet version of rc_dose_linear_impl */
+template <bool Checked>
+static __m256 rc_dose_linear8_impl(const struct rc_dose   *dose,
+                                   const struct rc_packet *pos,
+                                   __m256                  mask)
+    noexcept
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const int sy = (int)dose->sdim[0] + RC_DOSE_PAD;
+    const int sz = sy * ((int)dose->sdim[1] + RC_DOSE_PAD);
+    __m256 fx, fy, fz, c[8];
+    __m256i x[2], y[2], z[2], n;
+    unsigned i;
+    int d;
+
+    fx = _mm256_floor_ps(pos->x);
+    fy = _mm256_floor_ps(pos->y);
+    fz = _mm256_floor_ps(pos->z);
+    x[0] = _mm256_cvtps_epi32(fx);
+    y[0] = _mm256_cvtps_epi32(fy);
+    z[0] = _mm256_cvtps_epi32(fz);
+    x[1] = _mm256_add_epi32(x[0], one);
+    y[1] = _mm256_add_epi32(y[0], one);
+    z[1] = _mm256_add_epi32(z[0], one);
+    fx = _mm256_sub_ps(pos->x, fx);
+    fy = _mm256_sub_ps(pos->y, fy);
+    fz = _mm256_sub_ps(pos->z, fz);
+    /* Same corner ordering as union interpolant. Dispatch once for all eight
+    corners */
+    rc_dose_dispatch(dose->fmt, [&](auto t) {
+        using T = decltype(t);
+
+        if (!Checked && dose->layout == RC_DOSE_LINEAR) {
+            /* The corners are a fixed distance apart */
+            n = rc_dose_offset8(dose, x[0], y[0], z[0]);
+            for (i = 0; i < 8; i++) {
+                d = (i & 1) + (i >> 1 & 1) * sy + (i >> 2) * sz;
+                c[i] = rc_dose_gather<T>(dose,
+                                         _mm256_add_epi32(n,
+                                                          _mm256_set1_epi32(d)),
+                                         mask);
+            }
+            return;
+        }
+        for (i = 0; i < 8; i++) {
+            c[i] = rc_dose_access8<T, Checked>(dose, x[i & 1], y[i >> 1 & 1],
+                                               z[i >> 2], mask);
+        }
+    });
+    c[0] = rc_lerp8(c[0], c[4], fz);
+    c[1] = rc_lerp8(c[1], c[5], fz);
+    c[2] = rc_lerp8(c[2], c[6], fz);
+    c[3] = rc_lerp8(c[3], c[7], fz);
+    c[0] = rc_lerp8(c[0], c[2], fy);
+    c[1] = rc_lerp8(c[1], c[3], fy);
+    return rc_lerp8(c[0], c[1], fx);
+}
+
+
+extern "C" __m256 rc_dose_linear8(const struct rc_dose   *dose,
+                                  const struct rc_packet *pos,
+                                  __m256                  mask)
+{
+    return rc_dose_linear8_impl<true>(dose, pos, mask);
+}
+
+
+extern "C" __m256 rc_dose_linear8_unchecked(const struct rc_dose   *dose,
+                                            const struct rc_packet *pos,
+                                            __m256                  mask)
+{
+    return rc_dose_linear8_impl<false>(dose, pos, mask);
+}
+
+
+/** @brief Find the indices in each dimension of the last dose point above
+ *      @p threshold
+ *  @param dose
+ *      Dose volume. If it has plane maxima, those are searched instead of its
+ *      voxels
+ *  @param threshold
+ *      Threshold dose
+ *  @param org
+ *      Origin indices of the rectangle
+ *  @param end
+ *      Ending indices of the rectangle
+ */
+static void rc_dose_findbounds(const struct rc_dose *dose,
+                               double                threshold,
+                               unsigned              org[],
+                               unsigned              end[])
+    noexcept
+{
+    const double *prof = dose->prof;
+    unsigned a, i, j, k;
+
+    org[0] = dose->dim[0] - 1;
+    org[1] = dose->dim[1] - 1;
+    org[2] = dose->dim[2] - 1;
+    end[0] = 0;
+    end[1] = 0;
+    end[2] = 0;
+    /* A plane holds a voxel above the threshold iff its max is */
+    for (a = 0; prof && a < 3; prof += dose->dim[a++]) {
+        for (i = 0; i < dose->dim[a]; i++) {
+            if (prof[i] > threshold) {
+                org[a] = std::min(org[a], i);
+                end[a] = std::max(end[a], i);
+            }
+        }
+    }
+    for (k = 0; !dose->prof && k < dose->dim[2]; k++) {
+        for (j = 0; j < dose->dim[1]; j++) {
+            for (i = 0; i < dose->dim[0]; i++) {
+                if (rc_dose_voxel(dose, rc_dose_offset(dose, i, j, k))
+                    > threshold) {
+                    org[0] = std::min(org[0], i);
+                    org[1] = std::min(org[1], j);
+                    org[2] = std::min(org[2], k);
+                    end[0] = std::max(end[0], i);
+                    end[1] = std::max(end[1], j);
+                    end[2] = std::max(end[2], k);
+                }
+            }
+        }
+    }
+    end[0]++;
+    end[1]++;
+    end[2]++;
+}
+
+
+/** @brief Find the dimensions of the rectangle from rc_dose_findbounds
+ *  @param org
+ *      Origin indices of the rectangle
+ *  @param end
+ *      Ending indices of the rectangle
+ *  @param[out] dim
+ *      Its dimensions, zero if no dose point was above the threshold
+ */
+static void rc_dose_extent(const unsigned org[],
+                           const unsigned end[],
+                           unsigned       dim[])
+    noexcept
+{
+    unsigned a;
+
+    for (a = 0; a < 3; a++) {
+        dim[a] = end[a] > org[a] ? end[a] - org[a] : 0;
+    }
+}
+
+
+/** @brief Cut the plane maxima of @p dose down to a rectangle
+ *  @param dose
+ *      Dose volume with plane maxima
+ *  @param org
+ *      Origin indices of the rectangle
+ *  @param dim
+ *      Its dimensions
+ *  @returns The maxima of the planes of the rectangle, which are those of the
+ *      whole planes and so never less than its own, or NULL if there is not
+ *      enough memory
+ */
+static double *rc_dose_slice_prof(const struct rc_dose *dose,
+                                  const unsigned        org[],
+                                  const unsigned        dim[])
+    noexcept
+{
+    const double *src = dose->prof;
+    double *res, *dest;
+    unsigned a;
+
+    res = new (std::nothrow) double[(size_t)dim[0] + dim[1] + dim[2]];
+    for (a = 0, dest = res; res && a < 3; src += dose->dim[a], a++) {
+        dest = std::copy_n(src + org[a], dim[a], dest);
+    }
+    return res;
+}
+
+
+extern "C" int rc_dose_compact(struct rc_dose *dose, double threshold)
+{
+    unsigned org[3], end[3];
+    struct rc_dose next;
+    double *prof = NULL;
+    size_t len;
+    vec_t offs;
+
+    rc_dose_findbounds(dose, threshold * dose->dmax, org, end);
+    rc_dose_extent(org, end, next.dim);
+    next.fmt = dose->fmt;
+    next.layout = dose->layout;
+    len = rc_dose_update_storage(&next);
+    next.data = rc_dose_alloc(next.fmt, len);
+    if (!next.data && len) {
+        /* I don't know if operator new() properly sets errno... Probably
+        implementation-defined */
+        errno = ENOMEM;
+        return 1;
+    }
+
+    printf("Compacted dose from %u x %u x %u\n"
+           "                 to %u x %u x %u\n",
+           dose->dim[0], dose->dim[1], dose->dim[2],
+           next.dim[0], next.dim[1], next.dim[2]);
+
+    /* Kept, so that views of the compacted dose still find their bounds
+    without reading it. Failing to is not fatal, they just will */
+    if (dose->prof) {
+        prof = rc_dose_slice_prof(dose, org, next.dim);
+    }
+    rc_dose_blit(&next, dose, org);
+    rc_dose_free(dose);
+    dose->data = next.data;
+    delete[] dose->prof;
+    dose->prof = prof;
+    std::copy_n(next.dim, 3, dose->dim);
+    std::copy_n(next.sdim, 3, dose->sdim);
+    std::copy_n(next.org, 3, dose->org);
+    std::copy_n(next.bdim, 3, dose->bdim);
+    rc_dose_update_bounds(dose);
+
+    offs = rc_set((float)org[0], (float)org[1], (float)org[2], 1.0);
+    dose->mat[3] = rc_mvmul4(dose->mat, offs);
+    rc_matrix_invert(dose->mat, dose->inv);
+    rc_dose_update_bricks(dose);
+    rc_dose_update_mips(dose);
+
+    return 0;
+}
+
+
+/** @brief Point @p view at the voxels of @p dose from @p org up to @p end
+ *  @param view
+ *      Empty dose container
+ *  @param dose
+ *      Dose or mip level with pixel data, which may be a view itself
+ *  @param org
+ *      Indices of the voxel of @p dose at the origin of @p view
+ *  @param end
+ *      Ending indices of @p view in @p dose
+ */
+static void rc_dose_window(struct rc_dose       *view,
+                           const struct rc_dose *dose,
+                           const unsigned        org[],
+                           const unsigned        end[])
+    noexcept
+{
+    unsigned a;
+    vec_t offs;
+
+    rc_dose_extent(org, end, view->dim);
+    for (a = 0; a < 3; a++) {
+        view->sdim[a] = dose->sdim[a];
+        view->org[a] = dose->org[a] + org[a];
+        view->bdim[a] = dose->bdim[a];
+    }
+    view->fmt = dose->fmt;
+    view->scale = dose->scale;
+    view->layout = dose->layout;
+    view->floor = dose->floor;
+    view->centr = dose->centr;
+    view->dmax = dose->dmax;
+    std::copy_n(dose->hist, RC_DOSE_HIST, view->hist);
+    rc_dose_update_bounds(view);
+
+    offs = rc_set((float)org[0], (float)org[1], (float)org[2], 1.0);
+    std::copy_n(dose->mat, 3, view->mat);
+    view->mat[3] = rc_mvmul4(dose->mat, offs);
+    rc_matrix_invert(view->mat, view->inv);
+
+    view->data = dose->data;
+    view->shared = 1;
+}
+
+
+/** @brief Build the brick map of @p view from the brick maxima of @p dose,
+ *      without reading any voxels. Each brick of @p view takes the largest
+ *      maximum of the bricks of @p dose it overlaps, which is never less than
+ *      its own, so rays only ever skip less than they could
+ *  @param view
+ *      View from rc_dose_window
+ *  @param dose
+ *      The dose it views
+ *  @param org
+ *      Indices of the voxel of @p dose at the origin of @p view
+ */
+static void rc_dose_view_bricks(struct rc_dose       *view,
+                                const struct rc_dose *dose,
+                                const unsigned        org[])
+    noexcept
+{
+    const unsigned mask = RC_BRICK_LEN - 1;
+    const struct rc_bricks *src = &dose->bricks;
+    unsigned dim[3], lo[3], hi[3], b[3], c[3], a;
+    size_t n = 0;
+    float px;
+
+    for (a = 0; a < 3; a++) {
+        dim[a] = (view->dim[a] + mask) >> RC_BRICK_LOG2;
+    }
+    std::unique_ptr<float[]> max(new (std::nothrow)
+                                 float[(size_t)dim[0] * dim[1] * dim[2]]);
+    if (!src->max || !max) {
+        rc_dose_update_bricks(view);
+        return;
+    }
+    for (b[2] = 0; b[2] < dim[2]; b[2]++) {
+        for (b[1] = 0; b[1] < dim[1]; b[1]++) {
+            for (b[0] = 0; b[0] < dim[0]; b[0]++, n++) {
+                /* The voxels of the brick, with its upper faces */
+                for (a = 0; a < 3; a++) {
+                    lo[a] = org[a] + (b[a] << RC_BRICK_LOG2);
+                    hi[a] = std::min(lo[a] + RC_BRICK_LEN, dose->dim[a] - 1);
+                    lo[a] >>= RC_BRICK_LOG2;
+                    hi[a] >>= RC_BRICK_LOG2;
+                }
+                px = 0.0f;
+                for (c[2] = lo[2]; c[2] <= hi[2]; c[2]++) {
+                    for (c[1] = lo[1]; c[1] <= hi[1]; c[1]++) {
+                        for (c[0] = lo[0]; c[0] <= hi[0]; c[0]++) {
+                            px = std::max(px, src->max[c[0] + src->dim[0]
+                                * (c[1] + (size_t)src->dim[1] * c[2])]);
+                        }
+                    }
+                }
+                max[n] = px;
+            }
+        }
+    }
+    if (rc_bricks_load(&view->bricks,
+                       view,
+                       max.get(),
+                       view->floor * view->dmax)) {
+        std::cerr << "Not enough memory for the brick map\n";
+    }
+}
+
+
+extern "C" int rc_dose_view(struct rc_dose       *view,
+                            const struct rc_dose *dose,
+                            double                threshold)
+{
+    unsigned org[3], end[3], morg[3], mend[3], a, l, s;
+
+    rc_dose_clear(view);
+    rc_dose_findbounds(dose, threshold * dose->dmax, org, end);
+    rc_dose_window(view, dose, org, end);
+    rc_dose_view_bricks(view, dose, org);
+    if (!dose->nmip || !view->dim[0] || !view->dim[1] || !view->dim[2]) {
+        return 0;
+    }
+    view->mip = new (std::nothrow) struct rc_dose[RC_DOSE_MIPS]();
+    if (!view->mip) {
+        errno = ENOMEM;
+        return 1;
+    }
+    /* Each level views the voxels of the same level of @p dose that cover
+    the view */
+    for (l = 0; l < dose->nmip; l++) {
+        s = l + 1;
+        for (a = 0; a < 3; a++) {
+            morg[a] = org[a] >> s;
+            mend[a] = std::min(((end[a] - 1) >> s) + 1, dose->mip[l].dim[a]);
+        }
+        rc_dose_window(&view->mip[l], &dose->mip[l], morg, mend);
+        rc_dose_view_bricks(&view->mip[l], &dose->mip[l], morg);
+        view->nmip++;
+    }
+    return 0;
+}
+
+
+/** Marks the start of a dose cache */
+static const char rc_dose_cache_magic[8] = { 'R', 'C', 'D', 'O', 'S', 'E',
+                                             '\r', '\n' };
+
+/** Version of the dose cache format. Bump this whenever the cache, or anything
+ *  it holds such as the layouts or the border, changes, so that older caches
+ *  are replaced rather than misread */
+#define RC_DOSE_CACHE_VERSION 3
+
+/** Alignment of each section of a dose cache in bytes. Mappings start on a
+ *  page, so the sections do too */
+#define RC_DOSE_CACHE_ALIGN 4096
+
+
+/** One level of a dose cache, the dose itself or one of its mips */
+struct rc_dose_cache_level {
+    vec_t    centr;     /* rc_dose::centr */
+    vec_t    mat[4];    /* rc_dose::mat */
+    vec_t    inv[4];    /* rc_dose::inv */
+    unsigned dim[3];    /* rc_dose::dim */
+    double   dmax;      /* rc_dose::dmax */
+    double   scale;     /* rc_dose::scale */
+    uint64_t data;      /* Offset of the pixel data in the file */
+    uint64_t size;      /* Length of the pixel data in bytes */
+    uint64_t bmax;      /* Offset of the brick maxima, or zero if there are
+                        none */
+};
+
+
+/** The header at the start of a dose cache. Everything is in the native byte
+ *  order and struct layout, which the version and header size check */
+struct rc_dose_cache {
+    char     magic[8];  /* rc_dose_cache_magic */
+    uint32_t version;   /* RC_DOSE_CACHE_VERSION */
+    uint32_t hsize;     /* Size of this header */
+
+    struct rc_mapfile_stamp src;    /* Stamp of the DICOM file */
+    double                  threshold;  /* Compaction threshold */
+    uint32_t                fmt;    /* rc_dose::fmt */
+    uint32_t                layout; /* rc_dose::layout */
+    uint32_t                nlev;   /* The dose and its mips */
+    uint64_t                hist[RC_DOSE_HIST]; /* rc_dose::hist */
+    uint64_t                prof;   /* Offset of rc_dose::prof, or zero if
+                                    there is none */
+
+    struct rc_dose_cache_level lev[1 + RC_DOSE_MIPS];
+};
+
+
+/** @brief Count the plane maxima of @p dose
+ *  @param dose
+ *      Dose with dimensions set
+ *  @returns The length of rc_dose::prof
+ */
+static size_t rc_dose_cache_nprof(const struct rc_dose *dose)
+    noexcept
+{
+    return (size_t)dose->dim[0] + dose->dim[1] + dose->dim[2];
+}
+
+
+/** @brief Round @p off up to the next section of a dose cache
+ *  @param off
+ *      File offset
+ *  @returns The aligned offset
+ */
+static uint64_t rc_dose_cache_align(uint64_t off)
+    noexcept
+{
+    const uint64_t mask = RC_DOSE_CACHE_ALIGN - 1;
+
+    return (off + mask) & ~mask;
+}
+
+
+/** @brief Count the bricks of @p dose
+ *  @param dose
+ *      Dose with dimensions set
+ *  @returns The number of brick maxima in its brick map
+ */
+static size_t rc_dose_cache_nbrick(const struct rc_dose *dose)
+    noexcept
+{
+    const unsigned mask = RC_BRICK_LEN - 1;
+
+    return (size_t)((dose->dim[0] + mask) >> RC_BRICK_LOG2)
+         * ((dose->dim[1] + mask) >> RC_BRICK_LOG2)
+         * ((dose->dim[2] + mask) >> RC_BRICK_LOG2);
+}
+
+
+/** @brief Describe @p dose in a level of a dose cache, placing its sections
+ *  @param lev
+ *      Cache level
+ *  @param dose
+ *      Dose or mip level with pixel data
+ *  @param[in,out] off
+ *      End of the sections placed so far, which is moved past these
+ */
+static void rc_dose_cache_describe(struct rc_dose_cache_level *lev,
+                                   const struct rc_dose       *dose,
+                                   uint64_t                   *off)
+    noexcept
+{
+    lev->centr = dose->centr;
+    std::copy_n(dose->mat, 4, lev->mat);
+    std::copy_n(dose->inv, 4, lev->inv);
+    std::copy_n(dose->dim, 3, lev->dim);
+    lev->dmax = dose->dmax;
+    lev->scale = dose->scale;
+    /* With the padding voxel of rc_dose_alloc */
+    lev->size = (rc_dose_storage(dose) + 1) * rc_dose_fmt_size(dose->fmt);
+    lev->data = rc_dose_cache_align(*off);
+    *off = lev->data + lev->size;
+    lev->bmax = 0;
+    if (dose->bricks.max) {
+        lev->bmax = rc_dose_cache_align(*off);
+        *off = lev->bmax + rc_dose_cache_nbrick(dose) * sizeof (float);
+    }
+}
+
+
+/** @brief Write @p len bytes at offset @p off of @p file, zeroing any gap
+ *      since the last write
+ *  @param file
+ *      Output file
+ *  @param buf
+ *      Bytes to write
+ *  @param len
+ *      Byte count
+ *  @param off
+ *      Where they go, at or after @p pos
+ *  @param[in,out] pos
+ *      Current position in @p file, which is moved to the end of the write
+ *  @returns Nonzero on error
+ */
+static int rc_dose_cache_put(std::FILE  *file,
+                             const void *buf,
+                             size_t      len,
+                             uint64_t    off,
+                             uint64_t   *pos)
+    noexcept
+{
+    static const unsigned char zero[RC_DOSE_CACHE_ALIGN] = { 0 };
+    size_t gap;
+
+    while (*pos < off) {
+        gap = (size_t)std::min<uint64_t>(off - *pos, sizeof zero);
+        if (std::fwrite(zero, 1, gap, file) != gap) {
+            return 1;
+        }
+        *pos += gap;
+    }
+    if (std::fwrite(buf, 1, len, file) != len) {
+        return 1;
+    }
+    *pos += len;
+    return 0;
+}
+
+
+/** @brief Write @p dose to a cache file at @p tmp, then move it to @p path
+ *  @param dose
+ *      Compacted dose with pixel data
+ *  @param path
+ *      Path to the cache
+ *  @param tmp
+ *      Path to write the cache at first, unique to this process so that
+ *      concurrent writers never mix their files
+ *  @param src
+ *      Stamp of the DICOM file
+ *  @param threshold
+ *      Compaction threshold
+ *  @returns Nonzero on error, in which case errno(3) is set and nothing is
+ *      left at @p path or @p tmp
+ */
+static int rc_dose_cache_write(const struct rc_dose          *dose,
+                               const char                    *path,
+                               const char                    *tmp,
+                               const struct rc_mapfile_stamp *src,
+                               double                         threshold)
+    noexcept
+{
+    struct rc_dose_cache head;
+    const struct rc_dose *level;
+    uint64_t off = sizeof head, pos = 0;
+    std::FILE *file;
+    unsigned l;
+    int res;
+
+    /* Zero the padding too, so that the file is the same on every write */
+    std::memset(&head, 0, sizeof head);
+    std::copy_n(rc_dose_cache_magic, 8, head.magic);
+    head.version = RC_DOSE_CACHE_VERSION;
+    head.hsize = sizeof head;
+    head.src = *src;
+    head.threshold = threshold;
+    head.fmt = dose->fmt;
+    head.layout = dose->layout;
+    head.nlev = 1 + dose->nmip;
+    std::copy_n(dose->hist, RC_DOSE_HIST, head.hist);
+    for (l = 0; l < head.nlev; l++) {
+        level = l ? &dose->mip[l - 1] : dose;
+        rc_dose_cache_describe(&head.lev[l], level, &off);
+    }
+    if (dose->prof) {
+        head.prof = rc_dose_cache_align(off);
+    }
+
+    file = std::fopen(tmp, "wb");
+    if (!file) {
+        return 1;
+    }
+    res = rc_dose_cache_put(file, &head, sizeof head, 0, &pos);
+    for (l = 0; !res && l < head.nlev; l++) {
+        level = l ? &dose->mip[l - 1] : dose;
+        res = rc_dose_cache_put(file,
+                                level->data,
+                                head.lev[l].size,
+                                head.lev[l].data,
+                                &pos);
+        if (!res && head.lev[l].bmax) {
+            res = rc_dose_cache_put(file,
+                                    level->bricks.max,
+                                    rc_dose_cache_nbrick(level)
+                                        * sizeof (float),
+                                    head.lev[l].bmax,
+                                    &pos);
+        }
+    }
+    if (!res && head.prof) {
+        res = rc_dose_cache_put(file,
+                                dose->prof,
+                                rc_dose_cache_nprof(dose) * sizeof (double),
+                                head.prof,
+                                &pos);
+    }
+    res |= std::fclose(file) != 0;
+    if (res || rc_mapfile_replace(tmp, path)) {
+        res = errno;
+        std::remove(tmp);
+        errno = res ? res : EIO;
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Check that a section of a mapped dose cache lies inside of it
+ *  @param off
+ *      Section offset
+ *  @param size
+ *      Section length
+ *  @param len
+ *      Mapping length
+ *  @returns Whether the section fits
+ */
+static bool rc_dose_cache_fits(uint64_t off, uint64_t size, size_t len)
+    noexcept
+{
+    return off <= len && size <= len - off;
+}
+
+
+/** @brief Check that the dose cache headed by @p head is current and whole
+ *  @param head
+ *      Cache header
+ *  @param len
+ *      Length of the mapped cache
+ *  @param dose
+ *      Dose container with the requested storage format and layout set
+ *  @param src
+ *      Stamp of the DICOM file
+ *  @param threshold
+ *      Requested compaction threshold
+ *  @returns Whether the cache can be used as it is
+ */
+static bool rc_dose_cache_valid(const struct rc_dose_cache    *head,
+                                size_t                         len,
+                                const struct rc_dose          *dose,
+                                const struct rc_mapfile_stamp *src,
+                                double                         threshold)
+    noexcept
+{
+    const struct rc_dose_cache_level *lev;
+    struct rc_dose level;
+    unsigned l;
+
+    if (std::memcmp(head->magic, rc_dose_cache_magic, 8)
+     || head->version != RC_DOSE_CACHE_VERSION
+     || head->hsize != sizeof *head
+     || head->src.size != src->size
+     || head->src.mtime != src->mtime
+     || head->threshold != threshold
+     || head->fmt != (uint32_t)dose->fmt
+     || head->layout != (uint32_t)dose->layout
+     || head->nlev < 1
+     || head->nlev > 1 + RC_DOSE_MIPS) {
+        return false;
+    }
+    for (l = 0; l < head->nlev; l++) {
+        lev = &head->lev[l];
+        std::copy_n(lev->dim, 3, level.dim);
+        level.fmt = dose->fmt;
+        level.layout = dose->layout;
+        if (lev->size != (rc_dose_update_storage(&level) + 1)
+                       * rc_dose_fmt_size(level.fmt)
+         || lev->data % RC_DOSE_CACHE_ALIGN
+         || !rc_dose_cache_fits(lev->data, lev->size, len)) {
+            return false;
+        }
+        if (lev->bmax && (lev->bmax % RC_DOSE_CACHE_ALIGN
+         || !rc_dose_cache_fits(lev->bmax,
+                                rc_dose_cache_nbrick(&level) * sizeof (float),
+                                len))) {
+            return false;
+        }
+    }
+    std::copy_n(head->lev[0].dim, 3, level.dim);
+    return !head->prof || (head->prof % RC_DOSE_CACHE_ALIGN == 0
+                        && rc_dose_cache_fits(head->prof,
+                                              rc_dose_cache_nprof(&level)
+                                                  * sizeof (double),
+                                              len));
+}
+
+
+/** @brief Point a dose or mip level at its pixel data in a mapped dose cache
+ *  @param level
+ *      Empty dose container
+ *  @param lev
+ *      Its level of the cache
+ *  @param base
+ *      Start of the mapping
+ *  @param dose
+ *      The dose being loaded, for the storage format, layout and floor
+ */
+static void rc_dose_cache_attach(struct rc_dose                   *level,
+                                 const struct rc_dose_cache_level *lev,
+                                 unsigned char                    *base,
+                                 const struct rc_dose             *dose)
+    noexcept
+{
+    const float *bmax;
+
+    level->centr = lev->centr;
+    std::copy_n(lev->mat, 4, level->mat);
+    std::copy_n(lev->inv, 4, level->inv);
+    std::copy_n(lev->dim, 3, level->dim);
+    level->dmax = lev->dmax;
+    level->scale = lev->scale;
+    level->fmt = dose->fmt;
+    level->layout = dose->layout;
+    level->floor = dose->floor;
+    rc_dose_update_storage(level);
+    rc_dose_update_bounds(level);
+    level->data = base + lev->data;
+    level->shared = 1;
+    if (!lev->bmax) {
+        rc_dose_update_bricks(level);
+        return;
+    }
+    /* The maxima do not depend on the floor, so only the distances are
+    recomputed, and no voxel is read */
+    bmax = reinterpret_cast<const float *>(base + lev->bmax);
+    if (rc_bricks_load(&level->bricks,
+                       level,
+                       bmax,
+                       level->floor * level->dmax)) {
+        std::cerr << "Not enough memory for the brick map\n";
+    }
+}
+
+
+/** @brief Map the dose cache at @p path into @p dose if it is current
+ *  @param dose
+ *      Empty dose container with its storage format, layout and floor set
+ *  @param path
+ *      Path to the cache
+ *  @param src
+ *      Stamp of the DICOM file
+ *  @param threshold
+ *      Requested compaction threshold
+ *  @returns Nonzero if there is no usable cache, in which case @p dose is left
+ *      empty
+ */
+static int rc_dose_cache_map(struct rc_dose                *dose,
+                             const char                    *path,
+                             const struct rc_mapfile_stamp *src,
+                             double                         threshold)
+    noexcept
+{
+    struct rc_dose_cache head;
+    unsigned char *base;
+    size_t len, nprof;
+    unsigned l;
+
+    base = static_cast<unsigned char *>(rc_mapfile_open(path, &len));
+    if (!base) {
+        return 1;
+    }
+    if (len >= sizeof head) {
+        std::memcpy(&head, base, sizeof head);
+    }
+    if (len < sizeof head
+     || !rc_dose_cache_valid(&head, len, dose, src, threshold)) {
+        rc_mapfile_close(base, len);
+        return 1;
+    }
+    if (head.nlev > 1) {
+        dose->mip = new (std::nothrow) struct rc_dose[RC_DOSE_MIPS]();
+        if (!dose->mip) {
+            rc_mapfile_close(base, len);
+            errno = ENOMEM;
+            return 1;
+        }
+    }
+    dose->map = base;
+    dose->maplen = len;
+    std::copy_n(head.hist, RC_DOSE_HIST, dose->hist);
+    dose->nmip = head.nlev - 1;
+    for (l = 0; l < head.nlev; l++) {
+        rc_dose_cache_attach(l ? &dose->mip[l - 1] : dose,
+                             &head.lev[l],
+                             base,
+                             dose);
+    }
+    /* The plane maxima are copied, since views slice and free their own.
+    Without them, views are bounded by reading every voxel instead */
+    if (head.prof) {
+        nprof = rc_dose_cache_nprof(dose);
+        dose->prof = new (std::nothrow) double[nprof];
+        if (dose->prof) {
+            std::memcpy(dose->prof, base + head.prof, nprof * sizeof (double));
+        }
+    }
+    return 0;
+}
+
+
+extern "C" int rc_dose_load_cached(struct rc_dose *dose,
+                                   const char     *dcm,
+                                   double          threshold)
+{
+    struct rc_mapfile_stamp stamp;
+    std::string path, tmp;
+    bool stamped;
+
+    try {
+        path = std::string(dcm) + RC_DOSE_CACHE_EXT;
+        tmp = path + '.' + std::to_string(rc_mapfile_pid());
+    } catch (const std::bad_alloc &) {
+        errno = ENOMEM;
+        return 1;
+    }
+    /* A DICOM file that cannot be stamped is not cached */
+    stamped = !rc_mapfile_stamp(dcm, &stamp);
+    if (stamped && !rc_dose_cache_map(dose, path.c_str(), &stamp, threshold)) {
+        return 0;
+    }
+    if (rc_dose_load(dose, dcm)) {
+        return 1;
+    }
+    if (rc_dose_compact(dose, threshold)) {
+        std::cerr << "Not enough memory to compact the dose\n";
+        return 0;
+    }
+    if (stamped && rc_dose_cache_write(dose,
+                                       path.c_str(),
+                                       tmp.c_str(),
+                                       &stamp,
+                                       threshold)) {
+        std::cerr << "Couldn't write the dose cache at " << path << ": "
+                  << std::strerror(errno) << '\n';
+    }
+    return 0;
+}
+
+
+/** A common grid that doses are summed on, with the sum so far */
+struct rc_dose_sum {
+    vec_t    mat[4];    /* Affine transformation matrix: Pixel to ambient */
+    vec_t    inv[4];    /* Ambient to pixel */
+    unsigned dim[3];    /* Pixel dimensions */
+    std::unique_ptr<double[]> data;     /* Summed doses, frame by frame, row
+                                        by row, without a border */
+};
+
+
+/** @brief Find the grid that holds every one of @p dose. It has the
+ *      orientation and spacing of the first, which it only grows from to
+ *      cover the rest, so that doses on the same grid are summed as they are
+ *  @param sum
+ *      Sum container
+ *  @param dose
+ *      Doses
+ *  @param n
+ *      Dose count, at least one
+ */
+static void rc_dose_sum_grid(struct rc_dose_sum   *sum,
+                             const struct rc_dose *dose,
+                             unsigned              n)
+{
+    /* Corners within this of a voxel of the first dose are on it */
+    const double tol = 1e-3;
+    RC_ALIGN scal_t c[4];
+    double lo[3], hi[3];
+    unsigned a, b, v;
+    vec_t offs;
+
+    std::fill_n(lo, 3, 0.0);
+    for (a = 0; a < 3; a++) {
+        hi[a] = dose[0].dim[a] - 1.0;
+    }
+    for (b = 1; b < n; b++) {
+        for (v = 0; v < 8; v++) {
+            offs = rc_set((v & 1) ? dose[b].dim[0] - 1.0f : 0.0f,
+                          (v & 2) ? dose[b].dim[1] - 1.0f : 0.0f,
+                          (v & 4) ? dose[b].dim[2] - 1.0f : 0.0f,
+                          1.0);
+            rc_spill(c, rc_mvmul4(dose[0].inv, rc_mvmul4(dose[b].mat, offs)));
+            for (a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], std::floor(c[a] + tol));
+                hi[a] = std::max(hi[a], std::ceil(c[a] - tol));
+            }
+        }
+    }
+    for (a = 0; a < 3; a++) {
+        sum->dim[a] = static_cast<unsigned>(hi[a] - lo[a]) + 1;
+    }
+    offs = rc_set((scal_t)lo[0], (scal_t)lo[1], (scal_t)lo[2], 1.0);
+    std::copy_n(dose[0].mat, 3, sum->mat);
+    sum->mat[3] = rc_mvmul4(dose[0].mat, offs);
+    if (rc_matrix_invert(sum->mat, sum->inv)) {
+        throw OFCondition(0, 0, OF_error, "Dose matrix is singular");
+    }
+}
+
+
+/** @brief Find where the grid of @p dose sits on the grid of @p sum, if its
+ *      voxels are voxels of @p sum
+ *  @param sum
+ *      Sum container with its grid set
+ *  @param dose
+ *      Dose
+ *  @param[out] off
+ *      Indices in @p dose of voxel zero of @p sum
+ *  @returns Whether the grids share their orientation and spacing, and the
+ *      origin of each lies on a voxel of the other
+ */
+static bool rc_dose_sum_aligned(const struct rc_dose_sum *sum,
+                                const struct rc_dose     *dose,
+                                int                       off[])
+    noexcept
+{
+    const double tol = 1e-3;
+    RC_ALIGN scal_t c[4];
+    unsigned a, b;
+
+    for (a = 0; a < 3; a++) {
+        rc_spill(c, rc_mvmul4(dose->inv, sum->mat[a]));
+        for (b = 0; b < 3; b++) {
+            if (std::fabs(c[b] - (a == b)) > tol) {
+                return false;
+            }
+        }
+    }
+    rc_spill(c, rc_mvmul4(dose->inv, sum->mat[3]));
+    for (a = 0; a < 3; a++) {
+        off[a] = static_cast<int>(std::lrint(c[a]));
+        if (std::fabs(c[a] - off[a]) > tol) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** @brief Add @p weight times frame @p k of a dose on the grid of @p sum
+ *  @param sum
+ *      Sum container
+ *  @param dose
+ *      Dose in double precision and linear order
+ *  @param off
+ *      Indices in @p dose of voxel zero of @p sum
+ *  @param k
+ *      Frame of @p sum
+ *  @param weight
+ *      Weight of @p dose
+ */
+static void rc_dose_sum_add(struct rc_dose_sum   *sum,
+                            const struct rc_dose *dose,
+                            const int             off[],
+                            unsigned              k,
+                            double                weight)
+    noexcept
+{
+    const __m256d w = _mm256_set1_pd(weight);
+    const long dk = (long)k + off[2];
+    const long i0 = std::max(0, -off[0]);
+    const long i1 = std::min((long)sum->dim[0], (long)dose->dim[0] - off[0]);
+    const double *src;
+    double *dest;
+    unsigned j;
+    long dj, i;
+
+    if (dk < 0 || dk >= (long)dose->dim[2] || i0 >= i1) {
+        return;
+    }
+    for (j = 0; j < sum->dim[1]; j++) {
+        dj = (long)j + off[1];
+        if (dj < 0 || dj >= (long)dose->dim[1]) {
+            continue;
+        }
+        src = static_cast<const double *>(dose->data)
+            + rc_dose_offset(dose, i0 + off[0], dj, dk) - i0;
+        dest = sum->data.get() + sum->dim[0] * ((size_t)sum->dim[1] * k + j);
+        for (i = i0; i + 4 <= i1; i += 4) {
+            _mm256_storeu_pd(dest + i,
+                             _mm256_fmadd_pd(w,
+                                             _mm256_loadu_pd(src + i),
+                                             _mm256_loadu_pd(dest + i)));
+        }
+        for (; i < i1; i++) {
+            dest[i] = std::fma(weight, src[i], dest[i]);
+        }
+    }
+}
+
+
+/** @brief Add @p weight times frame @p k of a dose on another grid than
+ *      @p sum, interpolated linearly at each voxel of @p sum eight at a time
+ *  @param sum
+ *      Sum container
+ *  @param dose
+ *      Dose
+ *  @param k
+ *      Frame of @p sum
+ *  @param weight
+ *      Weight of @p dose
+ */
+static void rc_dose_sum_resample(struct rc_dose_sum   *sum,
+                                 const struct rc_dose *dose,
+                                 unsigned              k,
+                                 double                weight)
+    noexcept
+{
+    const __m256d w = _mm256_set1_pd(weight);
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    RC_ALIGN scal_t org[4], step[4];
+    RC_ALIGN float px[8];
+    struct rc_packet pos;
+    __m256 idx, mask, res;
+    double *dest;
+    unsigned i, j, l;
+
+    /* Pixel coordinates in @p dose of the voxels of @p sum, along rows */
+    rc_spill(step, rc_mvmul4(dose->inv, sum->mat[0]));
+    for (j = 0; j < sum->dim[1]; j++) {
+        rc_spill(org, rc_mvmul4(dose->inv,
+                                rc_mvmul4(sum->mat,
+                                          rc_set(0.0f,
+                                                 (scal_t)j,
+                                                 (scal_t)k,
+                                                 1.0))));
+        dest = sum->data.get() + sum->dim[0] * ((size_t)sum->dim[1] * k + j);
+        for (i = 0; i < sum->dim[0]; i += 8) {
+            idx = _mm256_add_ps(lane, _mm256_set1_ps((float)i));
+            pos.x = _mm256_fmadd_ps(idx, _mm256_set1_ps(step[0]),
+                                    _mm256_set1_ps(org[0]));
+            pos.y = _mm256_fmadd_ps(idx, _mm256_set1_ps(step[1]),
+                                    _mm256_set1_ps(org[1]));
+            pos.z = _mm256_fmadd_ps(idx, _mm256_set1_ps(step[2]),
+                                    _mm256_set1_ps(org[2]));
+            mask = _mm256_cmp_ps(idx,
+                                 _mm256_set1_ps((float)sum->dim[0]),
+                                 _CMP_LT_OQ);
+            res = rc_dose_linear8(dose, &pos, mask);
+            if (i + 8 <= sum->dim[0]) {
+                _mm256_storeu_pd(dest + i, _mm256_fmadd_pd(
+                    w,
+                    _mm256_cvtps_pd(_mm256_castps256_ps128(res)),
+                    _mm256_loadu_pd(dest + i)));
+                _mm256_storeu_pd(dest + i + 4, _mm256_fmadd_pd(
+                    w,
+                    _mm256_cvtps_pd(_mm256_extractf128_ps(res, 1)),
+                    _mm256_loadu_pd(dest + i + 4)));
+                continue;
+            }
+            _mm256_store_ps(px, res);
+            for (l = 0; i + l < sum->dim[0]; l++) {
+                dest[i + l] = std::fma(weight, (double)px[l], dest[i + l]);
+            }
+        }
+    }
+}
+
+
+/** @brief Add @p weight times @p dose to @p sum, in parallel over its frames
+ *  @param sum
+ *      Sum container with its grid and data set
+ *  @param dose
+ *      Dose in double precision and linear order
+ *  @param weight
+ *      Weight of @p dose
+ */
+static void rc_dose_sum_accumulate(struct rc_dose_sum   *sum,
+                                   const struct rc_dose *dose,
+                                   double                weight)
+    noexcept
+{
+    const int kend = static_cast<int>(sum->dim[2]);
+    int off[3], k;
+    bool aligned;
+
+    aligned = rc_dose_sum_aligned(sum, dose, off);
+
+#if _OPENMP
+#   pragma omp parallel for
+#endif /* _OPENMP */
+    for (k = 0; k < kend; k++) {
+        if (aligned) {
+            rc_dose_sum_add(sum, dose, off, k, weight);
+        } else {
+            rc_dose_sum_resample(sum, dose, k, weight);
+        }
+    }
+}
+
+
+/** @brief Store @p sum in @p dose in its storage format, gathering the max,
+ *      centroid, histogram and plane maxima as rc_dose_get_pixels does
+ *  @param dose
+ *      Dose container with its storage format set
+ *  @param sum
+ *      Complete sum
+ */
+static void rc_dose_put_sum(struct rc_dose *dose, const struct rc_dose_sum *sum)
+{
+    const size_t plane = (size_t)sum->dim[0] * sum->dim[1];
+    const double limit = dose->fmt == RC_DOSE_U16 ? UINT16_MAX : UINT32_MAX;
+    const double *src = sum->data.get();
+    std::unique_ptr<unsigned char[]> data;
+    std::unique_ptr<double[]> prof;
+    double max = 0.0, *zprof;
+    size_t len, n;
+    int k, kend;
+
+    std::copy_n(sum->dim, 3, dose->dim);
+    std::copy_n(sum->mat, 4, dose->mat);
+    std::copy_n(sum->inv, 4, dose->inv);
+    rc_dose_update_bounds(dose);
+    dose->scale = 1.0;
+    dose->layout = RC_DOSE_LINEAR;
+    len = rc_dose_update_storage(dose);
+    data.reset(static_cast<unsigned char *>(rc_dose_alloc(dose->fmt, len)));
+    prof.reset(new (std::nothrow) double[dose->dim[0]
+                                         + dose->dim[1]
+                                         + dose->dim[2]]);
+    if (!data || !prof) {
+        throw OFCondition(0, 0, OF_error, "Not enough memory");
+    }
+    kend = static_cast<int>(dose->dim[2]);
+    zprof = prof.get() + dose->dim[0] + dose->dim[1];
+    /* The integer formats span the summed doses, which no one file knows */
+    if (dose->fmt == RC_DOSE_U16 || dose->fmt == RC_DOSE_U32) {
+
+#if _OPENMP
+#   pragma omp parallel for private(n) reduction(max: max)
+#endif /* _OPENMP */
+        for (k = 0; k < kend; k++) {
+            for (n = 0; n < plane; n++) {
+                max = std::max(max, src[plane * k + n]);
+            }
+        }
+        dose->scale = max > 0.0 ? max / limit : 1.0;
+    }
+    rc_dose_stats total(dose);
+
+#if _OPENMP
+#   pragma omp parallel
+#endif /* _OPENMP */
+    {
+        rc_dose_stats part(dose);
+
+#if _OPENMP
+#   pragma omp for schedule(dynamic)
+#endif /* _OPENMP */
+        for (k = 0; k < kend; k++) {
+            rc_dose_dispatch(dose->fmt, [&](auto t) {
+                rc_dose_put_frame<decltype(t)>(dose, data.get(),
+                                               src + plane * k, 1.0,
+                                               k, part, zprof);
+            });
+        }
+
+#if _OPENMP
+#   pragma omp critical(rc_dose_ingest)
+#endif /* _OPENMP */
+        total.merge(part);
+    }
+    total.finish(dose, prof.release());
+    dose->data = data.release();
+}
+
+
+extern "C" int rc_dose_load_sum(struct rc_dose    *dose,
+                                const char *const  dcm[],
+                                const double       weight[],
+                                unsigned           n)
+{
+    const enum rc_dose_layout layout = dose->layout;
+    std::vector<struct rc_dose> grid;
+    struct rc_dose part = { };
+    struct rc_dose_sum sum;
+    unsigned b;
+    int res = 0;
+
+    if (!n) {
+        errno = EINVAL;
+        return 1;
+    }
+    try {
+        /* The grid of the sum is chosen from the headers alone, so that only
+        one file at a time needs its voxels in memory */
+        grid.resize(n);
+        for (b = 0; b < n; b++) {
+            rc_dose_read_grid(&grid[b], dcm[b]);
+        }
+        rc_dose_sum_grid(&sum, grid.data(), n);
+        sum.data.reset(new (std::nothrow)
+                       double[(size_t)sum.dim[0] * sum.dim[1] * sum.dim[2]]());
+        if (!sum.data) {
+            throw OFCondition(0, 0, OF_error, "Not enough memory");
+        }
+        /* Each file is read in double precision, so that the sum is not
+        quantized twice */
+        for (b = 0; b < n; b++) {
+            part.fmt = RC_DOSE_F64;
+            rc_dose_read(&part, dcm[b]);
+            rc_dose_sum_accumulate(&sum, &part, weight ? weight[b] : 1.0);
+            rc_dose_clear(&part);
+        }
+        rc_dose_put_sum(dose, &sum);
+    } catch (const OFCondition &ofc) {
+        std::cerr << "dose error: " << ofc.text() << '\n';
+        res = 1;
+    } catch (const std::bad_alloc &) {
+        std::cerr << "dose error: Not enough memory\n";
+        errno = ENOMEM;
+        res = 1;
+    }
+    rc_dose_clear(&part);
+    if (!res) {
+        rc_dose_finish(dose, layout);
+    }
+    return res;
+}
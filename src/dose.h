@@ -3,13 +3,58 @@
 #ifndef RC_DOSE_H
 #define RC_DOSE_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "rcmath.h"
+#include "brick.h"
 
 #if defined(__cplusplus) && __cplusplus
 extern "C" {
 #endif
 
 
+/** How the voxels of a dose are stored */
+enum rc_dose_fmt {
+    RC_DOSE_F64,    /* double, the default */
+    RC_DOSE_F32,    /* float */
+    RC_DOSE_U16,    /* uint16_t, times the dose scale */
+    RC_DOSE_U32     /* uint32_t, times the dose scale */
+};
+
+
+/** How the voxels of a dose are ordered in memory */
+enum rc_dose_layout {
+    RC_DOSE_LINEAR,     /* The first index fastest, then the second, then the
+                        third, the default */
+    RC_DOSE_BRICKED     /* Bricks of RC_BRICK_LEN^3 voxels in linear order,
+                        each holding its voxels in linear order. Rays along
+                        any axis stay within a few pages */
+};
+
+
+/** Every dose is stored inside a border of zero voxels, this many thick below
+ *  the volume along each axis... */
+#define RC_DOSE_PAD_LO 1
+
+/** ...and this many above it. Indices from -1 up to dim + 1 can then be read
+ *  without checking them, which covers every corner of a linear sample
+ *  anywhere in the box from 0 to dim that rays are clipped to, even after
+ *  rounding */
+#define RC_DOSE_PAD_HI 2
+
+/** The total thickness of the border along each axis */
+#define RC_DOSE_PAD (RC_DOSE_PAD_LO + RC_DOSE_PAD_HI)
+
+
+/** The most mip levels kept above a dose. Each level halves the resolution of
+ *  the last, so the coarsest has one voxel for every 16^3 of the dose */
+#define RC_DOSE_MIPS 4
+
+
+/** Bin count of the dose histogram, one for each percent of the max dose */
+#define RC_DOSE_HIST 100
+
+
 /** A rectangular dose array */
 struct rc_dose {
     vec_t    centr;     /* Center of dose/centroid in ambient coordinates */
@@ -18,10 +63,167 @@ struct rc_dose {
     unsigned dim[3];    /* Pixel dimensions */
     __m128i  ubnd;      /* Upper bounds */
     double   dmax;      /* Maximum dose value */
-    double  *data;      /* Pixel data */
+    size_t   hist[RC_DOSE_HIST];    /* Voxel counts of the dose as loaded,
+                                    before compaction. Bin b counts doses from
+                                    b up to b + 1 percent of the max, the max
+                                    itself in the last bin, each rounded down
+                                    to nine significant bits first. Mip levels
+                                    have none */
+    double  *prof;      /* Largest dose in each plane normal to the first
+                        axis, then the second, then the third, or NULL.
+                        rc_dose_view and rc_dose_compact find their bounds in
+                        these instead of the voxels. Views have none */
+    void    *data;      /* Pixel data, in the storage format */
+
+    enum rc_dose_fmt fmt;       /* Storage format. Set this before loading */
+    double           scale;     /* Dose of one unit of the integer formats */
+
+    enum rc_dose_layout layout; /* Voxel order. Set this before loading or use
+                                rc_dose_set_layout */
+    unsigned            sdim[3];    /* Dimensions of the stored volume, which
+                                    are larger than dim in a view */
+    unsigned            org[3];     /* Indices of voxel zero in the stored
+                                    volume, nonzero only in a view */
+    unsigned            bdim[3];    /* Brick counts of the bricked layout */
+
+    double           floor;     /* PROPORTION of dmax at or below which bricks
+                                are skipped by rays. Set this before loading
+                                or use rc_dose_set_floor */
+    struct rc_bricks bricks;    /* Empty-space skipping map */
+
+    unsigned        nmip;   /* Number of mip levels */
+    struct rc_dose *mip;    /* Mip levels, finest first. Voxel (i, j, k) of
+                            each holds the max of voxels 2 * (i, j, k) up to
+                            2 * (i, j, k) + 1 of the level below it, and sits
+                            at their center, so that no level loses a hot
+                            spot. Levels have no mips of their own */
+
+    void  *map;     /* Mapping of the cache file that the pixel data of this
+                    dose and its mips point into, or NULL. Only the dose
+                    that was loaded owns it, not its levels */
+    size_t maplen;  /* Length of the mapping in bytes */
+    int    shared;  /* If nonzero, the pixel data is not this dose's own. It
+                    lies in a mapping, which is read-only, or belongs to the
+                    dose this is a view of. It is never freed */
 };
 
 
+/** @brief Find where voxel (@p i, @p j, @p k) is stored
+ *  @param dose
+ *      Dose volume
+ *  @param i
+ *      First index, which may be in the border
+ *  @param j
+ *      Second index, which may be in the border
+ *  @param k
+ *      Third index, which may be in the border
+ *  @returns The offset of the voxel in the pixel data, in voxels
+ */
+static inline size_t rc_dose_offset(const struct rc_dose *dose,
+                                    unsigned              i,
+                                    unsigned              j,
+                                    unsigned              k)
+{
+    const unsigned mask = RC_BRICK_LEN - 1;
+    size_t b;
+
+    /* Unsigned, so that -1 wraps back to zero */
+    i += RC_DOSE_PAD_LO + dose->org[0];
+    j += RC_DOSE_PAD_LO + dose->org[1];
+    k += RC_DOSE_PAD_LO + dose->org[2];
+    if (dose->layout == RC_DOSE_BRICKED) {
+        b = (i >> RC_BRICK_LOG2) + dose->bdim[0] * ((j >> RC_BRICK_LOG2)
+            + (size_t)dose->bdim[1] * (k >> RC_BRICK_LOG2));
+        return b << 3 * RC_BRICK_LOG2
+             | (k & mask) << 2 * RC_BRICK_LOG2
+             | (j & mask) << RC_BRICK_LOG2
+             | (i & mask);
+    }
+    return i + (dose->sdim[0] + RC_DOSE_PAD)
+        * (j + (size_t)(dose->sdim[1] + RC_DOSE_PAD) * k);
+}
+
+
+/** @brief Packet version of rc_dose_offset
+ *  @param dose
+ *      Dose volume
+ *  @param x
+ *      First index of each lane
+ *  @param y
+ *      Second index of each lane
+ *  @param z
+ *      Third index of each lane
+ *  @returns The offset of each voxel. Lanes outside of the volume and its
+ *      border are garbage
+ */
+static inline __m256i rc_dose_offset8(const struct rc_dose *dose,
+                                      __m256i               x,
+                                      __m256i               y,
+                                      __m256i               z)
+{
+    const __m256i mask = _mm256_set1_epi32(RC_BRICK_LEN - 1);
+    __m256i b, n;
+
+    x = _mm256_add_epi32(x, _mm256_set1_epi32((int)(RC_DOSE_PAD_LO
+                                                    + dose->org[0])));
+    y = _mm256_add_epi32(y, _mm256_set1_epi32((int)(RC_DOSE_PAD_LO
+                                                    + dose->org[1])));
+    z = _mm256_add_epi32(z, _mm256_set1_epi32((int)(RC_DOSE_PAD_LO
+                                                    + dose->org[2])));
+    if (dose->layout == RC_DOSE_BRICKED) {
+        b = _mm256_mullo_epi32(_mm256_srli_epi32(z, RC_BRICK_LOG2),
+                               _mm256_set1_epi32((int)dose->bdim[1]));
+        b = _mm256_add_epi32(b, _mm256_srli_epi32(y, RC_BRICK_LOG2));
+        b = _mm256_mullo_epi32(b, _mm256_set1_epi32((int)dose->bdim[0]));
+        b = _mm256_add_epi32(b, _mm256_srli_epi32(x, RC_BRICK_LOG2));
+        n = _mm256_slli_epi32(_mm256_and_si256(z, mask), 2 * RC_BRICK_LOG2);
+        n = _mm256_or_si256(n, _mm256_slli_epi32(_mm256_and_si256(y, mask),
+                                                 RC_BRICK_LOG2));
+        n = _mm256_or_si256(n, _mm256_and_si256(x, mask));
+        return _mm256_or_si256(_mm256_slli_epi32(b, 3 * RC_BRICK_LOG2), n);
+    }
+    n = _mm256_mullo_epi32(z, _mm256_set1_epi32((int)dose->sdim[1]
+                                                + RC_DOSE_PAD));
+    n = _mm256_add_epi32(n, y);
+    n = _mm256_mullo_epi32(n, _mm256_set1_epi32((int)dose->sdim[0]
+                                                + RC_DOSE_PAD));
+    return _mm256_add_epi32(n, x);
+}
+
+
+/** @brief Read one voxel of @p dose, whatever its storage format
+ *  @param dose
+ *      Dose volume
+ *  @param n
+ *      Offset of the voxel from rc_dose_offset, which must be in bounds
+ *  @returns The dose there
+ */
+static inline double rc_dose_voxel(const struct rc_dose *dose, size_t n)
+{
+    switch (dose->fmt) {
+    case RC_DOSE_F32:
+        return ((const float *)dose->data)[n];
+    case RC_DOSE_U16:
+        return dose->scale * ((const uint16_t *)dose->data)[n];
+    case RC_DOSE_U32:
+        return dose->scale * ((const uint32_t *)dose->data)[n];
+    default:
+        return ((const double *)dose->data)[n];
+    }
+}
+
+
+/** @brief Parse the name of a storage format
+ *  @param name
+ *      One of "f64", "f32", "u16" or "u32"
+ *  @param[out] fmt
+ *      The format named by @p name
+ *  @returns Nonzero if @p name is not recognized, in which case errno(3) is
+ *      set
+ */
+int rc_dose_fmt_parse(const char *name, enum rc_dose_fmt *fmt);
+
+
 /** @brief Load a DICOM file @p dcm
  *  @param dose
  *      Dose container
@@ -32,7 +234,94 @@ struct rc_dose {
 int rc_dose_load(struct rc_dose *dose, const char *dcm);
 
 
-/** @brief Delete the stored pixels and free all memory
+/** @brief Load several DICOM files, such as the doses of each beam of a plan,
+ *      and sum them with weights into a single dose. The sum lies on a grid
+ *      with the orientation and spacing of the first dose, grown to hold every
+ *      other. Doses on that grid are added voxel by voxel, and the rest are
+ *      interpolated linearly at its voxels, eight at a time. Each frame of the
+ *      sum is summed in parallel
+ *  @param dose
+ *      Dose container, empty, with its storage format, layout and floor set
+ *  @param dcm
+ *      Paths to DICOM files
+ *  @param weight
+ *      Weight of each dose, or NULL to weigh each by one
+ *  @param n
+ *      File count, at least one
+ *  @returns Nonzero on failure/error. The grid is found from the header of
+ *      each file, and then the files are read and summed one at a time, so
+ *      only the sum and one file are held in double precision at once
+ */
+int rc_dose_load_sum(struct rc_dose    *dose,
+                     const char *const  dcm[],
+                     const double       weight[],
+                     unsigned           n);
+
+
+/** Suffix appended to the path of a DICOM file to name its dose cache */
+#define RC_DOSE_CACHE_EXT ".rcd"
+
+
+/** @brief Load a DICOM file @p dcm and compact it, through a cache beside it.
+ *      The cache holds the voxels of the compacted dose in its storage format
+ *      and layout, its mip levels, geometry and brick maxima, in the native
+ *      byte order. If it is current, it is mapped instead of reading the DICOM
+ *      file, and the pixel data points straight into the mapping, shared with
+ *      every other process that maps it. Otherwise the DICOM file is loaded
+ *      and compacted, and the cache is written for next time
+ *  @param dose
+ *      Dose container, empty, with its storage format, layout and floor set
+ *  @param dcm
+ *      Path to DICOM file
+ *  @param threshold
+ *      Compaction threshold passed to rc_dose_compact. A cache written with
+ *      another threshold, format or layout, or older than @p dcm, is
+ *      replaced
+ *  @returns Nonzero if the dose cannot be loaded at all. Failing to write the
+ *      cache is only reported
+ */
+int rc_dose_load_cached(struct rc_dose *dose,
+                        const char     *dcm,
+                        double          threshold);
+
+
+/** @brief Change the dose floor and rebuild the brick map with it. Rays leap
+ *      over every brick whose maximum is at or below the floor without sampling
+ *      it, so a nonzero floor drops those doses from the projection
+ *  @param dose
+ *      Dose container
+ *  @param floor
+ *      PROPORTION (i.e. <= 1.0) of max dose at or below which a brick is empty
+ *  @returns Nonzero if there is not enough memory to build the map. On
+ *      failure, errno(3) is set and @p dose is still valid, but rays will not
+ *      skip anything
+ */
+int rc_dose_set_floor(struct rc_dose *dose, double floor);
+
+
+/** @brief Reorder the voxels of @p dose and its mip levels. A view is copied
+ *      into pixel data of its own
+ *  @param dose
+ *      Dose container
+ *  @param layout
+ *      New voxel order
+ *  @returns Nonzero if there is not enough memory, in which case errno(3) is
+ *      set and any level that could not be reordered keeps its old order
+ */
+int rc_dose_set_layout(struct rc_dose *dose, enum rc_dose_layout layout);
+
+
+/** @brief Rebuild the mip levels of @p dose after its pixels change. This is
+ *      done on load and by rc_dose_compact
+ *  @param dose
+ *      Dose container with pixel data
+ *  @returns Nonzero if there is not enough memory for every level, in which
+ *      case errno(3) is set and @p dose keeps the levels that were built
+ */
+int rc_dose_build_mips(struct rc_dose *dose);
+
+
+/** @brief Delete the stored pixels, free all memory and unmap any cache
  *  @param dose
  *      Dose container. The dimensions will be zeroed
  */
@@ -72,10 +361,120 @@ double rc_dose_nearest(const struct rc_dose *dose, vec_t pos);
 double rc_dose_linear(const struct rc_dose *dose, vec_t pos);
 
 
+/** @brief Signature for a function that interpolates the dose at eight
+ *      positions at once
+ *  @param dose
+ *      The dose volume
+ *  @param pos
+ *      Real-valued pixel coordinates of each lane
+ *  @param mask
+ *      Only lanes with their sign bit set are sampled. The rest are zero
+ *  @returns The interpolated doses, in single precision
+ */
+typedef __m256 rc_dose_interp8fn_t(const struct rc_dose   *dose,
+                                   const struct rc_packet *pos,
+                                   __m256                  mask);
+
+
+/** @brief Read eight voxels of @p dose at once, whatever its storage format
+ *  @param dose
+ *      Dose volume
+ *  @param n
+ *      Offset of the voxel of each lane from rc_dose_offset8
+ *  @param mask
+ *      Only lanes with their sign bit set are read, and they must be in bounds.
+ *      The rest are zero
+ *  @returns The doses, in single precision
+ */
+__m256 rc_dose_gather8(const struct rc_dose *dose, __m256i n, __m256 mask);
+
+
+/** @brief Packet version of rc_dose_nearest
+ *  @param dose
+ *      Dose
+ *  @param pos
+ *      Real-valued pixel positions. Out-of-bounds lanes are zero
+ *  @param mask
+ *      Active lanes
+ *  @returns The nearest @p dose values to each lane of @p pos
+ */
+__m256 rc_dose_nearest8(const struct rc_dose   *dose,
+                        const struct rc_packet *pos,
+                        __m256                  mask);
+
+
+/** @brief Packet version of rc_dose_linear
+ *  @param dose
+ *      Dose volume
+ *  @param pos
+ *      Pixel positions over the reals
+ *  @param mask
+ *      Active lanes
+ *  @returns The interpolated doses at each lane of @p pos, with the same edge
+ *      behavior as rc_dose_linear
+ */
+__m256 rc_dose_linear8(const struct rc_dose   *dose,
+                       const struct rc_packet *pos,
+                       __m256                  mask);
+
+
+/** @brief rc_dose_nearest without the bounds checks
+ *  @param dose
+ *      Dose
+ *  @param pos
+ *      Real-valued pixel position, which must be in the box from 0 to dim up
+ *      to a voxel. Rays clipped by their intersection with the volume are
+ *  @returns The nearest @p dose value to @p pos. The border is zero
+ */
+double rc_dose_nearest_unchecked(const struct rc_dose *dose, vec_t pos);
+
+
+/** @brief rc_dose_linear without the bounds checks
+ *  @param dose
+ *      Dose volume
+ *  @param pos
+ *      Pixel position over the reals, in the box from 0 to dim up to a voxel
+ *  @returns The interpolated dose at @p pos, which is the same as
+ *      rc_dose_linear because the border is zero
+ */
+double rc_dose_linear_unchecked(const struct rc_dose *dose, vec_t pos);
+
+
+/** @brief Packet version of rc_dose_nearest_unchecked
+ *  @param dose
+ *      Dose
+ *  @param pos
+ *      Real-valued pixel positions. Active lanes must be in the box from 0 to
+ *      dim up to a voxel
+ *  @param mask
+ *      Active lanes
+ *  @returns The nearest @p dose values to each lane of @p pos
+ */
+__m256 rc_dose_nearest8_unchecked(const struct rc_dose   *dose,
+                                  const struct rc_packet *pos,
+                                  __m256                  mask);
+
+
+/** @brief Packet version of rc_dose_linear_unchecked
+ *  @param dose
+ *      Dose volume
+ *  @param pos
+ *      Pixel positions over the reals. Active lanes must be in the box from 0
+ *      to dim up to a voxel
+ *  @param mask
+ *      Active lanes
+ *  @returns The interpolated doses at each lane of @p pos
+ */
+__m256 rc_dose_linear8_unchecked(const struct rc_dose   *dose,
+                                 const struct rc_packet *pos,
+                                 __m256                  mask);
+
+
 /** @brief Compact @p dose by removing all boundary regions below a threshold.
  *      All planes that are below the computed threshold are DELETED. This is a
  *      destructive operation. The only way to restore a dose that was compacted
- *      is to reload it from disk
+ *      is to reload it from disk. rc_dose_view crops a dose without copying or
+ *      deleting anything
  *  @param dose
  *      Dose to compact
  *  @param threshold
@@ -88,6 +487,33 @@ double rc_dose_linear(const struct rc_dose *dose, vec_t pos);
 int rc_dose_compact(struct rc_dose *dose, double threshold);
 
 
+/** @brief Point @p view at the smallest box of @p dose holding every voxel
+ *      above a threshold, without copying it. The view has the voxels, mip
+ *      levels and brick map of that box and the affine matrix to match, so it
+ *      renders like @p dose compacted with the same threshold, except that
+ *      the border of the view is the voxels of @p dose around it rather than
+ *      zero. Its bounds come from the plane maxima of @p dose and its brick
+ *      maxima from those of @p dose, so unless either is missing no voxel is
+ *      read, and the threshold can be changed as often as needed
+ *  @param view
+ *      Dose container, empty or holding a view from before, which is cleared
+ *      first. It must not be @p dose
+ *  @param dose
+ *      Dose to view, which may be a view itself. Its pixel data is shared with
+ *      @p view, so it must not be compacted, reordered or cleared while
+ *      @p view is in use
+ *  @param threshold
+ *      PROPORTION (i.e. <= 1.0) of max dose above which the point shall be
+ *      in the view
+ *  @returns Nonzero if there is not enough memory for the mip levels of the
+ *      view, in which case errno(3) is set and @p view is still valid without
+ *      them
+ */
+int rc_dose_view(struct rc_dose       *view,
+                 const struct rc_dose *dose,
+                 double                threshold);
+
+
 #if defined(__cplusplus) && __cplusplus
 }
 #endif
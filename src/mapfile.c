@@ -0,0 +1,169 @@
+#if !defined(_WIN32) || !_WIN32
+#   define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include "mapfile.h"
+
+#if defined(_WIN32) && _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   include <process.h>
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+
+#if defined(_WIN32) && _WIN32
+
+
+int rc_mapfile_stamp(const char *path, struct rc_mapfile_stamp *stamp)
+{
+    struct _stat64 st;
+
+    if (_stat64(path, &st)) {
+        return 1;
+    }
+    stamp->size = (uint64_t)st.st_size;
+    stamp->mtime = (int64_t)st.st_mtime;
+    return 0;
+}
+
+
+void *rc_mapfile_open(const char *path, size_t *len)
+{
+    HANDLE file, map;
+    LARGE_INTEGER size;
+    void *res = NULL;
+
+    file = CreateFileA(path,
+                       GENERIC_READ,
+                       FILE_SHARE_READ | FILE_SHARE_DELETE,
+                       NULL,
+                       OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL,
+                       NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        errno = ENOENT;
+        return NULL;
+    }
+    if (!GetFileSizeEx(file, &size) || !size.QuadPart
+     || (uint64_t)size.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        errno = EINVAL;
+        return NULL;
+    }
+    /* The view keeps the mapping and the file open by itself */
+    map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map) {
+        res = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(map);
+    }
+    CloseHandle(file);
+    if (!res) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *len = (size_t)size.QuadPart;
+    return res;
+}
+
+
+void rc_mapfile_close(void *addr, size_t len)
+{
+    (void)len;
+    if (addr) {
+        UnmapViewOfFile(addr);
+    }
+}
+
+
+int rc_mapfile_replace(const char *src, const char *dest)
+{
+    if (!MoveFileExA(src, dest, MOVEFILE_REPLACE_EXISTING)) {
+        errno = EACCES;
+        return 1;
+    }
+    return 0;
+}
+
+
+unsigned long rc_mapfile_pid(void)
+{
+    return (unsigned long)_getpid();
+}
+
+
+#else
+
+
+int rc_mapfile_stamp(const char *path, struct rc_mapfile_stamp *stamp)
+{
+    struct stat st;
+
+    if (stat(path, &st)) {
+        return 1;
+    }
+    stamp->size = (uint64_t)st.st_size;
+    stamp->mtime = (int64_t)st.st_mtime;
+    return 0;
+}
+
+
+void *rc_mapfile_open(const char *path, size_t *len)
+{
+    struct stat st;
+    void *res;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st)) {
+        close(fd);
+        return NULL;
+    }
+    if (!st.st_size || (uintmax_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    /* The mapping keeps the file open by itself */
+    res = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (res == MAP_FAILED) {
+        return NULL;
+    }
+    *len = (size_t)st.st_size;
+    return res;
+}
+
+
+void rc_mapfile_close(void *addr, size_t len)
+{
+    if (addr) {
+        munmap(addr, len);
+    }
+}
+
+
+int rc_mapfile_replace(const char *src, const char *dest)
+{
+    return rename(src, dest) != 0;
+}
+
+
+unsigned long rc_mapfile_pid(void)
+{
+    return (unsigned long)getpid();
+}
+
+
+#endif /* _WIN32 */
@@ -0,0 +1,75 @@
+#pragma once
+
+#ifndef RC_MAPFILE_H
+#define RC_MAPFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus) && __cplusplus
+extern "C" {
+#endif
+
+
+/** Enough of the metadata of a file to tell when it has been rewritten */
+struct rc_mapfile_stamp {
+    uint64_t size;  /* Length in bytes */
+    int64_t  mtime; /* Last modification, in seconds since the epoch */
+};
+
+
+/** @brief Look up the stamp of the file at @p path
+ *  @param path
+ *      Path to the file
+ *  @param[out] stamp
+ *      Its size and modification time
+ *  @returns Nonzero if the file cannot be found, in which case errno(3) is set
+ */
+int rc_mapfile_stamp(const char *path, struct rc_mapfile_stamp *stamp);
+
+
+/** @brief Map the whole file at @p path read-only. The mapping is shared, so
+ *      every process that maps the same file reads the same pages of the page
+ *      cache
+ *  @param path
+ *      Path to the file
+ *  @param[out] len
+ *      Length of the mapping in bytes
+ *  @returns The page-aligned start of the mapping, or NULL if the file cannot
+ *      be opened or is empty, in which case errno(3) is set
+ */
+void *rc_mapfile_open(const char *path, size_t *len);
+
+
+/** @brief Unmap a file mapped by rc_mapfile_open
+ *  @param addr
+ *      Start of the mapping, or NULL
+ *  @param len
+ *      Length of the mapping
+ */
+void rc_mapfile_close(void *addr, size_t len);
+
+
+/** @brief Rename @p src to @p dest, replacing @p dest if it exists. Readers of
+ *      @p dest see either the old file or the new one, never part of either
+ *  @param src
+ *      Path to a complete file
+ *  @param dest
+ *      Path to replace
+ *  @returns Nonzero on failure, in which case errno(3) is set
+ */
+int rc_mapfile_replace(const char *src, const char *dest);
+
+
+/** @brief Get a number unique to this process among those running, for naming
+ *      temporary files that other processes might be writing at the same time
+ *  @returns The process ID
+ */
+unsigned long rc_mapfile_pid(void);
+
+
+#if defined(__cplusplus) && __cplusplus
+}
+#endif
+
+#endif /* RC_MAPFILE_H */
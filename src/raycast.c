@@ -1,6 +1,9 @@
 #include <assert.h>
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "raycast.h"
 
 
@@ -82,7 +85,12 @@ void rc_target_update(struct rc_target *target, const struct rc_screen *screen)
     const double pi = RC_PI, conv = pi / 360;
     RC_ALIGN scal_t spill[4] = { 0 };
 
-    spill[0] = (scal_t)(2.0 * tan(conv * screen->fov));
+    target->ortho = screen->width > 0.0;
+    if (target->ortho) {
+        spill[0] = (scal_t)screen->width;
+    } else {
+        spill[0] = (scal_t)(2.0 * tan(conv * screen->fov));
+    }
     spill[1] = (scal_t)aspect * spill[0];
     target->size = rc_load(spill);
 
@@ -198,148 +206,2733 @@ static int rc_raycast_intersect(const struct rc_dose *dose,
 }
 
 
+/** @brief Find the distance along a ray to the exit of the box from @p lo to
+ *      @p hi, which is assumed to contain @p pos
+ *  @param pos
+ *      Pixel coordinates of the current sample
+ *  @param tangent
+ *      Tangent vector in pixel coordinates
+ *  @param lo
+ *      Lower corner of the box
+ *  @param hi
+ *      Upper corner of the box
+ *  @returns The distance along the ray, in units of @p tangent
+ */
+static scal_t rc_raycast_box(vec_t pos, vec_t tangent, vec_t lo, vec_t hi)
+{
+    RC_ALIGN scal_t spill[4];
+    vec_t dt;
+    scal_t res;
+
+    dt = _mm_blendv_ps(rc_sub(hi, pos), rc_sub(pos, lo), tangent);
+    dt = rc_div(dt, _mm_andnot_ps(rc_set1(-0.0f), tangent));
+    rc_spill(spill, dt);
+    res = INFINITY;
+    res = rc_fmin(spill[0], res);
+    res = rc_fmin(spill[1], res);
+    res = rc_fmin(spill[2], res);
+    return res;
+}
+
+
+/** @brief Find the coordinates of the brick containing @p pos
+ *  @param bricks
+ *      Brick map
+ *  @param pos
+ *      Pixel coordinates
+ *  @param[out] blk
+ *      Brick coordinates, clamped to the grid
+ *  @returns The linear index of the brick
+ */
+static size_t rc_raycast_blkidx(const struct rc_bricks *bricks,
+                                vec_t                   pos,
+                                int                     blk[])
+{
+    const vec_t len = rc_set1((scal_t)RC_BRICK_LEN);
+    union {
+        __m128i idx;
+        int     xmm[4];
+    } u;
+    __m128i ubnd;
+
+    ubnd = _mm_set_epi32(0,
+                         bricks->dim[2] - 1,
+                         bricks->dim[1] - 1,
+                         bricks->dim[0] - 1);
+    u.idx = _mm_cvtps_epi32(rc_floor(rc_div(pos, len)));
+    u.idx = _mm_min_epi32(_mm_max_epi32(u.idx, _mm_setzero_si128()), ubnd);
+    blk[0] = u.xmm[0];
+    blk[1] = u.xmm[1];
+    blk[2] = u.xmm[2];
+    return blk[0] + bricks->dim[0] * (blk[1] + (size_t)bricks->dim[1] * blk[2]);
+}
+
+
+/** @brief Look up the brick containing @p pos and find how far the ray can go
+ *      before it has to look at the brick map again. That is the exit of the
+ *      brick itself if it is nonempty, and otherwise the exit of the cube of
+ *      empty bricks surrounding it, which the distance map guarantees
+ *  @param bricks
+ *      Brick map
+ *  @param pos
+ *      Pixel coordinates of the current sample
+ *  @param tangent
+ *      Tangent vector in pixel coordinates
+ *  @param[out] empty
+ *      Set to true if the brick is empty, meaning that every sample up to the
+ *      returned distance may be skipped
+ *  @returns The distance along the ray, in units of @p tangent
+ */
+static scal_t rc_raycast_brick(const struct rc_bricks *bricks,
+                               vec_t                   pos,
+                               vec_t                   tangent,
+                               bool                   *empty)
+{
+    const vec_t len = rc_set1((scal_t)RC_BRICK_LEN);
+    vec_t blk, lo, hi;
+    unsigned dist, half;
+    int b[3];
+
+    dist = bricks->dist[rc_raycast_blkidx(bricks, pos, b)];
+    half = dist ? dist - 1 : 0;
+    *empty = dist > 0;
+    blk = rc_set((scal_t)b[0], (scal_t)b[1], (scal_t)b[2], 0.0);
+    lo = rc_mul(rc_sub(blk, rc_set1((scal_t)half)), len);
+    hi = rc_mul(rc_add(blk, rc_set1((scal_t)(half + 1))), len);
+    return rc_raycast_box(pos, tangent, lo, hi);
+}
+
+
+/** @brief Climb the max pyramid from the brick containing @p pos for as long
+ *      as the node maxima do not exceed @p thresh. For MIP, no sample in such
+ *      a node can change the result. For compositing, every sample in it is
+ *      transparent
+ *  @param bricks
+ *      Brick map
+ *  @param pos
+ *      Pixel coordinates of the current sample
+ *  @param tangent
+ *      Tangent vector in pixel coordinates
+ *  @param thresh
+ *      The running maximum of the ray, or the dose at or below which samples
+ *      are transparent
+ *  @param[out] prune
+ *      Set to true if the brick containing @p pos does not exceed @p thresh
+ *  @returns The distance along the ray to the exit of the largest node that
+ *      can be pruned, in units of @p tangent, or zero if @p prune is false
+ */
+static scal_t rc_raycast_prune(const struct rc_bricks *bricks,
+                               vec_t                   pos,
+                               vec_t                   tangent,
+                               float                   thresh,
+                               bool                   *prune)
+{
+    const struct rc_brick_level *lev;
+    unsigned l, shift = 0;
+    size_t n;
+    scal_t len;
+    int b[3];
+    vec_t lo;
+
+    n = rc_raycast_blkidx(bricks, pos, b);
+    *prune = !(bricks->max[n] > thresh);
+    if (!*prune) {
+        return 0.0f;
+    }
+    for (l = 0; l < bricks->nlev; l++) {
+        lev = &bricks->lev[l];
+        n = (b[0] >> (l + 1)) + lev->dim[0]
+          * ((b[1] >> (l + 1)) + (size_t)lev->dim[1] * (b[2] >> (l + 1)));
+        if (lev->max[n] > thresh) {
+            break;
+        }
+        shift = l + 1;
+    }
+    len = (scal_t)(RC_BRICK_LEN << shift);
+    lo = rc_set((scal_t)(b[0] >> shift << shift),
+                (scal_t)(b[1] >> shift << shift),
+                (scal_t)(b[2] >> shift << shift),
+                0.0);
+    lo = rc_mul(lo, rc_set1((scal_t)RC_BRICK_LEN));
+    return rc_raycast_box(pos, tangent, lo, rc_add(lo, rc_set1(len)));
+}
+
+
+/** @brief Signature for a function that computes the pixel dose for a ray
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn
+ *      Interpolator function applied to @p dose
+ *  @param org
+ *      Position on the ray, in pixel coordinates
+ *  @param tangent
+ *      Tangent vector in pixel coordinates, one step long
+ *  @param[in,out] depth
+ *      On entry, the parameter of a point on the ray in steps from @p org
+ *      that is likely to be near its max, or NaN. Its dose seeds the result,
+ *      so that more of the ray can be pruned. On return, the parameter of the
+ *      max, or NaN if the ray found no dose
+ *  @param[out] count
+ *      The number of samples taken
+ *  @returns The dose picked out for this ray
+ */
+typedef double rc_raycast_kernel_t(const struct rc_dose *dose,
+                                   rc_dose_interpfn_t   *dosefn,
+                                   vec_t                 org,
+                                   vec_t                 tangent,
+                                   scal_t               *depth,
+                                   unsigned             *count);
+
+
+/** @brief Signature for a function that computes the pixel doses for eight
+ *      rays at once
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn8
+ *      Packet interpolator applied to @p dose
+ *  @param org
+ *      Positions on each ray, in pixel coordinates
+ *  @param tangent
+ *      Tangent vectors in pixel coordinates, each one step long
+ *  @param[in,out] depth
+ *      Seeds on entry and the parameters of each max on return, as in
+ *      rc_raycast_kernel_t
+ *  @param[out] count
+ *      The number of samples taken by each ray
+ *  @returns The dose picked out for each ray
+ */
+typedef __m256 rc_raycast_kernel8_t(const struct rc_dose   *dose,
+                                    rc_dose_interp8fn_t    *dosefn8,
+                                    const struct rc_packet *org,
+                                    const struct rc_packet *tangent,
+                                    __m256                 *depth,
+                                    __m256                 *count);
+
+
 /** @brief Compute the pixel dose for a ray given by homogeneous coordinates
- *      @p pos and tangent vector @p tangent
+ *      @p org and tangent vector @p tangent
  *  @param dose
  *      Dose to raycast
  *  @param dosefn
  *      Interpolator function applied to @p dose
- *  @param pos
- *      Ambient position of the point on the line
+ *  @param org
+ *      Position on the ray, in pixel coordinates
  *  @param tangent
- *      Tangent vector in the ambient space. This does not need to be normalized
- *      (and should not, because it will be in this function)
+ *      Unit tangent vector in pixel coordinates
+ *  @param[in,out] depth
+ *      Seed on entry and the parameter of the max on return. The seed is
+ *      rounded to the nearest step, so that it does not change the result
+ *  @param[out] count
+ *      The number of samples taken
  *  @returns The dose picked out for this ray
  */
 static double rc_raycast_compute(const struct rc_dose *dose,
                                  rc_dose_interpfn_t   *dosefn,
-                                 vec_t                 pos,
-                                 vec_t                 tangent)
+                                 vec_t                 org,
+                                 vec_t                 tangent,
+                                 scal_t               *depth,
+                                 unsigned             *count)
 {
+    const struct rc_bricks *bricks = &dose->bricks;
+    const scal_t seed = rintf(*depth);
     double res = 0.0, next;
-    int count, tau, end;
-    vec_t params[6];
-
-    pos = rc_mvmul4(dose->inv, pos);
-    tangent = rc_mvmul3(dose->inv, tangent);
-    tangent = rc_vnorm(tangent);
-    count = rc_raycast_intersect(dose, pos, tangent, params);
-    if (count > 1) {
+    scal_t tau, end, exit, skip;
+    vec_t params[6], pos;
+    bool empty, prune;
+    unsigned n = 0;
+
+    *depth = NAN;
+    if (rc_raycast_intersect(dose, org, tangent, params) > 1) {
         params[2] = rc_ceil(rc_max(rc_min(params[0], params[1]), rc_zero()));
         params[3] = rc_floor(rc_max(params[0], params[1]));
-        pos = rc_fmadd(params[2], tangent, pos);
-        tau = (int)rc_cvtsf(params[2]);
-        end = (int)rc_cvtsf(params[3]);
-        for (; tau < end; tau += 1) {
+        tau = exit = rc_cvtsf(params[2]);
+        end = rc_cvtsf(params[3]);
+        if (seed >= tau && seed < end) {
+            res = dosefn(dose, rc_fmadd(rc_set1(seed), tangent, org));
+            *depth = res > 0.0 ? seed : NAN;
+            n++;
+        }
+        while (tau < end && res < dose->dmax) {
+            pos = rc_fmadd(rc_set1(tau), tangent, org);
+            if (bricks->dist && tau >= exit) {
+                exit = rc_raycast_brick(bricks, pos, tangent, &empty);
+                skip = rc_raycast_prune(bricks,
+                                        pos,
+                                        tangent,
+                                        (float)rc_fmax(res, bricks->floor),
+                                        &prune);
+                exit = tau + rc_fmax(exit, skip);
+                if (empty || prune) {
+                    tau = rc_fmax(ceil(exit), tau + 1.0f);
+                    continue;
+                }
+            }
+            next = dosefn(dose, pos);
+            if (next > res) {
+                res = next;
+                *depth = tau;
+            }
+            tau += 1.0f;
+            n++;
+        }
+    }
+    *count = n;
+    return res;
+}
+
+
+/** @brief Maximum-intensity projection with a step that adapts to the dose.
+ *      This is an rc_raycast_kernel_t. Steps double, up to four times the
+ *      tangent, while successive samples differ by less than 1/256 of the max
+ *      dose, and halve, down to a quarter of it, while they differ by more than
+ *      1/64. Seeds are ignored, since a seed would land between the steps
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn
+ *      Interpolator function applied to @p dose
+ *  @param org
+ *      Position on the ray, in pixel coordinates
+ *  @param tangent
+ *      Tangent vector in pixel coordinates, one base step long
+ *  @param[out] depth
+ *      The parameter of the max
+ *  @param[out] count
+ *      The number of samples taken
+ *  @returns The dose picked out for this ray
+ */
+static double rc_raycast_adaptive(const struct rc_dose *dose,
+                                  rc_dose_interpfn_t   *dosefn,
+                                  vec_t                 org,
+                                  vec_t                 tangent,
+                                  scal_t               *depth,
+                                  unsigned             *count)
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    const double tol = dose->dmax / 64.0;
+    double res = 0.0, prev = 0.0, next, diff;
+    scal_t tau, end, exit, skip, dt = 1.0f;
+    vec_t params[6], pos;
+    bool empty, prune;
+    unsigned n = 0;
+
+    *depth = NAN;
+    if (rc_raycast_intersect(dose, org, tangent, params) > 1) {
+        params[2] = rc_max(rc_min(params[0], params[1]), rc_zero());
+        params[3] = rc_max(params[0], params[1]);
+        tau = exit = rc_cvtsf(params[2]);
+        end = rc_cvtsf(params[3]);
+        while (tau < end && res < dose->dmax) {
+            pos = rc_fmadd(rc_set1(tau), tangent, org);
+            if (bricks->dist && tau >= exit) {
+                exit = rc_raycast_brick(bricks, pos, tangent, &empty);
+                skip = rc_raycast_prune(bricks,
+                                        pos,
+                                        tangent,
+                                        (float)rc_fmax(res, bricks->floor),
+                                        &prune);
+                exit = tau + rc_fmax(exit, skip);
+                if (empty || prune) {
+                    tau = rc_fmax(exit, tau + dt);
+                    prev = 0.0;
+                    continue;
+                }
+            }
             next = dosefn(dose, pos);
-            res = rc_fmax(next, res);
-            pos = rc_add(pos, tangent);
+            if (next > res) {
+                res = next;
+                *depth = tau;
+            }
+            diff = fabs(next - prev);
+            if (diff > tol) {
+                dt = rc_fmaxf(0.5f * dt, 0.25f);
+            } else if (diff < 0.25 * tol) {
+                dt = rc_fminf(2.0f * dt, 4.0f);
+            }
+            prev = next;
+            tau += dt;
+            n++;
         }
     }
+    *count = n;
     return res;
 }
 
 
-/** A tangent basis for the image plane */
-struct rc_basis {
-    vec_t x;    /* The horizontal tangent basis vector */
-    vec_t y;    /* The vertical tangent basis vector */
-    vec_t org;  /* The physical coordinates of the top left corner */
+/** @brief Reduce the samples along a ray with any projection but the max.
+ *      This is always inlined with a constant @p proj, so that each
+ *      projection gets a kernel of its own with no dispatch per sample
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn
+ *      Interpolator function applied to @p dose
+ *  @param org
+ *      Position on the ray, in pixel coordinates
+ *  @param tangent
+ *      Unit tangent vector in pixel coordinates
+ *  @param[out] count
+ *      The number of samples taken
+ *  @param proj
+ *      Projection
+ *  @returns The projected dose
+ */
+static inline __attribute__((always_inline))
+double rc_raycast_reduce(const struct rc_dose *dose,
+                         rc_dose_interpfn_t   *dosefn,
+                         vec_t                 org,
+                         vec_t                 tangent,
+                         unsigned             *count,
+                         enum rc_raycast_proj  proj)
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    double res = 0.0, lo = INFINITY, next;
+    scal_t tau, start, end, exit;
+    vec_t params[6], pos;
+    bool empty;
+    unsigned n = 0;
+
+    *count = 0;
+    if (rc_raycast_intersect(dose, org, tangent, params) < 2) {
+        return 0.0;
+    }
+    params[2] = rc_ceil(rc_max(rc_min(params[0], params[1]), rc_zero()));
+    params[3] = rc_floor(rc_max(params[0], params[1]));
+    tau = start = exit = rc_cvtsf(params[2]);
+    end = rc_cvtsf(params[3]);
+    while (tau < end) {
+        pos = rc_fmadd(rc_set1(tau), tangent, org);
+        if (bricks->dist && tau >= exit) {
+            exit = tau + rc_raycast_brick(bricks, pos, tangent, &empty);
+            if (empty) {
+                tau = rc_fmax(ceil(exit), tau + 1.0f);
+                continue;
+            }
+        }
+        next = dosefn(dose, pos);
+        if (proj == RC_PROJ_MIN) {
+            lo = next > bricks->floor ? rc_fmin(lo, next) : lo;
+        } else {
+            res += next;
+        }
+        tau += 1.0f;
+        n++;
+    }
+    *count = n;
+    switch (proj) {
+    case RC_PROJ_MIN:
+        return isinf(lo) ? 0.0 : lo;
+    case RC_PROJ_MEAN:
+        return end > start ? res / (end - start) : 0.0;
+    case RC_PROJ_INTEGRAL:
+        /* Each step is one unit of tangent long */
+        return res * sqrt(rc_cvtsf(rc_vsqrnorm(rc_mvmul3(dose->mat,
+                                                         tangent))));
+    default:
+        return res;
+    }
+}
+
+
+/** @brief Minimum-intensity projection. This is an rc_raycast_kernel_t. The
+ *      depth is always NaN
+ */
+static double rc_raycast_minip(const struct rc_dose *dose,
+                               rc_dose_interpfn_t   *dosefn,
+                               vec_t                 org,
+                               vec_t                 tangent,
+                               scal_t               *depth,
+                               unsigned             *count)
+{
+    *depth = NAN;
+    return rc_raycast_reduce(dose, dosefn, org, tangent, count, RC_PROJ_MIN);
+}
+
+
+/** @brief Mean-intensity projection. This is an rc_raycast_kernel_t. The
+ *      depth is always NaN
+ */
+static double rc_raycast_meanip(const struct rc_dose *dose,
+                                rc_dose_interpfn_t   *dosefn,
+                                vec_t                 org,
+                                vec_t                 tangent,
+                                scal_t               *depth,
+                                unsigned             *count)
+{
+    *depth = NAN;
+    return rc_raycast_reduce(dose, dosefn, org, tangent, count, RC_PROJ_MEAN);
+}
+
+
+/** @brief Integral projection. This is an rc_raycast_kernel_t. The depth is
+ *      always NaN
+ */
+static double rc_raycast_integral(const struct rc_dose *dose,
+                                  rc_dose_interpfn_t   *dosefn,
+                                  vec_t                 org,
+                                  vec_t                 tangent,
+                                  scal_t               *depth,
+                                  unsigned             *count)
+{
+    *depth = NAN;
+    return rc_raycast_reduce(dose, dosefn, org, tangent, count, RC_PROJ_INTEGRAL);
+}
+
+
+/** State of a ray walking the voxel grid. Voxel (i, j, k) is the cell of
+ *  pixel coordinates within one half of (i, j, k), which is every position
+ *  that rc_dose_nearest maps to it
+ */
+struct rc_dda {
+    int    cell[3];     /* The current voxel */
+    long   n;           /* Its linear index */
+    int    step[3];     /* Voxel displacement along each axis */
+    long   stride[3];   /* Linear index displacement along each axis */
+    scal_t tmax[3];     /* Ray parameters of the next boundary on each axis */
+    scal_t tdelta[3];   /* Ray parameter between boundaries on each axis */
 };
 
 
-/** @brief Compute the basis vectors for the target plane. Only the first two
- *      are returned; the third component is the origin. All outputs are in
- *      scene coordinates
- *  @param[out] basis
- *      Destination buffer
- *  @param camera
- *      Camera containing orientation quaternion
- *  @param target
- *      Target context
+/** @brief Place @p dda at the voxel containing the ray at parameter @p tau
+ *  @param dda
+ *      Traversal state
+ *  @param dose
+ *      Dose volume
+ *  @param org
+ *      Position on the ray, in pixel coordinates shifted by one half so that
+ *      voxels are unit cells with integer corners
+ *  @param tangent
+ *      Tangent vector in pixel coordinates
+ *  @param tau
+ *      Ray parameter
  */
-static void rc_raycast_basis(struct rc_basis        *basis,
-                             const struct rc_target *target,
-                             const struct rc_cam    *camera)
+static void rc_raycast_dda_init(struct rc_dda        *dda,
+                                const struct rc_dose *dose,
+                                vec_t                 org,
+                                vec_t                 tangent,
+                                scal_t                tau)
 {
-    vec_t offs, resx, resy, scalx, scaly, two;
+    RC_ALIGN scal_t p[4], t[4];
+    const long stride[3] = {
+        1,
+        (long)dose->sdim[0] + RC_DOSE_PAD,
+        ((long)dose->sdim[0] + RC_DOSE_PAD) * (dose->sdim[1] + RC_DOSE_PAD)
+    };
+    scal_t dist;
+    int a, hi;
 
-    two = rc_set1(2.0);
-    basis->x = rc_qrot(camera->quat, rc_set(1.0, 0.0, 0.0, 0.0));
-    basis->y = rc_qrot(camera->quat, rc_set(0.0, 1.0, 0.0, 0.0));
-    offs = rc_qrot(camera->quat, rc_set(0.0, 0.0, 1.0, 0.0));
-    resx = rc_permute(target->res, _MM_SHUFFLE(0, 0, 0, 0));
-    resy = rc_permute(target->res, _MM_SHUFFLE(1, 1, 1, 1));
-    scalx = rc_permute(target->size, _MM_SHUFFLE(0, 0, 0, 0));
-    scaly = rc_permute(target->size, _MM_SHUFFLE(1, 1, 1, 1));
-    scalx = rc_div(rc_sub(resx, scalx), two);
-    scaly = rc_div(rc_sub(resy, scaly), two);
-    offs = rc_fmadd(basis->x, scalx, offs);
-    offs = rc_fmadd(basis->y, scaly, offs);
-    basis->org = rc_add(camera->org, offs);
-    basis->x = rc_mul(basis->x, resx);
-    basis->y = rc_mul(basis->y, resy);
+    rc_spill(p, rc_fmadd(rc_set1(tau), tangent, org));
+    rc_spill(t, tangent);
+    for (a = 0; a < 3; a++) {
+        hi = (int)dose->dim[a] - 1;
+        dda->cell[a] = (int)floorf(p[a]);
+        dda->cell[a] = dda->cell[a] < 0 ? 0 : dda->cell[a];
+        dda->cell[a] = dda->cell[a] > hi ? hi : dda->cell[a];
+        dda->step[a] = t[a] < 0.0f ? -1 : 1;
+        dda->stride[a] = dda->step[a] * stride[a];
+        if (t[a] == 0.0f) {
+            dda->tmax[a] = dda->tdelta[a] = INFINITY;
+        } else {
+            dist = t[a] > 0.0f ? dda->cell[a] + 1 - p[a] : p[a] - dda->cell[a];
+            dda->tdelta[a] = 1.0f / fabsf(t[a]);
+            dda->tmax[a] = tau + dist * dda->tdelta[a];
+        }
+    }
+    dda->n = (long)rc_dose_offset(dose,
+                                  dda->cell[0],
+                                  dda->cell[1],
+                                  dda->cell[2]);
 }
 
 
-/** @brief No dose in sight, just rapidly colormap zero to @p target
- *  @param target
- *      Target texture
- *  @param cmap
- *      Colormap
+/** @brief Move @p dda into the next voxel along its ray
+ *  @param dda
+ *      Traversal state
+ *  @param dose
+ *      Dose volume
+ *  @param[out] tau
+ *      The ray parameter at which the new voxel is entered
+ *  @returns false if the ray has left the volume
  */
-static void rc_raycast_empty(struct rc_target *target, struct rc_colormap *cmap)
+static bool rc_raycast_dda_step(struct rc_dda        *dda,
+                                const struct rc_dose *dose,
+                                scal_t               *tau)
 {
-    const unsigned flen = target->tex.dim[0] * target->tex.stride;
-    unsigned char *scan, *pixel;
-    unsigned i;
-    int j, jend = target->tex.dim[1];
+    int a;
 
-#if _OPENMP
-#   pragma omp parallel for private(i, scan, pixel)
-#endif /* _OPENMP */
-    for (j = 0; j < jend; j++) {
-        scan = (unsigned char *)target->tex.pixels + flen;
-        for (i = 0; i < target->tex.dim[0]; i++) {
-            pixel = scan + i * target->tex.stride;
-            cmap->func(cmap, 0.0, pixel);
+    if (dda->tmax[0] <= dda->tmax[1] && dda->tmax[0] <= dda->tmax[2]) {
+        a = 0;
+    } else {
+        a = dda->tmax[1] <= dda->tmax[2] ? 1 : 2;
+    }
+    *tau = dda->tmax[a];
+    dda->cell[a] += dda->step[a];
+    if ((unsigned)dda->cell[a] >= dose->dim[a]) {
+        return false;
+    }
+    dda->n += dda->stride[a];
+    dda->tmax[a] += dda->tdelta[a];
+    return true;
+}
+
+
+/** @brief Read the voxel that @p dda is in
+ *  @param dose
+ *      Dose volume
+ *  @param dda
+ *      Traversal state
+ *  @returns The dose there
+ */
+static double rc_raycast_dda_voxel(const struct rc_dose *dose,
+                                   const struct rc_dda  *dda)
+{
+    size_t n = (size_t)dda->n;
+
+    /* The linear index only steps by a constant stride in linear order */
+    if (dose->layout == RC_DOSE_BRICKED) {
+        n = rc_dose_offset(dose, dda->cell[0], dda->cell[1], dda->cell[2]);
+    }
+    return rc_dose_voxel(dose, n);
+}
+
+
+/** @brief Compute the nearest-neighbor MIP for a ray by visiting every voxel it
+ *      crosses exactly once. This is the exact counterpart of
+ *      rc_raycast_compute with rc_dose_nearest
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn
+ *      Unused; this always reads voxels directly
+ *  @param org
+ *      Position on the ray, in pixel coordinates
+ *  @param tangent
+ *      Unit tangent vector in pixel coordinates
+ *  @param[in,out] depth
+ *      Seed on entry and the parameter halfway through the largest voxel on
+ *      return
+ *  @param[out] count
+ *      The number of voxels read
+ *  @returns The largest voxel crossed by the ray
+ */
+static double rc_raycast_traverse(const struct rc_dose *dose,
+                                  rc_dose_interpfn_t   *dosefn,
+                                  vec_t                 org,
+                                  vec_t                 tangent,
+                                  scal_t               *depth,
+                                  unsigned             *count)
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    const scal_t seed = *depth;
+    struct rc_dda dda;
+    double res = 0.0, px;
+    scal_t tau, end, exit, skip;
+    vec_t params[6], pos, shift;
+    bool empty, prune;
+    unsigned n = 0;
+
+    (void)dosefn;
+    *depth = NAN;
+    *count = 0;
+    shift = rc_add(org, rc_set(0.5, 0.5, 0.5, 0.0));
+    if (rc_raycast_intersect(dose, shift, tangent, params) < 2) {
+        return res;
+    }
+    tau = rc_cvtsf(rc_max(rc_min(params[0], params[1]), rc_zero()));
+    end = rc_cvtsf(rc_max(params[0], params[1]));
+    if (!(tau < end)) {
+        return res;
+    }
+    if (seed >= tau && seed < end) {
+        rc_raycast_dda_init(&dda, dose, shift, tangent, seed);
+        res = rc_raycast_dda_voxel(dose, &dda);
+        *depth = res > 0.0 ? seed : NAN;
+        n++;
+    }
+    exit = tau;
+    rc_raycast_dda_init(&dda, dose, shift, tangent, tau);
+    for (;;) {
+        if (bricks->dist && tau >= exit) {
+            pos = rc_fmadd(rc_set1(tau), tangent, org);
+            exit = rc_raycast_brick(bricks, pos, tangent, &empty);
+            skip = rc_raycast_prune(bricks,
+                                    pos,
+                                    tangent,
+                                    (float)rc_fmax(res, bricks->floor),
+                                    &prune);
+            exit = tau + rc_fmax(exit, skip);
+            if ((empty || prune) && exit > tau) {
+                tau = exit;
+                if (tau >= end) {
+                    break;
+                }
+                rc_raycast_dda_init(&dda, dose, shift, tangent, tau);
+                continue;
+            }
+        }
+        px = rc_raycast_dda_voxel(dose, &dda);
+        if (px > res) {
+            res = px;
+            /* Not the entry, which is on a boundary */
+            *depth = 0.5f * (tau + rc_fminf(rc_fminf(dda.tmax[0],
+                                                     dda.tmax[1]),
+                                            dda.tmax[2]));
+        }
+        n++;
+        if (res >= dose->dmax || !rc_raycast_dda_step(&dda, dose, &tau)) {
+            break;
         }
     }
+    *count = n;
+    return res;
 }
 
 
-void rc_raycast_dose(const struct rc_dose *dose,
-                     struct rc_target     *target,
-                     struct rc_colormap   *cmap,
-                     const struct rc_cam  *camera,
-                     rc_dose_interpfn_t   *dosefn)
+/** @brief Clip the parameter interval of eight rays to one slab of the dose
+ *      box
+ *  @param p
+ *      One component of the starting points
+ *  @param t
+ *      The same component of the tangent vectors
+ *  @param dim
+ *      The box dimension along this axis
+ *  @param[in,out] near
+ *      Entry parameters
+ *  @param[in,out] far
+ *      Exit parameters
+ */
+static void rc_raycast_slab8(__m256  p,
+                             __m256  t,
+                             scal_t  dim,
+                             __m256 *near,
+                             __m256 *far)
+/** The accumulators are always the second operand of min/max, so that NaNs
+ *  from 0/0 (a ray lying in a face plane) leave them untouched
+ */
 {
-    vec_t scanpos, pxpos, tangent;
-    struct rc_basis basis;
-    unsigned i, offs;
-    int j, jend = (int)target->tex.dim[1];
-    double res;
-    char *ptr;
+    __m256 lo, hi;
 
-    if (!dose->data) {
-        rc_raycast_empty(target, cmap);
-        return;
+    lo = _mm256_div_ps(_mm256_sub_ps(_mm256_setzero_ps(), p), t);
+    hi = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(dim), p), t);
+    *near = _mm256_max_ps(_mm256_min_ps(lo, hi), *near);
+    *far = _mm256_min_ps(_mm256_max_ps(lo, hi), *far);
+}
+
+
+/** @brief Compute the entry and exit parameters of eight rays with the dose
+ *      box, using the slab method
+ *  @param dose
+ *      Dose volume to intersect
+ *  @param p
+ *      Starting points in pixel coordinates
+ *  @param t
+ *      Tangent vectors in pixel coordinates
+ *  @param[out] tnear
+ *      Entry parameters
+ *  @param[out] tfar
+ *      Exit parameters. Lanes that miss the box have @p tfar < @p tnear
+ */
+static void rc_raycast_intersect8(const struct rc_dose   *dose,
+                                  const struct rc_packet *p,
+                                  const struct rc_packet *t,
+                                  __m256                 *tnear,
+                                  __m256                 *tfar)
+{
+    *tnear = _mm256_set1_ps(-INFINITY);
+    *tfar = _mm256_set1_ps(INFINITY);
+    rc_raycast_slab8(p->x, t->x, (scal_t)dose->dim[0], tnear, tfar);
+    rc_raycast_slab8(p->y, t->y, (scal_t)dose->dim[1], tnear, tfar);
+    rc_raycast_slab8(p->z, t->z, (scal_t)dose->dim[2], tnear, tfar);
+}
+
+
+/** @brief Find the brick coordinates of eight positions along one axis
+ *  @param p
+ *      One component of the pixel coordinates
+ *  @param dim
+ *      The brick grid dimension along this axis
+ *  @returns The brick coordinates, clamped to the grid
+ */
+static __m256 rc_raycast_block8(__m256 p, unsigned dim)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / RC_BRICK_LEN);
+    __m256 res;
+
+    res = _mm256_floor_ps(_mm256_mul_ps(p, scale));
+    res = _mm256_max_ps(res, _mm256_setzero_ps());
+    return _mm256_min_ps(res, _mm256_set1_ps((float)dim - 1.0f));
+}
+
+
+/** @brief Clip the distance to a box along one axis
+ *  @param p
+ *      One component of the pixel coordinates
+ *  @param t
+ *      The same component of the tangent vectors
+ *  @param rcp
+ *      The reciprocal of the magnitude of @p t
+ *  @param lo
+ *      Lower bound of the box
+ *  @param hi
+ *      Upper bound of the box
+ *  @param[in,out] dt
+ *      Distances to the box boundary
+ */
+static void rc_raycast_box8(__m256  p,
+                            __m256  t,
+                            __m256  rcp,
+                            __m256  lo,
+                            __m256  hi,
+                            __m256 *dt)
+{
+    __m256 res;
+
+    res = _mm256_blendv_ps(_mm256_sub_ps(hi, p), _mm256_sub_ps(p, lo), t);
+    *dt = _mm256_min_ps(_mm256_mul_ps(res, rcp), *dt);
+}
+
+
+/** @brief Clip the distance to a cube of bricks along one axis
+ *  @param p
+ *      One component of the pixel coordinates
+ *  @param t
+ *      The same component of the tangent vectors
+ *  @param rcp
+ *      The reciprocal of the magnitude of @p t
+ *  @param blk
+ *      Brick coordinates of @p p
+ *  @param half
+ *      Half-width of the cube in bricks, not counting the brick at @p blk
+ *  @param[in,out] dt
+ *      Distances to the cube boundary
+ */
+static void rc_raycast_cube8(__m256  p,
+                             __m256  t,
+                             __m256  rcp,
+                             __m256  blk,
+                             __m256  half,
+                             __m256 *dt)
+{
+    const __m256 len = _mm256_set1_ps((float)RC_BRICK_LEN);
+    __m256 lo, hi;
+
+    lo = _mm256_mul_ps(_mm256_sub_ps(blk, half), len);
+    hi = _mm256_add_ps(_mm256_add_ps(blk, half), _mm256_set1_ps(1.0f));
+    hi = _mm256_mul_ps(hi, len);
+    rc_raycast_box8(p, t, rcp, lo, hi, dt);
+}
+
+
+/** @brief Round eight node corners down to a multiple of the node size
+ *  @param lo
+ *      Node corners, in pixel coordinates
+ *  @param len
+ *      Node edge lengths, which must be powers of two
+ *  @returns The corners of the nodes of edge length @p len containing @p lo
+ */
+static __m256 rc_raycast_snap8(__m256 lo, __m256 len)
+{
+    return _mm256_mul_ps(_mm256_floor_ps(_mm256_div_ps(lo, len)), len);
+}
+
+
+/** @brief Packet version of rc_raycast_brick
+ *  @param bricks
+ *      Brick map
+ *  @param pos
+ *      Pixel coordinates of the current samples
+ *  @param tangent
+ *      Tangent vectors in pixel coordinates
+ *  @param rcp
+ *      Reciprocals of the magnitudes of each component of @p tangent
+ *  @param mask
+ *      Lanes to look up
+ *  @param[out] empty
+ *      Mask of the lanes in @p mask that are in empty bricks
+ *  @returns The distance along each ray, in units of @p tangent
+ */
+static __m256 rc_raycast_brick8(const struct rc_bricks *bricks,
+                                const struct rc_packet *pos,
+                                const struct rc_packet *tangent,
+                                const struct rc_packet *rcp,
+                                __m256                  mask,
+                                __m256                 *empty)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 bx, by, bz, idx, dist, half, res;
+    __m256i n;
+
+    bx = rc_raycast_block8(pos->x, bricks->dim[0]);
+    by = rc_raycast_block8(pos->y, bricks->dim[1]);
+    bz = rc_raycast_block8(pos->z, bricks->dim[2]);
+    idx = _mm256_fmadd_ps(bz, _mm256_set1_ps((float)bricks->dim[1]), by);
+    idx = _mm256_fmadd_ps(idx, _mm256_set1_ps((float)bricks->dim[0]), bx);
+    n = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+                                    (const int *)bricks->dist,
+                                    _mm256_cvtps_epi32(idx),
+                                    _mm256_castps_si256(mask),
+                                    1);
+    n = _mm256_and_si256(n, _mm256_set1_epi32(UINT8_MAX));
+    dist = _mm256_cvtepi32_ps(n);
+    *empty = _mm256_and_ps(_mm256_cmp_ps(dist, one, _CMP_GE_OQ), mask);
+    half = _mm256_max_ps(_mm256_sub_ps(dist, one), _mm256_setzero_ps());
+    res = _mm256_set1_ps(INFINITY);
+    rc_raycast_cube8(pos->x, tangent->x, rcp->x, bx, half, &res);
+    rc_raycast_cube8(pos->y, tangent->y, rcp->y, by, half, &res);
+    rc_raycast_cube8(pos->z, tangent->z, rcp->z, bz, half, &res);
+    return res;
+}
+
+
+/** @brief Gather the maxima of the nodes containing eight bricks at one level
+ *      of the max pyramid
+ *  @param max
+ *      Node maxima
+ *  @param dim
+ *      Node grid dimensions
+ *  @param bx
+ *      First brick coordinates
+ *  @param by
+ *      Second brick coordinates
+ *  @param bz
+ *      Third brick coordinates
+ *  @param shift
+ *      Base-two logarithm of the node edge length in bricks
+ *  @param mask
+ *      Lanes to gather
+ *  @returns The node maxima. Lanes not in @p mask are zero
+ */
+static __m256 rc_raycast_nodemax8(const float    *max,
+                                  const unsigned  dim[],
+                                  __m256i         bx,
+                                  __m256i         by,
+                                  __m256i         bz,
+                                  unsigned        shift,
+                                  __m256          mask)
+{
+    const __m128i cnt = _mm_cvtsi32_si128((int)shift);
+    __m256i n;
+
+    n = _mm256_mullo_epi32(_mm256_srl_epi32(bz, cnt),
+                           _mm256_set1_epi32((int)dim[1]));
+    n = _mm256_add_epi32(n, _mm256_srl_epi32(by, cnt));
+    n = _mm256_mullo_epi32(n, _mm256_set1_epi32((int)dim[0]));
+    n = _mm256_add_epi32(n, _mm256_srl_epi32(bx, cnt));
+    return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), max, n, mask, 4);
+}
+
+
+/** @brief Packet version of rc_raycast_prune
+ *  @param bricks
+ *      Brick map
+ *  @param pos
+ *      Pixel coordinates of the current samples
+ *  @param tangent
+ *      Tangent vectors in pixel coordinates
+ *  @param rcp
+ *      Reciprocals of the magnitudes of each component of @p tangent
+ *  @param mask
+ *      Lanes to look up
+ *  @param thresh
+ *      The running maximum of each ray, or the transparent dose
+ *  @param[out] prune
+ *      Mask of the lanes in @p mask whose bricks do not exceed @p thresh
+ *  @returns The distance along each ray in @p prune to the exit of the largest
+ *      node that can be pruned, in units of @p tangent
+ */
+static __m256 rc_raycast_prune8(const struct rc_bricks *bricks,
+                                const struct rc_packet *pos,
+                                const struct rc_packet *tangent,
+                                const struct rc_packet *rcp,
+                                __m256                  mask,
+                                __m256                  thresh,
+                                __m256                 *prune)
+{
+    const __m256 brklen = _mm256_set1_ps((float)RC_BRICK_LEN);
+    struct rc_packet lo, hi;
+    __m256 bx, by, bz, len, max, climb, up, res;
+    __m256i ix, iy, iz;
+    unsigned l;
+
+    bx = rc_raycast_block8(pos->x, bricks->dim[0]);
+    by = rc_raycast_block8(pos->y, bricks->dim[1]);
+    bz = rc_raycast_block8(pos->z, bricks->dim[2]);
+    ix = _mm256_cvtps_epi32(bx);
+    iy = _mm256_cvtps_epi32(by);
+    iz = _mm256_cvtps_epi32(bz);
+    max = rc_raycast_nodemax8(bricks->max, bricks->dim, ix, iy, iz, 0, mask);
+    climb = _mm256_and_ps(_mm256_cmp_ps(max, thresh, _CMP_LE_OQ), mask);
+    *prune = climb;
+    if (_mm256_testz_ps(climb, climb)) {
+        return _mm256_setzero_ps();
     }
-    rc_raycast_basis(&basis, target, camera);
+    lo.x = _mm256_mul_ps(bx, brklen);
+    lo.y = _mm256_mul_ps(by, brklen);
+    lo.z = _mm256_mul_ps(bz, brklen);
+    len = brklen;
+    for (l = 0; l < bricks->nlev && !_mm256_testz_ps(climb, climb); l++) {
+        max = rc_raycast_nodemax8(bricks->lev[l].max,
+                                  bricks->lev[l].dim,
+                                  ix, iy, iz,
+                                  l + 1,
+                                  climb);
+        up = _mm256_and_ps(_mm256_cmp_ps(max, thresh, _CMP_LE_OQ), climb);
+        len = _mm256_blendv_ps(len, _mm256_add_ps(len, len), up);
+        lo.x = _mm256_blendv_ps(lo.x, rc_raycast_snap8(lo.x, len), up);
+        lo.y = _mm256_blendv_ps(lo.y, rc_raycast_snap8(lo.y, len), up);
+        lo.z = _mm256_blendv_ps(lo.z, rc_raycast_snap8(lo.z, len), up);
+        climb = up;
+    }
+    hi.x = _mm256_add_ps(lo.x, len);
+    hi.y = _mm256_add_ps(lo.y, len);
+    hi.z = _mm256_add_ps(lo.z, len);
+    res = _mm256_set1_ps(INFINITY);
+    rc_raycast_box8(pos->x, tangent->x, rcp->x, lo.x, hi.x, &res);
+    rc_raycast_box8(pos->y, tangent->y, rcp->y, lo.y, hi.y, &res);
+    rc_raycast_box8(pos->z, tangent->z, rcp->z, lo.z, hi.z, &res);
+    return _mm256_and_ps(res, *prune);
+}
 
-#if _OPENMP
-#   pragma omp parallel for private(i, ptr, offs, scanpos, pxpos, tangent, res)
-#endif /* _OPENMP */
-    for (j = 0; j < jend; j++) {
-        scanpos = rc_fmadd(basis.y, rc_set1((scal_t)j), basis.org);
-        offs = target->tex.stride * target->tex.dim[0] * j;
-        ptr = (char *)target->tex.pixels + offs;
-        for (i = 0; i < target->tex.dim[0]; i++) {
-            pxpos = rc_fmadd(basis.x, rc_set1((scal_t)i), scanpos);
-            tangent = rc_sub(pxpos, camera->org);
-            res = rc_raycast_compute(dose, dosefn, pxpos, tangent);
-            cmap->func(cmap, res, ptr);
-            ptr += target->tex.stride;
+
+/** @brief Compute the pixel doses for eight rays at once. This is the packet
+ *      version of rc_raycast_compute
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn8
+ *      Packet interpolator applied to @p dose
+ *  @param org
+ *      Positions on each ray, in pixel coordinates
+ *  @param tangent
+ *      Unit tangent vectors in pixel coordinates
+ *  @param[in,out] depth
+ *      Seeds on entry and the parameters of each max on return
+ *  @param[out] count
+ *      The number of samples taken by each ray
+ *  @returns The dose picked out for each ray
+ */
+static __m256 rc_raycast_compute8(const struct rc_dose   *dose,
+                                  rc_dose_interp8fn_t    *dosefn8,
+                                  const struct rc_packet *org,
+                                  const struct rc_packet *tangent,
+                                  __m256                 *depth,
+                                  __m256                 *count)
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 dfloor = _mm256_set1_ps((float)dose->bricks.floor);
+    const __m256 dmax = _mm256_set1_ps((float)dose->dmax);
+    const __m256 nan = _mm256_set1_ps(NAN);
+    __m256 tau, end, exit, active, check, sample, empty, prune, dt, skip;
+    __m256 next, res, seed;
+    struct rc_packet pos, rcp;
+
+    rc_raycast_intersect8(dose, org, tangent, &tau, &end);
+    tau = _mm256_ceil_ps(_mm256_max_ps(tau, _mm256_setzero_ps()));
+    end = _mm256_floor_ps(end);
+    exit = tau;
+    seed = _mm256_round_ps(*depth, _MM_FROUND_TO_NEAREST_INT
+                                 | _MM_FROUND_NO_EXC);
+    sample = _mm256_and_ps(_mm256_cmp_ps(seed, tau, _CMP_GE_OQ),
+                           _mm256_cmp_ps(seed, end, _CMP_LT_OQ));
+    seed = _mm256_and_ps(seed, sample);
+    pos.x = _mm256_fmadd_ps(seed, tangent->x, org->x);
+    pos.y = _mm256_fmadd_ps(seed, tangent->y, org->y);
+    pos.z = _mm256_fmadd_ps(seed, tangent->z, org->z);
+    res = dosefn8(dose, &pos, sample);
+    *count = _mm256_and_ps(sample, one);
+    sample = _mm256_cmp_ps(res, _mm256_setzero_ps(), _CMP_GT_OQ);
+    *depth = _mm256_blendv_ps(nan, seed, sample);
+    rcp.x = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->x));
+    rcp.y = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->y));
+    rcp.z = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->z));
+    active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+    while (!_mm256_testz_ps(active, active)) {
+        pos.x = _mm256_fmadd_ps(tau, tangent->x, org->x);
+        pos.y = _mm256_fmadd_ps(tau, tangent->y, org->y);
+        pos.z = _mm256_fmadd_ps(tau, tangent->z, org->z);
+        sample = active;
+        check = _mm256_and_ps(active, _mm256_cmp_ps(tau, exit, _CMP_GE_OQ));
+        if (bricks->dist && !_mm256_testz_ps(check, check)) {
+            dt = rc_raycast_brick8(bricks, &pos, tangent, &rcp, check, &empty);
+            skip = rc_raycast_prune8(bricks,
+                                     &pos,
+                                     tangent,
+                                     &rcp,
+                                     check,
+                                     _mm256_max_ps(res, dfloor),
+                                     &prune);
+            empty = _mm256_or_ps(empty, prune);
+            dt = _mm256_add_ps(tau, _mm256_max_ps(dt, skip));
+            exit = _mm256_blendv_ps(exit, dt, check);
+            dt = _mm256_max_ps(_mm256_ceil_ps(dt), _mm256_add_ps(tau, one));
+            tau = _mm256_blendv_ps(tau, dt, empty);
+            sample = _mm256_andnot_ps(empty, sample);
         }
+        next = dosefn8(dose, &pos, sample);
+        check = _mm256_cmp_ps(next, res, _CMP_GT_OQ);
+        *depth = _mm256_blendv_ps(*depth, tau, check);
+        res = _mm256_max_ps(next, res);
+        tau = _mm256_add_ps(tau, _mm256_and_ps(sample, one));
+        *count = _mm256_add_ps(*count, _mm256_and_ps(sample, one));
+        active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+        active = _mm256_and_ps(active, _mm256_cmp_ps(res, dmax, _CMP_LT_OQ));
+    }
+    return res;
+}
+
+
+/** @brief Packet version of rc_raycast_adaptive
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn8
+ *      Packet interpolator applied to @p dose
+ *  @param org
+ *      Positions on each ray, in pixel coordinates
+ *  @param tangent
+ *      Tangent vectors in pixel coordinates, each one base step long
+ *  @param[out] depth
+ *      The parameters of each max
+ *  @param[out] count
+ *      The number of samples taken by each ray
+ *  @returns The dose picked out for each ray
+ */
+static __m256 rc_raycast_adaptive8(const struct rc_dose   *dose,
+                                   rc_dose_interp8fn_t    *dosefn8,
+                                   const struct rc_packet *org,
+                                   const struct rc_packet *tangent,
+                                   __m256                 *depth,
+                                   __m256                 *count)
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 dfloor = _mm256_set1_ps((float)bricks->floor);
+    const __m256 dmax = _mm256_set1_ps((float)dose->dmax);
+    const __m256 hi = _mm256_set1_ps((float)(dose->dmax / 64.0));
+    const __m256 lo = _mm256_set1_ps((float)(dose->dmax / 256.0));
+    const __m256 shortest = _mm256_set1_ps(0.25f);
+    const __m256 longest = _mm256_set1_ps(4.0f);
+    __m256 tau, end, exit, active, check, sample, empty, prune, skip, dt, step;
+    __m256 next, prev, diff, res;
+    struct rc_packet pos, rcp;
+
+    rc_raycast_intersect8(dose, org, tangent, &tau, &end);
+    tau = _mm256_max_ps(tau, _mm256_setzero_ps());
+    exit = tau;
+    step = one;
+    res = prev = *count = _mm256_setzero_ps();
+    *depth = _mm256_set1_ps(NAN);
+    rcp.x = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->x));
+    rcp.y = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->y));
+    rcp.z = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->z));
+    active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+    while (!_mm256_testz_ps(active, active)) {
+        pos.x = _mm256_fmadd_ps(tau, tangent->x, org->x);
+        pos.y = _mm256_fmadd_ps(tau, tangent->y, org->y);
+        pos.z = _mm256_fmadd_ps(tau, tangent->z, org->z);
+        sample = active;
+        check = _mm256_and_ps(active, _mm256_cmp_ps(tau, exit, _CMP_GE_OQ));
+        if (bricks->dist && !_mm256_testz_ps(check, check)) {
+            dt = rc_raycast_brick8(bricks, &pos, tangent, &rcp, check, &empty);
+            skip = rc_raycast_prune8(bricks,
+                                     &pos,
+                                     tangent,
+                                     &rcp,
+                                     check,
+                                     _mm256_max_ps(res, dfloor),
+                                     &prune);
+            empty = _mm256_or_ps(empty, prune);
+            dt = _mm256_add_ps(tau, _mm256_max_ps(dt, skip));
+            exit = _mm256_blendv_ps(exit, dt, check);
+            dt = _mm256_max_ps(dt, _mm256_add_ps(tau, step));
+            tau = _mm256_blendv_ps(tau, dt, empty);
+            prev = _mm256_andnot_ps(empty, prev);
+            sample = _mm256_andnot_ps(empty, sample);
+        }
+        next = dosefn8(dose, &pos, sample);
+        check = _mm256_cmp_ps(next, res, _CMP_GT_OQ);
+        *depth = _mm256_blendv_ps(*depth, tau, check);
+        res = _mm256_max_ps(next, res);
+        diff = _mm256_andnot_ps(sign, _mm256_sub_ps(next, prev));
+        check = _mm256_and_ps(sample, _mm256_cmp_ps(diff, hi, _CMP_GT_OQ));
+        dt = _mm256_max_ps(_mm256_mul_ps(step, _mm256_set1_ps(0.5f)), shortest);
+        step = _mm256_blendv_ps(step, dt, check);
+        check = _mm256_and_ps(sample, _mm256_cmp_ps(diff, lo, _CMP_LT_OQ));
+        dt = _mm256_min_ps(_mm256_add_ps(step, step), longest);
+        step = _mm256_blendv_ps(step, dt, check);
+        prev = _mm256_blendv_ps(prev, next, sample);
+        tau = _mm256_add_ps(tau, _mm256_and_ps(sample, step));
+        *count = _mm256_add_ps(*count, _mm256_and_ps(sample, one));
+        active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+        active = _mm256_and_ps(active, _mm256_cmp_ps(res, dmax, _CMP_LT_OQ));
+    }
+    return res;
+}
+
+
+/** @brief Find the ambient length of unit steps along eight rays
+ *  @param dose
+ *      Dose volume
+ *  @param tangent
+ *      Tangent vectors in pixel coordinates
+ *  @returns The length of each tangent in ambient units
+ */
+static __m256 rc_raycast_length8(const struct rc_dose   *dose,
+                                 const struct rc_packet *tangent)
+{
+    RC_ALIGN scal_t col[3][4];
+    __m256 res, comp;
+    unsigned i;
+
+    rc_spill(col[0], dose->mat[0]);
+    rc_spill(col[1], dose->mat[1]);
+    rc_spill(col[2], dose->mat[2]);
+    res = _mm256_setzero_ps();
+    for (i = 0; i < 3; i++) {
+        comp = _mm256_mul_ps(tangent->x, _mm256_set1_ps(col[0][i]));
+        comp = _mm256_fmadd_ps(tangent->y, _mm256_set1_ps(col[1][i]), comp);
+        comp = _mm256_fmadd_ps(tangent->z, _mm256_set1_ps(col[2][i]), comp);
+        res = _mm256_fmadd_ps(comp, comp, res);
+    }
+    return _mm256_sqrt_ps(res);
+}
+
+
+/** @brief Packet version of rc_raycast_reduce
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn8
+ *      Packet interpolator applied to @p dose
+ *  @param org
+ *      Positions on each ray, in pixel coordinates
+ *  @param tangent
+ *      Unit tangent vectors in pixel coordinates
+ *  @param[out] count
+ *      The number of samples taken by each ray
+ *  @param proj
+ *      Projection
+ *  @returns The projected dose of each ray
+ */
+static inline __attribute__((always_inline))
+__m256 rc_raycast_reduce8(const struct rc_dose   *dose,
+                          rc_dose_interp8fn_t    *dosefn8,
+                          const struct rc_packet *org,
+                          const struct rc_packet *tangent,
+                          __m256                 *count,
+                          enum rc_raycast_proj    proj)
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 dfloor = _mm256_set1_ps((float)bricks->floor);
+    const __m256 inf = _mm256_set1_ps(INFINITY);
+    __m256 tau, start, end, exit, active, check, sample, empty, dt, next, res;
+    struct rc_packet pos, rcp;
+
+    rc_raycast_intersect8(dose, org, tangent, &tau, &end);
+    tau = _mm256_ceil_ps(_mm256_max_ps(tau, _mm256_setzero_ps()));
+    end = _mm256_floor_ps(end);
+    start = exit = tau;
+    res = proj == RC_PROJ_MIN ? inf : _mm256_setzero_ps();
+    *count = _mm256_setzero_ps();
+    rcp.x = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->x));
+    rcp.y = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->y));
+    rcp.z = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->z));
+    active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+    while (!_mm256_testz_ps(active, active)) {
+        pos.x = _mm256_fmadd_ps(tau, tangent->x, org->x);
+        pos.y = _mm256_fmadd_ps(tau, tangent->y, org->y);
+        pos.z = _mm256_fmadd_ps(tau, tangent->z, org->z);
+        sample = active;
+        check = _mm256_and_ps(active, _mm256_cmp_ps(tau, exit, _CMP_GE_OQ));
+        if (bricks->dist && !_mm256_testz_ps(check, check)) {
+            dt = rc_raycast_brick8(bricks, &pos, tangent, &rcp, check, &empty);
+            dt = _mm256_add_ps(tau, dt);
+            exit = _mm256_blendv_ps(exit, dt, check);
+            dt = _mm256_max_ps(_mm256_ceil_ps(dt), _mm256_add_ps(tau, one));
+            tau = _mm256_blendv_ps(tau, dt, empty);
+            sample = _mm256_andnot_ps(empty, sample);
+        }
+        next = dosefn8(dose, &pos, sample);
+        if (proj == RC_PROJ_MIN) {
+            check = _mm256_and_ps(sample,
+                                  _mm256_cmp_ps(next, dfloor, _CMP_GT_OQ));
+            res = _mm256_blendv_ps(res, _mm256_min_ps(next, res), check);
+        } else {
+            res = _mm256_add_ps(res, _mm256_and_ps(next, sample));
+        }
+        tau = _mm256_add_ps(tau, _mm256_and_ps(sample, one));
+        *count = _mm256_add_ps(*count, _mm256_and_ps(sample, one));
+        active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+    }
+    switch (proj) {
+    case RC_PROJ_MIN:
+        return _mm256_and_ps(res, _mm256_cmp_ps(res, inf, _CMP_LT_OQ));
+    case RC_PROJ_MEAN:
+        /* Misses have no steps, and their NaN quotients are masked off */
+        dt = _mm256_sub_ps(end, start);
+        check = _mm256_cmp_ps(dt, _mm256_setzero_ps(), _CMP_GT_OQ);
+        return _mm256_and_ps(_mm256_div_ps(res, dt), check);
+    case RC_PROJ_INTEGRAL:
+        return _mm256_mul_ps(res, rc_raycast_length8(dose, tangent));
+    default:
+        return res;
+    }
+}
+
+
+/** @brief Packet version of rc_raycast_minip */
+static __m256 rc_raycast_minip8(const struct rc_dose   *dose,
+                                rc_dose_interp8fn_t    *dosefn8,
+                                const struct rc_packet *org,
+                                const struct rc_packet *tangent,
+                                __m256                 *depth,
+                                __m256                 *count)
+{
+    *depth = _mm256_set1_ps(NAN);
+    return rc_raycast_reduce8(dose, dosefn8, org, tangent, count, RC_PROJ_MIN);
+}
+
+
+/** @brief Packet version of rc_raycast_meanip */
+static __m256 rc_raycast_meanip8(const struct rc_dose   *dose,
+                                 rc_dose_interp8fn_t    *dosefn8,
+                                 const struct rc_packet *org,
+                                 const struct rc_packet *tangent,
+                                 __m256                 *depth,
+                                 __m256                 *count)
+{
+    *depth = _mm256_set1_ps(NAN);
+    return rc_raycast_reduce8(dose, dosefn8, org, tangent, count, RC_PROJ_MEAN);
+}
+
+
+/** @brief Packet version of rc_raycast_integral */
+static __m256 rc_raycast_integral8(const struct rc_dose   *dose,
+                                   rc_dose_interp8fn_t    *dosefn8,
+                                   const struct rc_packet *org,
+                                   const struct rc_packet *tangent,
+                                   __m256                 *depth,
+                                   __m256                 *count)
+{
+    *depth = _mm256_set1_ps(NAN);
+    return rc_raycast_reduce8(dose, dosefn8, org, tangent, count, RC_PROJ_INTEGRAL);
+}
+
+
+/** Packet version of struct rc_dda */
+struct rc_dda8 {
+    __m256i cell[3];    /* The current voxels */
+    __m256i n;          /* Their linear indices */
+    __m256i step[3];    /* Voxel displacements along each axis */
+    __m256i stride[3];  /* Linear index displacements along each axis */
+    __m256  tmax[3];    /* Ray parameters of the next boundaries on each axis */
+};
+
+
+/** @brief Packet version of rc_raycast_dda_init
+ *  @param dda
+ *      Traversal state
+ *  @param dose
+ *      Dose volume
+ *  @param org
+ *      Positions on each ray, in pixel coordinates shifted by one half
+ *  @param tangent
+ *      Tangent vectors in pixel coordinates
+ *  @param rcp
+ *      Reciprocals of the magnitudes of each component of @p tangent, which
+ *      are the ray parameters between voxel boundaries along each axis
+ *  @param tau
+ *      Ray parameters
+ *  @param mask
+ *      Lanes to place. The rest are left alone
+ */
+static void rc_raycast_dda8_init(struct rc_dda8         *dda,
+                                 const struct rc_dose   *dose,
+                                 const struct rc_packet *org,
+                                 const struct rc_packet *tangent,
+                                 const struct rc_packet *rcp,
+                                 __m256                  tau,
+                                 __m256                  mask)
+{
+    const __m256 p[3] = { org->x, org->y, org->z };
+    const __m256 t[3] = { tangent->x, tangent->y, tangent->z };
+    const __m256 r[3] = { rcp->x, rcp->y, rcp->z };
+    const int stride[3] = {
+        1,
+        (int)dose->sdim[0] + RC_DOSE_PAD,
+        ((int)dose->sdim[0] + RC_DOSE_PAD) * ((int)dose->sdim[1] + RC_DOSE_PAD)
+    };
+    const __m256i imask = _mm256_castps_si256(mask);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    __m256 pos, neg, cf, up, down, tm;
+    __m256i c, s, n, cell[3];
+    int a;
+
+    for (a = 0; a < 3; a++) {
+        pos = _mm256_fmadd_ps(tau, t[a], p[a]);
+        c = _mm256_cvttps_epi32(_mm256_floor_ps(pos));
+        c = _mm256_max_epi32(c, _mm256_setzero_si256());
+        c = _mm256_min_epi32(c, _mm256_set1_epi32((int)dose->dim[a] - 1));
+        cell[a] = c;
+        neg = _mm256_cmp_ps(t[a], zero, _CMP_LT_OQ);
+        cf = _mm256_cvtepi32_ps(c);
+        up = _mm256_sub_ps(_mm256_add_ps(cf, one), pos);
+        down = _mm256_sub_ps(pos, cf);
+        tm = _mm256_fmadd_ps(_mm256_blendv_ps(up, down, neg), r[a], tau);
+        tm = _mm256_blendv_ps(tm,
+                              _mm256_set1_ps(INFINITY),
+                              _mm256_cmp_ps(t[a], zero, _CMP_EQ_OQ));
+        s = _mm256_blendv_epi8(_mm256_set1_epi32(1),
+                               _mm256_set1_epi32(-1),
+                               _mm256_castps_si256(neg));
+        dda->cell[a] = _mm256_blendv_epi8(dda->cell[a], c, imask);
+        dda->step[a] = _mm256_blendv_epi8(dda->step[a], s, imask);
+        s = _mm256_mullo_epi32(s, _mm256_set1_epi32(stride[a]));
+        dda->stride[a] = _mm256_blendv_epi8(dda->stride[a], s, imask);
+        dda->tmax[a] = _mm256_blendv_ps(dda->tmax[a], tm, mask);
+    }
+    n = rc_dose_offset8(dose, cell[0], cell[1], cell[2]);
+    dda->n = _mm256_blendv_epi8(dda->n, n, imask);
+}
+
+
+/** @brief Packet version of rc_raycast_dda_step
+ *  @param dda
+ *      Traversal state
+ *  @param dose
+ *      Dose volume
+ *  @param rcp
+ *      Ray parameters between voxel boundaries along each axis
+ *  @param mask
+ *      Lanes to step
+ *  @param[in,out] tau
+ *      The ray parameters at which the new voxels are entered, in @p mask
+ *  @returns A mask of the lanes in @p mask that have left the volume
+ */
+static __m256 rc_raycast_dda8_step(struct rc_dda8         *dda,
+                                   const struct rc_dose   *dose,
+                                   const struct rc_packet *rcp,
+                                   __m256                  mask,
+                                   __m256                 *tau)
+{
+    const __m256 r[3] = { rcp->x, rcp->y, rcp->z };
+    const __m256 *tm = dda->tmax;
+    __m256 sel[3], tmin;
+    __m256i out = _mm256_setzero_si256(), isel, lo, hi;
+    int a;
+
+    sel[0] = _mm256_and_ps(_mm256_cmp_ps(tm[0], tm[1], _CMP_LE_OQ),
+                           _mm256_cmp_ps(tm[0], tm[2], _CMP_LE_OQ));
+    sel[1] = _mm256_andnot_ps(sel[0], _mm256_cmp_ps(tm[1], tm[2], _CMP_LE_OQ));
+    sel[2] = _mm256_andnot_ps(_mm256_or_ps(sel[0], sel[1]), mask);
+    sel[0] = _mm256_and_ps(sel[0], mask);
+    sel[1] = _mm256_and_ps(sel[1], mask);
+    tmin = _mm256_min_ps(_mm256_min_ps(tm[0], tm[1]), tm[2]);
+    *tau = _mm256_blendv_ps(*tau, tmin, mask);
+    for (a = 0; a < 3; a++) {
+        isel = _mm256_castps_si256(sel[a]);
+        dda->cell[a] = _mm256_add_epi32(dda->cell[a],
+                                        _mm256_and_si256(dda->step[a], isel));
+        dda->n = _mm256_add_epi32(dda->n,
+                                  _mm256_and_si256(dda->stride[a], isel));
+        dda->tmax[a] = _mm256_add_ps(dda->tmax[a], _mm256_and_ps(r[a], sel[a]));
+        lo = _mm256_cmpgt_epi32(_mm256_setzero_si256(), dda->cell[a]);
+        hi = _mm256_cmpgt_epi32(dda->cell[a],
+                                _mm256_set1_epi32((int)dose->dim[a] - 1));
+        out = _mm256_or_si256(out, _mm256_or_si256(lo, hi));
+    }
+    return _mm256_and_ps(_mm256_castsi256_ps(out), mask);
+}
+
+
+/** @brief Read the voxels at the current positions of @p dda
+ *  @param dose
+ *      Dose volume
+ *  @param dda
+ *      Traversal state
+ *  @param mask
+ *      Lanes to read. The rest are zero
+ *  @returns The voxels, in single precision
+ */
+static __m256 rc_raycast_dda8_load(const struct rc_dose *dose,
+                                   const struct rc_dda8 *dda,
+                                   __m256                mask)
+{
+    __m256i n = dda->n;
+
+    if (dose->layout == RC_DOSE_BRICKED) {
+        n = rc_dose_offset8(dose, dda->cell[0], dda->cell[1], dda->cell[2]);
+    }
+    return rc_dose_gather8(dose, n, mask);
+}
+
+
+/** @brief Packet version of rc_raycast_traverse
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn8
+ *      Unused; this always reads voxels directly
+ *  @param org
+ *      Positions on each ray, in pixel coordinates
+ *  @param tangent
+ *      Unit tangent vectors in pixel coordinates
+ *  @param[in,out] depth
+ *      Seeds on entry and the parameters halfway through the largest voxel of
+ *      each ray on return
+ *  @param[out] count
+ *      The number of voxels read by each ray
+ *  @returns The largest voxel crossed by each ray
+ */
+static __m256 rc_raycast_traverse8(const struct rc_dose   *dose,
+                                   rc_dose_interp8fn_t    *dosefn8,
+                                   const struct rc_packet *org,
+                                   const struct rc_packet *tangent,
+                                   __m256                 *depth,
+                                   __m256                 *count)
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    const __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 dfloor = _mm256_set1_ps((float)dose->bricks.floor);
+    const __m256 dmax = _mm256_set1_ps((float)dose->dmax);
+    const __m256 nan = _mm256_set1_ps(NAN);
+    __m256 tau, end, exit, active, check, sample, empty, prune, leap, done;
+    __m256 dt, skip, res, next;
+    struct rc_packet shift, pos, rcp;
+    struct rc_dda8 dda;
+
+    (void)dosefn8;
+    shift.x = _mm256_add_ps(org->x, half);
+    shift.y = _mm256_add_ps(org->y, half);
+    shift.z = _mm256_add_ps(org->z, half);
+    rc_raycast_intersect8(dose, &shift, tangent, &tau, &end);
+    tau = _mm256_max_ps(tau, _mm256_setzero_ps());
+    exit = tau;
+    rcp.x = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->x));
+    rcp.y = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->y));
+    rcp.z = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->z));
+    memset(&dda, 0, sizeof dda);
+    sample = _mm256_and_ps(_mm256_cmp_ps(*depth, tau, _CMP_GE_OQ),
+                           _mm256_cmp_ps(*depth, end, _CMP_LT_OQ));
+    rc_raycast_dda8_init(&dda, dose, &shift, tangent, &rcp, *depth, sample);
+    res = rc_raycast_dda8_load(dose, &dda, sample);
+    *count = _mm256_and_ps(sample, one);
+    sample = _mm256_cmp_ps(res, _mm256_setzero_ps(), _CMP_GT_OQ);
+    *depth = _mm256_blendv_ps(nan, *depth, sample);
+    active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+    rc_raycast_dda8_init(&dda, dose, &shift, tangent, &rcp, tau, active);
+    while (!_mm256_testz_ps(active, active)) {
+        sample = active;
+        check = _mm256_and_ps(active, _mm256_cmp_ps(tau, exit, _CMP_GE_OQ));
+        if (bricks->dist && !_mm256_testz_ps(check, check)) {
+            pos.x = _mm256_fmadd_ps(tau, tangent->x, org->x);
+            pos.y = _mm256_fmadd_ps(tau, tangent->y, org->y);
+            pos.z = _mm256_fmadd_ps(tau, tangent->z, org->z);
+            dt = rc_raycast_brick8(bricks, &pos, tangent, &rcp, check, &empty);
+            skip = rc_raycast_prune8(bricks,
+                                     &pos,
+                                     tangent,
+                                     &rcp,
+                                     check,
+                                     _mm256_max_ps(res, dfloor),
+                                     &prune);
+            dt = _mm256_add_ps(tau, _mm256_max_ps(dt, skip));
+            exit = _mm256_blendv_ps(exit, dt, check);
+            leap = _mm256_and_ps(_mm256_or_ps(empty, prune),
+                                 _mm256_cmp_ps(dt, tau, _CMP_GT_OQ));
+            tau = _mm256_blendv_ps(tau, exit, leap);
+            done = _mm256_and_ps(leap, _mm256_cmp_ps(tau, end, _CMP_GE_OQ));
+            active = _mm256_andnot_ps(done, active);
+            leap = _mm256_and_ps(leap, active);
+            rc_raycast_dda8_init(&dda, dose, &shift, tangent, &rcp, tau, leap);
+            sample = _mm256_andnot_ps(leap, active);
+        }
+        next = rc_raycast_dda8_load(dose, &dda, sample);
+        check = _mm256_cmp_ps(next, res, _CMP_GT_OQ);
+        dt = _mm256_min_ps(_mm256_min_ps(dda.tmax[0], dda.tmax[1]),
+                           dda.tmax[2]);
+        dt = _mm256_mul_ps(_mm256_add_ps(tau, dt), half);
+        *depth = _mm256_blendv_ps(*depth, dt, check);
+        res = _mm256_max_ps(next, res);
+        *count = _mm256_add_ps(*count, _mm256_and_ps(sample, one));
+        done = rc_raycast_dda8_step(&dda, dose, &rcp, sample, &tau);
+        active = _mm256_andnot_ps(done, active);
+        active = _mm256_and_ps(active, _mm256_cmp_ps(res, dmax, _CMP_LT_OQ));
+    }
+    return res;
+}
+
+
+/** @brief Composite a ray front to back through transfer function @p tf
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn
+ *      Interpolator function applied to @p dose
+ *  @param tf
+ *      Transfer function
+ *  @param org
+ *      Position on the ray, in pixel coordinates
+ *  @param tangent
+ *      Unit tangent vector in pixel coordinates
+ *  @param[out] rgba
+ *      The composited colour, premultiplied by the opacity that follows it
+ */
+static void rc_raycast_composite(const struct rc_dose     *dose,
+                                 rc_dose_interpfn_t       *dosefn,
+                                 const struct rc_transfer *tf,
+                                 vec_t                     org,
+                                 vec_t                     tangent,
+                                 float                     rgba[])
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    const float thresh = rc_fmaxf(tf->lo, (float)bricks->floor);
+    const float *lut;
+    float trans;
+    scal_t tau, end, exit, skip;
+    vec_t params[6], pos;
+    bool empty, prune;
+    unsigned idx;
+
+    rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0.0f;
+    if (rc_raycast_intersect(dose, org, tangent, params) < 2) {
+        return;
+    }
+    params[2] = rc_ceil(rc_max(rc_min(params[0], params[1]), rc_zero()));
+    params[3] = rc_floor(rc_max(params[0], params[1]));
+    tau = exit = rc_cvtsf(params[2]);
+    end = rc_cvtsf(params[3]);
+    while (tau < end && rgba[3] < tf->cutoff) {
+        pos = rc_fmadd(rc_set1(tau), tangent, org);
+        if (bricks->dist && tau >= exit) {
+            exit = rc_raycast_brick(bricks, pos, tangent, &empty);
+            skip = rc_raycast_prune(bricks, pos, tangent, thresh, &prune);
+            exit = tau + rc_fmax(exit, skip);
+            if (empty || prune) {
+                tau = rc_fmax(ceil(exit), tau + 1.0f);
+                continue;
+            }
+        }
+        idx = (unsigned)rc_fclampf((float)dosefn(dose, pos) * tf->scale + 0.5f,
+                                   0.0f,
+                                   (float)(tf->len - 1));
+        lut = tf->lut + idx;
+        trans = 1.0f - rgba[3];
+        rgba[0] += trans * lut[0 * tf->len];
+        rgba[1] += trans * lut[1 * tf->len];
+        rgba[2] += trans * lut[2 * tf->len];
+        rgba[3] += trans * lut[3 * tf->len];
+        tau += 1.0f;
+    }
+}
+
+
+/** @brief Packet version of rc_raycast_composite
+ *  @param dose
+ *      Dose to raycast
+ *  @param dosefn8
+ *      Packet interpolator applied to @p dose
+ *  @param tf
+ *      Transfer function
+ *  @param org
+ *      Positions on each ray, in pixel coordinates
+ *  @param tangent
+ *      Unit tangent vectors in pixel coordinates
+ *  @param[out] rgba
+ *      The composited red, green, blue and opacity of each ray
+ */
+static void rc_raycast_composite8(const struct rc_dose     *dose,
+                                  rc_dose_interp8fn_t      *dosefn8,
+                                  const struct rc_transfer *tf,
+                                  const struct rc_packet   *org,
+                                  const struct rc_packet   *tangent,
+                                  __m256                    rgba[])
+{
+    const struct rc_bricks *bricks = &dose->bricks;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 thresh = _mm256_set1_ps(rc_fmaxf(tf->lo,
+                                                  (float)bricks->floor));
+    const __m256 cutoff = _mm256_set1_ps(tf->cutoff);
+    const __m256 scale = _mm256_set1_ps(tf->scale);
+    const __m256 top = _mm256_set1_ps((float)(tf->len - 1));
+    __m256 tau, end, exit, active, check, sample, empty, prune, dt, skip;
+    __m256 trans, val;
+    struct rc_packet pos, rcp;
+    __m256i idx;
+    unsigned c;
+
+    rgba[0] = rgba[1] = rgba[2] = rgba[3] = _mm256_setzero_ps();
+    rc_raycast_intersect8(dose, org, tangent, &tau, &end);
+    tau = _mm256_ceil_ps(_mm256_max_ps(tau, _mm256_setzero_ps()));
+    end = _mm256_floor_ps(end);
+    exit = tau;
+    rcp.x = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->x));
+    rcp.y = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->y));
+    rcp.z = _mm256_div_ps(one, _mm256_andnot_ps(sign, tangent->z));
+    active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+    while (!_mm256_testz_ps(active, active)) {
+        pos.x = _mm256_fmadd_ps(tau, tangent->x, org->x);
+        pos.y = _mm256_fmadd_ps(tau, tangent->y, org->y);
+        pos.z = _mm256_fmadd_ps(tau, tangent->z, org->z);
+        sample = active;
+        check = _mm256_and_ps(active, _mm256_cmp_ps(tau, exit, _CMP_GE_OQ));
+        if (bricks->dist && !_mm256_testz_ps(check, check)) {
+            dt = rc_raycast_brick8(bricks, &pos, tangent, &rcp, check, &empty);
+            skip = rc_raycast_prune8(bricks,
+                                     &pos,
+                                     tangent,
+                                     &rcp,
+                                     check,
+                                     thresh,
+                                     &prune);
+            empty = _mm256_or_ps(empty, prune);
+            dt = _mm256_add_ps(tau, _mm256_max_ps(dt, skip));
+            exit = _mm256_blendv_ps(exit, dt, check);
+            dt = _mm256_max_ps(_mm256_ceil_ps(dt), _mm256_add_ps(tau, one));
+            tau = _mm256_blendv_ps(tau, dt, empty);
+            sample = _mm256_andnot_ps(empty, sample);
+        }
+        /* NaNs from masked lanes are sent to the first entry by the max */
+        val = dosefn8(dose, &pos, sample);
+        val = _mm256_max_ps(_mm256_fmadd_ps(val, scale, _mm256_set1_ps(0.5f)),
+                            _mm256_setzero_ps());
+        idx = _mm256_cvttps_epi32(_mm256_min_ps(val, top));
+        trans = _mm256_and_ps(_mm256_sub_ps(one, rgba[3]), sample);
+        for (c = 0; c < 4; c++) {
+            val = _mm256_i32gather_ps(tf->lut + c * tf->len, idx, 4);
+            rgba[c] = _mm256_fmadd_ps(trans, val, rgba[c]);
+        }
+        tau = _mm256_add_ps(tau, _mm256_and_ps(sample, one));
+        active = _mm256_cmp_ps(tau, end, _CMP_LT_OQ);
+        active = _mm256_and_ps(active,
+                               _mm256_cmp_ps(rgba[3], cutoff, _CMP_LT_OQ));
+    }
+}
+
+
+/** @brief Write a composited colour as four bytes, in the same order as
+ *      dose_cmap
+ *  @param rgba
+ *      Red, green, blue and opacity, each in [0, 1]
+ *  @param pixel
+ *      Destination
+ */
+static void rc_raycast_rgba(const float rgba[], void *pixel)
+{
+    unsigned char *px = pixel;
+    unsigned c;
+
+    for (c = 0; c < 4; c++) {
+        px[c] = (unsigned char)(255.0f * rc_fclampf(rgba[c], 0.0f, 1.0f)
+                              + 0.5f);
+    }
+}
+
+
+/** @brief Get the counterpart of scalar interpolator @p dosefn that skips the
+ *      bounds checks. Every kernel only samples between the intersections of
+ *      its ray with the volume, which the zero border of the dose covers
+ *  @param dosefn
+ *      Interpolator
+ *  @returns The unchecked interpolator, or @p dosefn itself if it has none
+ */
+static rc_dose_interpfn_t *rc_raycast_clipfn(rc_dose_interpfn_t *dosefn)
+{
+    if (dosefn == rc_dose_nearest) {
+        return rc_dose_nearest_unchecked;
+    } else if (dosefn == rc_dose_linear) {
+        return rc_dose_linear_unchecked;
+    }
+    return dosefn;
+}
+
+
+/** @brief Get the packet counterpart of scalar interpolator @p dosefn
+ *  @param dosefn
+ *      Interpolator
+ *  @returns The unchecked packet interpolator, or NULL if @p dosefn has none,
+ *      in which case rays must be marched one at a time
+ */
+static rc_dose_interp8fn_t *rc_raycast_packetfn(rc_dose_interpfn_t *dosefn)
+{
+    if (dosefn == rc_dose_nearest) {
+        return rc_dose_nearest8_unchecked;
+    } else if (dosefn == rc_dose_linear) {
+        return rc_dose_linear8_unchecked;
+    }
+    return NULL;
+}
+
+
+void rc_raycast_basis(struct rc_basis        *basis,
+                      const struct rc_target *target,
+                      const struct rc_cam    *camera)
+{
+    vec_t offs, resx, resy, scalx, scaly, two;
+
+    two = rc_set1(2.0);
+    basis->x = rc_qrot(camera->quat, rc_set(1.0, 0.0, 0.0, 0.0));
+    basis->y = rc_qrot(camera->quat, rc_set(0.0, 1.0, 0.0, 0.0));
+    offs = rc_qrot(camera->quat, rc_set(0.0, 0.0, 1.0, 0.0));
+    resx = rc_permute(target->res, _MM_SHUFFLE(0, 0, 0, 0));
+    resy = rc_permute(target->res, _MM_SHUFFLE(1, 1, 1, 1));
+    scalx = rc_permute(target->size, _MM_SHUFFLE(0, 0, 0, 0));
+    scaly = rc_permute(target->size, _MM_SHUFFLE(1, 1, 1, 1));
+    scalx = rc_div(rc_sub(resx, scalx), two);
+    scaly = rc_div(rc_sub(resy, scaly), two);
+    offs = rc_fmadd(basis->x, scalx, offs);
+    offs = rc_fmadd(basis->y, scaly, offs);
+    basis->org = rc_add(camera->org, offs);
+    basis->x = rc_mul(basis->x, resx);
+    basis->y = rc_mul(basis->y, resy);
+}
+
+
+/** Everything that stays fixed while a frame is raycast */
+struct rc_raycast_ctx {
+    const struct rc_dose *dose;     /* Dose volume */
+    struct rc_target     *target;   /* Render target */
+    struct rc_colormap   *cmap;     /* Colormap */
+    const struct rc_cmap_lut *lut;  /* The colormap as a table, if it is one
+                                    and pixels are four bytes wide */
+    bool                  floats;   /* Pixels are the doses themselves */
+    struct rc_basis       basis;    /* Image plane basis */
+    vec_t                 vstep;    /* Horizontal pixel step, in pixel
+                                    coordinates */
+    vec_t                 vorg;     /* Camera position, in pixel coordinates */
+    bool                  ortho;    /* Every ray has the same tangent */
+    vec_t                 vdir;     /* That tangent, in pixel coordinates */
+    scal_t                step;     /* Ambient distance between samples, or
+                                    zero for unit steps in pixel coordinates */
+    unsigned              clip[4];  /* Rays can only hit the dose from pixel
+                                    (clip[0], clip[1]) up to but excluding
+                                    (clip[2], clip[3]) */
+    unsigned char         bg[16];   /* The pixel of a ray that misses */
+    rc_raycast_kernel_t  *kernel;   /* Scalar ray function */
+    rc_raycast_kernel8_t *kernel8;  /* Packet ray function */
+    rc_dose_interpfn_t   *dosefn;   /* Scalar interpolator */
+    rc_dose_interp8fn_t  *dosefn8;  /* Packet interpolator, if there is one */
+    unsigned              block;    /* Pixels per ray along each axis */
+    bool                  refine;   /* Skip the rays of the previous pass */
+    struct rc_reproj     *reproj;   /* Per-pixel seeds and results, if kept */
+    const struct rc_gbuf *gbuf;     /* Auxiliary planes, if written */
+    const struct rc_transfer *transfer; /* Transfer function, if compositing */
+};
+
+
+/** @brief Find how far to scale a unit tangent so that it is one step long
+ *  @param ctx
+ *      Frame context
+ *  @param tangent
+ *      Unit tangent vector in pixel coordinates
+ *  @returns The scale, which is one if there is no physical step
+ */
+static scal_t rc_raycast_stepscale(const struct rc_raycast_ctx *ctx,
+                                   vec_t                        tangent)
+{
+    scal_t len;
+
+    if (!(ctx->step > 0.0f)) {
+        return 1.0f;
+    }
+    len = rc_cvtsf(rc_vsqrnorm(rc_mvmul3(ctx->dose->mat, tangent)));
+    return ctx->step / sqrtf(len);
+}
+
+
+/** @brief Packet version of rc_raycast_stepscale
+ *  @param ctx
+ *      Frame context
+ *  @param tangent
+ *      Unit tangent vectors in pixel coordinates
+ *  @returns The scale of each lane
+ */
+static __m256 rc_raycast_stepscale8(const struct rc_raycast_ctx *ctx,
+                                    const struct rc_packet      *tangent)
+{
+    if (!(ctx->step > 0.0f)) {
+        return _mm256_set1_ps(1.0f);
+    }
+    return _mm256_div_ps(_mm256_set1_ps(ctx->step),
+                         rc_raycast_length8(ctx->dose, tangent));
+}
+
+
+/** @brief Find the voxel nearest to a position
+ *  @param dose
+ *      Dose volume
+ *  @param pos
+ *      Pixel coordinates
+ *  @returns The linear index of the voxel, or -1 if @p pos is out of bounds
+ */
+static int32_t rc_raycast_voxel(const struct rc_dose *dose, const scal_t pos[])
+{
+    long c[3];
+    unsigned a;
+
+    for (a = 0; a < 3; a++) {
+        c[a] = lrintf(pos[a]);
+        if (c[a] < 0 || c[a] >= (long)dose->dim[a]) {
+            return -1;
+        }
+    }
+    return (int32_t)(c[0] + dose->dim[0] * (c[1] + (long)dose->dim[1] * c[2]));
+}
+
+
+/** @brief Write the auxiliary planes of one pixel
+ *  @param ctx
+ *      Frame context
+ *  @param n
+ *      Linear index of the pixel
+ *  @param org
+ *      Position on the ray, in pixel coordinates
+ *  @param tangent
+ *      Tangent vector in pixel coordinates
+ *  @param depth
+ *      Ray parameter of the max, or NaN
+ *  @param count
+ *      Samples taken by the ray
+ */
+static void rc_raycast_gbuf(const struct rc_raycast_ctx *ctx,
+                            size_t                       n,
+                            vec_t                        org,
+                            vec_t                        tangent,
+                            scal_t                       depth,
+                            unsigned                     count)
+{
+    const struct rc_gbuf *gbuf = ctx->gbuf;
+    RC_ALIGN scal_t pos[4];
+    scal_t len;
+
+    if (gbuf->depth) {
+        len = rc_cvtsf(rc_vsqrnorm(rc_mvmul3(ctx->dose->mat, tangent)));
+        gbuf->depth[n] = depth * sqrtf(len);
+    }
+    if (gbuf->voxel) {
+        rc_spill(pos, rc_fmadd(rc_set1(depth), tangent, org));
+        gbuf->voxel[n] = isnan(depth) ? -1 : rc_raycast_voxel(ctx->dose, pos);
+    }
+    if (gbuf->count) {
+        gbuf->count[n] = count;
+    }
+}
+
+
+/** @brief Packet version of rc_raycast_gbuf
+ *  @param ctx
+ *      Frame context
+ *  @param n
+ *      Linear index of the first pixel
+ *  @param skip
+ *      Distance between the pixels
+ *  @param org
+ *      Positions on each ray, in pixel coordinates
+ *  @param tangent
+ *      Tangent vectors in pixel coordinates
+ *  @param depth
+ *      Ray parameters of each max
+ *  @param count
+ *      Samples taken by each ray
+ */
+static void rc_raycast_gbuf8(const struct rc_raycast_ctx *ctx,
+                             size_t                       n,
+                             unsigned                     skip,
+                             const struct rc_packet      *org,
+                             const struct rc_packet      *tangent,
+                             __m256                       depth,
+                             __m256                       count)
+{
+    alignas (__m256) float p[3][8], t[3][8], dep[8], cnt[8];
+    unsigned k;
+
+    _mm256_store_ps(p[0], org->x);
+    _mm256_store_ps(p[1], org->y);
+    _mm256_store_ps(p[2], org->z);
+    _mm256_store_ps(t[0], tangent->x);
+    _mm256_store_ps(t[1], tangent->y);
+    _mm256_store_ps(t[2], tangent->z);
+    _mm256_store_ps(dep, depth);
+    _mm256_store_ps(cnt, count);
+    for (k = 0; k < 8; k++, n += skip) {
+        rc_raycast_gbuf(ctx,
+                        n,
+                        rc_set(p[0][k], p[1][k], p[2][k], 1.0),
+                        rc_set(t[0][k], t[1][k], t[2][k], 0.0),
+                        dep[k],
+                        (unsigned)cnt[k]);
+    }
+}
+
+
+/** @brief Raycast as many whole packets of eight pixels as fit in a span
+ *  @param ctx
+ *      Frame context
+ *  @param scanpos
+ *      Pixel coordinates of the first pixel on the scanline
+ *  @param row
+ *      Linear index of the first pixel on the scanline
+ *  @param first
+ *      Index of the first pixel of the span on the scanline
+ *  @param end
+ *      One past the index of the last pixel of the span
+ *  @param skip
+ *      Distance between the pixels cast on the span
+ *  @param ptr
+ *      Pointer to the first pixel of the span
+ *  @returns The number of pixels written, which is the number of pixels cast on
+ *      the span rounded down to a multiple of eight
+ */
+static unsigned rc_raycast_scan8(const struct rc_raycast_ctx *ctx,
+                                 vec_t                        scanpos,
+                                 size_t                       row,
+                                 unsigned                     first,
+                                 unsigned                     end,
+                                 unsigned                     skip,
+                                 char                        *ptr)
+{
+    const unsigned stride = ctx->target->tex.stride;
+    struct rc_reproj *reproj = ctx->reproj;
+    RC_ALIGN scal_t sp[4], st[4], so[4];
+    alignas (__m256) float res[8], dep[8], col[4][8];
+    alignas (__m256i) uint32_t pix[8];
+    struct rc_packet base, dx, cam, pos, tangent;
+    __m256 lane, norm, depth, samples, scale, rgba[4];
+    __m256i px;
+    unsigned i, k, count = 0;
+    size_t n;
+
+    rc_spill(sp, scanpos);
+    rc_spill(st, ctx->vstep);
+    rc_spill(so, ctx->vorg);
+    base.x = _mm256_set1_ps(sp[0]);
+    base.y = _mm256_set1_ps(sp[1]);
+    base.z = _mm256_set1_ps(sp[2]);
+    dx.x = _mm256_set1_ps(st[0]);
+    dx.y = _mm256_set1_ps(st[1]);
+    dx.z = _mm256_set1_ps(st[2]);
+    cam.x = _mm256_set1_ps(so[0]);
+    cam.y = _mm256_set1_ps(so[1]);
+    cam.z = _mm256_set1_ps(so[2]);
+    scale = _mm256_set1_ps(1.0f);
+    if (ctx->ortho) {
+        rc_spill(so, ctx->vdir);
+        tangent.x = _mm256_set1_ps(so[0]);
+        tangent.y = _mm256_set1_ps(so[1]);
+        tangent.z = _mm256_set1_ps(so[2]);
+        if (!ctx->transfer) {
+            scale = rc_raycast_stepscale8(ctx, &tangent);
+            tangent.x = _mm256_mul_ps(tangent.x, scale);
+            tangent.y = _mm256_mul_ps(tangent.y, scale);
+            tangent.z = _mm256_mul_ps(tangent.z, scale);
+        }
+    }
+    for (i = first; i + 7 * skip < end; i += 8 * skip, count += 8) {
+        lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+        lane = _mm256_fmadd_ps(lane,
+                               _mm256_set1_ps((float)skip),
+                               _mm256_set1_ps((float)i));
+        pos.x = _mm256_fmadd_ps(lane, dx.x, base.x);
+        pos.y = _mm256_fmadd_ps(lane, dx.y, base.y);
+        pos.z = _mm256_fmadd_ps(lane, dx.z, base.z);
+        if (!ctx->ortho) {
+            tangent.x = _mm256_sub_ps(pos.x, cam.x);
+            tangent.y = _mm256_sub_ps(pos.y, cam.y);
+            tangent.z = _mm256_sub_ps(pos.z, cam.z);
+            norm = _mm256_mul_ps(tangent.x, tangent.x);
+            norm = _mm256_fmadd_ps(tangent.y, tangent.y, norm);
+            norm = _mm256_fmadd_ps(tangent.z, tangent.z, norm);
+            norm = _mm256_rsqrt_ps(norm);
+            tangent.x = _mm256_mul_ps(tangent.x, norm);
+            tangent.y = _mm256_mul_ps(tangent.y, norm);
+            tangent.z = _mm256_mul_ps(tangent.z, norm);
+            if (!ctx->transfer) {
+                scale = rc_raycast_stepscale8(ctx, &tangent);
+                tangent.x = _mm256_mul_ps(tangent.x, scale);
+                tangent.y = _mm256_mul_ps(tangent.y, scale);
+                tangent.z = _mm256_mul_ps(tangent.z, scale);
+            }
+        }
+        if (ctx->transfer) {
+            rc_raycast_composite8(ctx->dose,
+                                  ctx->dosefn8,
+                                  ctx->transfer,
+                                  &pos,
+                                  &tangent,
+                                  rgba);
+            for (k = 0; k < 4; k++) {
+                _mm256_store_ps(col[k], rgba[k]);
+            }
+            for (k = 0; k < 8; k++) {
+                rc_raycast_rgba((float [4]){
+                    col[0][k], col[1][k], col[2][k], col[3][k]
+                }, ptr);
+                ptr += (size_t)skip * stride;
+            }
+            continue;
+        }
+        for (k = 0, n = row + i; k < 8; k++, n += skip) {
+            dep[k] = reproj ? reproj->seed[n] : NAN;
+        }
+        /* Seeds and cached depths are in pixel units, not steps */
+        depth = _mm256_div_ps(_mm256_load_ps(dep), scale);
+        _mm256_store_ps(res, ctx->kernel8(ctx->dose,
+                                          ctx->dosefn8,
+                                          &pos,
+                                          &tangent,
+                                          &depth,
+                                          &samples));
+        _mm256_store_ps(dep, _mm256_mul_ps(depth, scale));
+        if (ctx->gbuf) {
+            rc_raycast_gbuf8(ctx,
+                             row + i,
+                             skip,
+                             &pos,
+                             &tangent,
+                             depth,
+                             samples);
+        }
+        if (ctx->floats || ctx->lut) {
+            if (ctx->floats) {
+                px = _mm256_castps_si256(_mm256_load_ps(res));
+            } else {
+                px = rc_cmap_lut_map8(ctx->lut, _mm256_load_ps(res));
+            }
+            if (skip == 1) {
+                _mm256_storeu_si256((__m256i *)ptr, px);
+                ptr += 8 * stride;
+            } else {
+                _mm256_store_si256((__m256i *)pix, px);
+                for (k = 0; k < 8; k++) {
+                    memcpy(ptr, &pix[k], sizeof *pix);
+                    ptr += (size_t)skip * stride;
+                }
+            }
+        } else {
+            for (k = 0; k < 8; k++) {
+                ctx->cmap->func(ctx->cmap, res[k], ptr);
+                ptr += (size_t)skip * stride;
+            }
+        }
+        for (k = 0, n = row + i; reproj && k < 8; k++, n += skip) {
+            reproj->value[n] = res[k];
+            reproj->depth[n] = dep[k];
+        }
+    }
+    return count;
+}
+
+
+/** @brief Copy each pixel cast on scanline @p j over the rest of its block
+ *  @param ctx
+ *      Frame context
+ *  @param j
+ *      Scanline
+ *  @param i
+ *      First pixel cast
+ *  @param step
+ *      Distance between pixels cast
+ *  @param iend
+ *      One past the last pixel that may have been cast
+ */
+static void rc_raycast_fill(const struct rc_raycast_ctx *ctx,
+                            unsigned                     j,
+                            unsigned                     i,
+                            unsigned                     step,
+                            unsigned                     iend)
+{
+    const struct rc_texture *tex = &ctx->target->tex;
+    const size_t pitch = (size_t)tex->stride * tex->dim[0];
+    struct rc_reproj *reproj = ctx->reproj;
+    const struct rc_gbuf *gbuf = ctx->gbuf;
+    unsigned r, rend, c, cend;
+    size_t n, m;
+    const char *src;
+    char *dst;
+
+    rend = j + ctx->block < tex->dim[1] ? j + ctx->block : tex->dim[1];
+    for (; i < iend; i += step) {
+        src = (char *)tex->pixels + pitch * j + (size_t)tex->stride * i;
+        n = (size_t)tex->dim[0] * j + i;
+        cend = i + ctx->block < tex->dim[0] ? i + ctx->block : tex->dim[0];
+        for (r = j; r < rend; r++) {
+            dst = (char *)tex->pixels + pitch * r;
+            for (c = (r == j) ? i + 1 : i; c < cend; c++) {
+                memcpy(dst + (size_t)tex->stride * c, src, tex->stride);
+                m = (size_t)tex->dim[0] * r + c;
+                if (reproj) {
+                    reproj->value[m] = reproj->value[n];
+                    reproj->depth[m] = reproj->depth[n];
+                }
+                if (gbuf && gbuf->depth) {
+                    gbuf->depth[m] = gbuf->depth[n];
+                }
+                if (gbuf && gbuf->voxel) {
+                    gbuf->voxel[m] = gbuf->voxel[n];
+                }
+                if (gbuf && gbuf->count) {
+                    gbuf->count[m] = gbuf->count[n];
+                }
+            }
+        }
+    }
+}
+
+
+/** @brief Fill @p count 32-bit words at @p dst with @p word, bypassing the
+ *      cache where it can
+ *  @param dst
+ *      Destination, aligned to four bytes
+ *  @param word
+ *      Fill value
+ *  @param count
+ *      Number of words
+ */
+static void rc_raycast_stream(void *dst, uint32_t word, size_t count)
+{
+    const __m256i fill = _mm256_set1_epi32((int)word);
+    char *ptr = dst;
+
+    for (; count && (uintptr_t)ptr % sizeof fill; count--) {
+        memcpy(ptr, &word, sizeof word);
+        ptr += sizeof word;
+    }
+    for (; count >= 8; count -= 8) {
+        _mm256_stream_si256((__m256i *)ptr, fill);
+        ptr += sizeof fill;
+    }
+    for (; count; count--) {
+        memcpy(ptr, &word, sizeof word);
+        ptr += sizeof word;
+    }
+}
+
+
+/** @brief Write the result of a ray that misses the dose to every pixel from
+ *      @p i to @p iend on scanline @p j
+ *  @param ctx
+ *      Frame context
+ *  @param j
+ *      Scanline
+ *  @param i
+ *      First pixel
+ *  @param iend
+ *      One past the last pixel
+ */
+static void rc_raycast_background(const struct rc_raycast_ctx *ctx,
+                                  unsigned                     j,
+                                  unsigned                     i,
+                                  unsigned                     iend)
+{
+    const struct rc_texture *tex = &ctx->target->tex;
+    const size_t n = (size_t)tex->dim[0] * j + i;
+    const float nan = NAN;
+    size_t k, count;
+    uint32_t word;
+    char *ptr;
+
+    if (i >= iend) {
+        return;
+    }
+    count = iend - i;
+    ptr = (char *)tex->pixels + (size_t)tex->stride * n;
+    if (tex->stride == sizeof word) {
+        memcpy(&word, ctx->bg, sizeof word);
+        rc_raycast_stream(ptr, word, count);
+    } else {
+        for (k = 0; k < count; k++) {
+            memcpy(ptr, ctx->bg, tex->stride);
+            ptr += tex->stride;
+        }
+    }
+    memcpy(&word, &nan, sizeof word);
+    if (ctx->reproj) {
+        rc_raycast_stream(ctx->reproj->value + n, 0, count);
+        rc_raycast_stream(ctx->reproj->depth + n, word, count);
+    }
+    if (ctx->gbuf && ctx->gbuf->depth) {
+        rc_raycast_stream(ctx->gbuf->depth + n, word, count);
+    }
+    if (ctx->gbuf && ctx->gbuf->voxel) {
+        rc_raycast_stream(ctx->gbuf->voxel + n, UINT32_MAX, count);
+    }
+    if (ctx->gbuf && ctx->gbuf->count) {
+        rc_raycast_stream(ctx->gbuf->count + n, 0, count);
+    }
+    /* Streamed stores are weakly ordered */
+    _mm_sfence();
+}
+
+
+/** @brief Raycast the pixels from @p i to @p iend on scanline @p j that
+ *      belong to the current pass
+ *  @param ctx
+ *      Frame context
+ *  @param j
+ *      Scanline
+ *  @param i
+ *      First pixel
+ *  @param iend
+ *      One past the last pixel
+ */
+static void rc_raycast_span(const struct rc_raycast_ctx *ctx,
+                            unsigned                     j,
+                            unsigned                     i,
+                            unsigned                     iend)
+{
+    const unsigned stride = ctx->target->tex.stride;
+    const size_t row = (size_t)ctx->target->tex.dim[0] * j;
+    struct rc_reproj *reproj = ctx->reproj;
+    unsigned count, step = ctx->block, skew = 0, first;
+    vec_t scanpos, pos, tangent;
+    float rgba[4];
+    unsigned samples;
+    scal_t depth, scale;
+    size_t offs;
+    double res;
+    char *ptr;
+
+    if (j < ctx->clip[1] || j >= ctx->clip[3]) {
+        rc_raycast_background(ctx, j, i, iend);
+        return;
+    }
+    rc_raycast_background(ctx, j, i, iend < ctx->clip[0] ? iend : ctx->clip[0]);
+    rc_raycast_background(ctx, j, i > ctx->clip[2] ? i : ctx->clip[2], iend);
+    i = i > ctx->clip[0] ? i : ctx->clip[0];
+    iend = iend < ctx->clip[2] ? iend : ctx->clip[2];
+    if (j % ctx->block || i >= iend) {
+        return;
+    }
+    if (ctx->refine && j % (2 * ctx->block) == 0) {
+        /* Every other pixel on this row was cast by the previous pass */
+        step = 2 * ctx->block;
+        skew = ctx->block;
+    }
+    i += (skew + step - i % step) % step;
+    first = i;
+    scanpos = rc_fmadd(ctx->basis.y, rc_set1((scal_t)j), ctx->basis.org);
+    scanpos = rc_mvmul4(ctx->dose->inv, scanpos);
+    offs = (size_t)stride * (row + i);
+    ptr = (char *)ctx->target->tex.pixels + offs;
+    if (ctx->dosefn8) {
+        count = rc_raycast_scan8(ctx,
+                                 scanpos,
+                                 row,
+                                 i,
+                                 iend,
+                                 step,
+                                 ptr);
+        ptr += (size_t)count * step * stride;
+        i += count * step;
+    }
+    for (; i < iend; i += step) {
+        pos = rc_fmadd(ctx->vstep, rc_set1((scal_t)i), scanpos);
+        if (ctx->ortho) {
+            tangent = ctx->vdir;
+        } else {
+            tangent = rc_vnorm(rc_sub(pos, ctx->vorg));
+        }
+        if (ctx->transfer) {
+            rc_raycast_composite(ctx->dose,
+                                 ctx->dosefn,
+                                 ctx->transfer,
+                                 pos,
+                                 tangent,
+                                 rgba);
+            rc_raycast_rgba(rgba, ptr);
+            ptr += (size_t)step * stride;
+            continue;
+        }
+        scale = rc_raycast_stepscale(ctx, tangent);
+        tangent = rc_mul(tangent, rc_set1(scale));
+        depth = reproj ? reproj->seed[row + i] / scale : NAN;
+        res = ctx->kernel(ctx->dose,
+                          ctx->dosefn,
+                          pos,
+                          tangent,
+                          &depth,
+                          &samples);
+        ctx->cmap->func(ctx->cmap, res, ptr);
+        if (ctx->gbuf) {
+            rc_raycast_gbuf(ctx, row + i, pos, tangent, depth, samples);
+        }
+        if (reproj) {
+            reproj->value[row + i] = (float)res;
+            reproj->depth[row + i] = depth * scale;
+        }
+        ptr += (size_t)step * stride;
+    }
+    if (ctx->block > 1) {
+        rc_raycast_fill(ctx, j, first, step, iend);
+    }
+}
+
+
+/** @brief Raycast one tile. This is an rc_sched_tilefn_t
+ *  @param data
+ *      Frame context
+ *  @param org
+ *      Top left corner of the tile
+ *  @param end
+ *      One past the bottom right corner of the tile
+ */
+static void rc_raycast_tile(void           *data,
+                            const unsigned  org[],
+                            const unsigned  end[])
+{
+    const struct rc_raycast_ctx *ctx = data;
+    unsigned j;
+
+    for (j = org[1]; j < end[1]; j++) {
+        rc_raycast_span(ctx, j, org[0], end[0]);
+    }
+}
+
+
+/** @brief Write the dose itself to a float pixel. This is the colormap of the
+ *      dose texture
+ */
+static void rc_raycast_floatfn(struct rc_colormap *this, double dose, void *pixel)
+{
+    (void)this;
+    *(float *)pixel = (float)dose;
+}
+
+
+/** The colormap of the dose texture */
+static struct rc_colormap rc_raycast_floatmap = { .func = rc_raycast_floatfn };
+
+
+/** @brief No dose in sight, just rapidly colormap zero to @p target
+ *  @param target
+ *      Target texture
+ *  @param cmap
+ *      Colormap
+ */
+static void rc_raycast_empty(struct rc_target *target, struct rc_colormap *cmap)
+{
+    const unsigned flen = target->tex.dim[0] * target->tex.stride;
+    unsigned char *scan, *pixel;
+    unsigned i;
+    int j, jend = target->tex.dim[1];
+
+#if _OPENMP
+#   pragma omp parallel for private(i, scan, pixel)
+#endif /* _OPENMP */
+    for (j = 0; j < jend; j++) {
+        scan = (unsigned char *)target->tex.pixels + (size_t)flen * j;
+        for (i = 0; i < target->tex.dim[0]; i++) {
+            pixel = scan + i * target->tex.stride;
+            cmap->func(cmap, 0.0, pixel);
+        }
+    }
+}
+
+
+/** @brief Find a corner of the dose box in camera coordinates
+ *  @param dose
+ *      Dose volume
+ *  @param camera
+ *      Camera
+ *  @param c
+ *      Corner, whose three low bits select the upper bound of each axis
+ *  @param[out] proj
+ *      Displacement from the camera to the corner along its horizontal,
+ *      vertical and view axes
+ */
+static void rc_raycast_corner(const struct rc_dose *dose,
+                              const struct rc_cam  *camera,
+                              unsigned              c,
+                              scal_t                proj[])
+{
+    RC_ALIGN static const scal_t unit[3][4] = {
+        { 1.0f, 0.0f, 0.0f, 0.0f },
+        { 0.0f, 1.0f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f, 0.0f }
+    };
+    RC_ALIGN scal_t v[4], axis[4];
+    vec_t corner;
+    unsigned a;
+
+    /* Pad by a voxel for the half-voxel shift of the nearest samples */
+    corner = rc_set((c & 1) ? (scal_t)dose->dim[0] : -1.0f,
+                    (c & 2) ? (scal_t)dose->dim[1] : -1.0f,
+                    (c & 4) ? (scal_t)dose->dim[2] : -1.0f,
+                    1.0f);
+    corner = rc_sub(rc_mvmul4(dose->mat, corner), camera->org);
+    rc_spill(v, corner);
+    for (a = 0; a < 3; a++) {
+        rc_spill(axis, rc_qrot(camera->quat, rc_load(unit[a])));
+        proj[a] = v[0] * axis[0] + v[1] * axis[1] + v[2] * axis[2];
+    }
+}
+
+
+/** @brief Project the corners of the dose onto the target to find the
+ *      rectangle of pixels whose rays can hit it
+ *  @param ctx
+ *      Frame context. The clip rectangle is written here
+ *  @param camera
+ *      Camera
+ *  @param align
+ *      The rectangle is grown outward to multiples of this many pixels, so
+ *      that it never splits a progressive block
+ */
+static void rc_raycast_scissor(struct rc_raycast_ctx *ctx,
+                               const struct rc_cam   *camera,
+                               unsigned               align)
+{
+    const struct rc_target *target = ctx->target;
+    RC_ALIGN scal_t res[4], size[4];
+    scal_t lo[2] = { INFINITY, INFINITY }, hi[2] = { -INFINITY, -INFINITY };
+    scal_t proj[3], off;
+    unsigned c, a, b;
+
+    ctx->clip[0] = ctx->clip[1] = 0;
+    ctx->clip[2] = target->tex.dim[0];
+    ctx->clip[3] = target->tex.dim[1];
+    rc_spill(res, target->res);
+    rc_spill(size, target->size);
+    for (c = 0; c < 8; c++) {
+        rc_raycast_corner(ctx->dose, camera, c, proj);
+        if (!target->ortho) {
+            if (!(proj[2] > 0.0f)) {
+                /* Behind the camera, the box may cover anything */
+                return;
+            }
+            proj[0] /= proj[2];
+            proj[1] /= proj[2];
+        }
+        for (a = 0; a < 2; a++) {
+            off = (proj[a] - 0.5f * (res[a] - size[a])) / res[a];
+            lo[a] = rc_fminf(lo[a], off);
+            hi[a] = rc_fmaxf(hi[a], off);
+        }
+    }
+    for (a = 0; a < 2; a++) {
+        if (!(lo[a] < (scal_t)target->tex.dim[a]) || !(hi[a] >= 0.0f)) {
+            ctx->clip[a] = ctx->clip[a + 2] = 0;
+            continue;
+        }
+        if (lo[a] > 1.0f) {
+            b = (unsigned)lo[a] - 1;
+            ctx->clip[a] = b - b % align;
+        }
+        if (hi[a] < (scal_t)target->tex.dim[a] - 2.0f) {
+            b = (unsigned)hi[a] + 2;
+            b += (align - b % align) % align;
+            ctx->clip[a + 2] = b < target->tex.dim[a] ? b : target->tex.dim[a];
+        }
+    }
+}
+
+
+const struct rc_dose *rc_raycast_lod(const struct rc_dose         *dose,
+                                     const struct rc_target       *target,
+                                     const struct rc_cam          *camera,
+                                     const struct rc_raycast_opts *opts)
+{
+    RC_ALIGN scal_t res[4], len[4];
+    scal_t proj[3], near = INFINITY, voxel = INFINITY, ratio;
+    unsigned lev, fit = 0, c, a;
+
+    lev = opts ? opts->lod : 0;
+    if (opts && opts->autolod && dose->nmip) {
+        for (a = 0; a < 3; a++) {
+            rc_spill(len, rc_vsqrnorm(dose->mat[a]));
+            voxel = rc_fminf(voxel, sqrtf(len[0]));
+        }
+        for (c = 0; c < 8 && !target->ortho; c++) {
+            rc_raycast_corner(dose, camera, c, proj);
+            near = rc_fminf(near, proj[2]);
+        }
+        /* The footprint of a pixel is its spacing on the image plane, which
+        is one unit from a pinhole, scaled out to the nearest corner */
+        rc_spill(res, target->res);
+        ratio = rc_fminf(res[0], res[1]) / voxel;
+        ratio *= target->ortho ? 1.0f : rc_fmaxf(near, 0.0f);
+        for (; ratio >= 2.0f && fit < dose->nmip; ratio *= 0.5f) {
+            fit++;
+        }
+    }
+    lev = lev > fit ? lev : fit;
+    lev = lev < dose->nmip ? lev : dose->nmip;
+    return lev ? &dose->mip[lev - 1] : dose;
+}
+
+
+void rc_raycast_dose(const struct rc_dose         *dose,
+                     struct rc_target             *target,
+                     struct rc_colormap           *cmap,
+                     const struct rc_cam          *camera,
+                     rc_dose_interpfn_t           *dosefn,
+                     const struct rc_raycast_opts *opts)
+{
+    struct rc_raycast_ctx ctx;
+    struct rc_reproj_view view;
+    struct rc_target dosetarget;
+    int j, jend = (int)target->tex.dim[1];
+
+    if (opts && opts->dosetex && !opts->transfer) {
+        /* Same geometry, but the pixels are the doses */
+        dosetarget = *target;
+        dosetarget.tex = *opts->dosetex;
+        target = &dosetarget;
+        cmap = &rc_raycast_floatmap;
+    }
+    if (!dose->data) {
+        rc_raycast_empty(target, cmap);
+        return;
+    }
+    dose = rc_raycast_lod(dose, target, camera, opts);
+    ctx.dose = dose;
+    ctx.target = target;
+    ctx.cmap = cmap;
+    ctx.lut = target->tex.stride == 4 ? rc_cmap_lut_cast(cmap) : NULL;
+    ctx.floats = cmap == &rc_raycast_floatmap;
+    rc_raycast_basis(&ctx.basis, target, camera);
+    ctx.vstep = rc_mvmul3(dose->inv, ctx.basis.x);
+    ctx.vorg = rc_mvmul4(dose->inv, camera->org);
+    ctx.ortho = target->ortho;
+    view.dir = rc_qrot(camera->quat, rc_set(0.0, 0.0, 1.0, 0.0));
+    ctx.vdir = rc_vnorm(rc_mvmul3(dose->inv, view.dir));
+    ctx.kernel = rc_raycast_compute;
+    ctx.kernel8 = rc_raycast_compute8;
+    ctx.dosefn = rc_raycast_clipfn(dosefn);
+    ctx.dosefn8 = rc_raycast_packetfn(dosefn);
+    ctx.block = opts && opts->block > 1 ? opts->block : 1;
+    ctx.refine = opts && opts->refine;
+    ctx.reproj = NULL;
+    ctx.transfer = opts ? opts->transfer : NULL;
+    ctx.gbuf = opts && !ctx.transfer ? opts->gbuf : NULL;
+    ctx.step = opts && opts->step > 0.0 ? (scal_t)opts->step : 0.0f;
+    if (target->tex.stride <= sizeof ctx.bg) {
+        if (ctx.transfer) {
+            rc_raycast_rgba((const float [4]){ 0 }, ctx.bg);
+        } else {
+            cmap->func(cmap, 0.0, ctx.bg);
+        }
+        rc_raycast_scissor(&ctx, camera, 2 * ctx.block);
+    } else {
+        /* No room for the background pixel, so cast everything */
+        ctx.clip[0] = ctx.clip[1] = 0;
+        ctx.clip[2] = target->tex.dim[0];
+        ctx.clip[3] = target->tex.dim[1];
+    }
+    if (opts && opts->reproj && !ctx.transfer && opts->proj == RC_PROJ_MAX) {
+        view.cam = camera->org;
+        view.org = ctx.basis.org;
+        view.x = ctx.basis.x;
+        view.y = ctx.basis.y;
+        view.ortho = ctx.ortho;
+        if (!rc_reproj_begin(opts->reproj, dose, target->tex.dim, &view)) {
+            ctx.reproj = opts->reproj;
+        }
+    }
+    switch (opts ? opts->proj : RC_PROJ_MAX) {
+    case RC_PROJ_MAX:
+        if (opts && opts->dda && dosefn == rc_dose_nearest) {
+            ctx.kernel = rc_raycast_traverse;
+            ctx.kernel8 = rc_raycast_traverse8;
+        } else if (opts && opts->adaptive) {
+            ctx.kernel = rc_raycast_adaptive;
+            ctx.kernel8 = rc_raycast_adaptive8;
+        }
+        break;
+    case RC_PROJ_MIN:
+        ctx.kernel = rc_raycast_minip;
+        ctx.kernel8 = rc_raycast_minip8;
+        break;
+    case RC_PROJ_MEAN:
+        ctx.kernel = rc_raycast_meanip;
+        ctx.kernel8 = rc_raycast_meanip8;
+        break;
+    case RC_PROJ_INTEGRAL:
+        ctx.kernel = rc_raycast_integral;
+        ctx.kernel8 = rc_raycast_integral8;
+        break;
+    }
+    if (opts && opts->sched
+     && !rc_sched_run(opts->sched, target->tex.dim, rc_raycast_tile, &ctx)) {
+        return;
+    }
+
+    /* No scheduler, or not enough memory for it */
+#if _OPENMP
+#   pragma omp parallel for schedule(dynamic)
+#endif /* _OPENMP */
+    for (j = 0; j < jend; j++) {
+        rc_raycast_span(&ctx, j, 0, target->tex.dim[0]);
+    }
+}
+
+
+void rc_raycast_recolor(const struct rc_texture *dosetex,
+                        struct rc_target        *target,
+                        struct rc_colormap      *cmap)
+{
+    const size_t pitch = (size_t)target->tex.stride * target->tex.dim[0];
+    const size_t srcpitch = (size_t)dosetex->stride * dosetex->dim[0];
+    const struct rc_cmap_lut *lut = NULL;
+    const float *src;
+    unsigned i;
+    char *dst;
+    int j, jend = (int)target->tex.dim[1];
+
+    if (target->tex.stride == 4) {
+        lut = rc_cmap_lut_cast(cmap);
+    }
+#if _OPENMP
+#   pragma omp parallel for private(i, src, dst)
+#endif /* _OPENMP */
+    for (j = 0; j < jend; j++) {
+        src = (const float *)((const char *)dosetex->pixels + srcpitch * j);
+        dst = (char *)target->tex.pixels + pitch * j;
+        if (lut) {
+            rc_cmap_lut_map(lut, src, target->tex.dim[0], dst);
+            continue;
+        }
+        for (i = 0; i < target->tex.dim[0]; i++) {
+            cmap->func(cmap, src[i], dst);
+            dst += target->tex.stride;
+        }
+    }
+}
+
+
+int rc_raycast_proj_parse(const char *name, enum rc_raycast_proj *proj)
+{
+    static const char *names[] = {
+        [RC_PROJ_MAX]      = "max",
+        [RC_PROJ_MIN]      = "min",
+        [RC_PROJ_MEAN]     = "mean",
+        [RC_PROJ_INTEGRAL] = "integral"
+    };
+    unsigned i;
+
+    for (i = 0; i < sizeof names / sizeof *names; i++) {
+        if (!strcmp(name, names[i])) {
+            *proj = (enum rc_raycast_proj)i;
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return 1;
+}
+
+
+double rc_raycast_proj_max(const struct rc_dose *dose,
+                           enum rc_raycast_proj  proj)
+{
+    RC_ALIGN scal_t len[4];
+    double res = INFINITY;
+    unsigned i;
+
+    if (proj != RC_PROJ_INTEGRAL) {
+        return dose->dmax;
+    }
+    for (i = 0; i < 3; i++) {
+        rc_spill(len, rc_vsqrnorm(dose->mat[i]));
+        res = rc_fmin(res, sqrt(len[0]) * dose->dim[i]);
     }
+    return dose->dmax * res;
 }
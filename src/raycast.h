@@ -4,9 +4,13 @@
 #define RAYCAST_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "rcmath.h"
 #include "dose.h"
 #include "cmap.h"
+#include "schedule.h"
+#include "reproject.h"
+#include "transfer.h"
 
 
 /** Context struct containing geometric information for a pinhole camera */
@@ -104,14 +108,14 @@ struct rc_texture {
 
 
 /** A target texture and relevant information. You set the texture components,
- *  but don't touch size and res
+ *  but don't touch size, res and ortho
  * 
- *  TODO: Make this a base class. Curved targets and orthographic targets might
- *      be interesting
+ *  TODO: Make this a base class. Curved targets might be interesting
  */
 struct rc_target {
     vec_t             size;     /* The physical size in each dimension */
     vec_t             res;      /* Pixel spacing */
+    bool              ortho;    /* Every ray points along the camera axis */
     struct rc_texture tex;      /* Texture details */
 };
 
@@ -122,6 +126,9 @@ struct rc_target {
 struct rc_screen {
     unsigned dim[2];    /* Pixel dimensions */
     double   fov;       /* Horizontal field of view (in degrees) */
+    double   width;     /* If positive, project orthographically instead, onto
+                        a plane this wide in ambient units. The field of view
+                        is ignored */
 };
 
 
@@ -135,8 +142,164 @@ struct rc_screen {
 void rc_target_update(struct rc_target *target, const struct rc_screen *screen);
 
 
+/** A tangent basis for the image plane */
+struct rc_basis {
+    vec_t x;    /* The horizontal tangent basis vector */
+    vec_t y;    /* The vertical tangent basis vector */
+    vec_t org;  /* The physical coordinates of the top left corner */
+};
+
+
+/** @brief Compute the basis vectors for the target plane. Only the first two
+ *      are returned; the third component is the origin. All outputs are in
+ *      scene coordinates, and the basis vectors are one pixel long
+ *  @param[out] basis
+ *      Destination buffer
+ *  @param target
+ *      Target context
+ *  @param camera
+ *      Camera containing orientation quaternion
+ */
+void rc_raycast_basis(struct rc_basis        *basis,
+                      const struct rc_target *target,
+                      const struct rc_cam    *camera);
+
+
+/** How the samples along each ray are reduced to one dose */
+enum rc_raycast_proj {
+    RC_PROJ_MAX,        /* Maximum intensity */
+    RC_PROJ_MIN,        /* Minimum intensity, ignoring samples at or below the
+                        brick floor. Rays that find nothing are zero */
+    RC_PROJ_MEAN,       /* Mean over the whole path through the volume */
+    RC_PROJ_INTEGRAL    /* Integral over the whole path through the volume,
+                        in dose times ambient units */
+};
+
+
+/** Auxiliary planes written alongside the projection, one entry for each
+ *  pixel of the target in the same order. Any of them may be NULL
+ */
+struct rc_gbuf {
+    float    *depth;    /* Ambient distance along the ray from the image plane
+                        to the max, or NaN if the ray found no dose */
+    int32_t  *voxel;    /* Linear index of the voxel nearest the max in the
+                        level sampled (see rc_raycast_lod), or -1 */
+    uint32_t *count;    /* Number of samples taken by the ray */
+};
+
+
+/** Optional settings for rc_raycast_dose. Zero-initialize this for the
+ *  defaults
+ */
+struct rc_raycast_opts {
+    bool dda;   /* With rc_dose_nearest, walk the voxel grid instead of taking
+                unit steps, visiting every voxel crossed by a ray exactly
+                once. Ignored by the other interpolators */
+
+    struct rc_sched *sched;     /* If not NULL, the frame is split into tiles
+                                and balanced across threads by this. Pass the
+                                same scheduler every frame */
+
+    unsigned block;     /* For progressive rendering: cast one ray for each
+                        square block of this many pixels on a side and fill
+                        the block with it. Zero or one is full resolution */
+    bool     refine;    /* Skip the pixels cast by a previous pass with twice
+                        the block size, leaving the target as it is there.
+                        A coarse pass followed by refining passes that halve
+                        the block each time casts every pixel exactly once */
+
+    struct rc_reproj *reproj;   /* If not NULL, each frame is seeded with the
+                                maxima of the last, reprojected into the new
+                                view. Results are unchanged, but rays prune
+                                more once they start at their old max. Pass
+                                the same cache every frame */
+
+    const struct rc_transfer *transfer; /* If not NULL, composite each ray
+                                        front to back through this transfer
+                                        function instead of taking its max.
+                                        Pixels are written as RGBA bytes and
+                                        the colormap is not used. Rays stop
+                                        early once they are nearly opaque.
+                                        dda and reproj are ignored */
+
+    enum rc_raycast_proj proj;  /* Reduction applied to each ray. Samples in
+                                empty bricks count as zero for the mean and
+                                integral. dda and reproj only apply to the
+                                max */
+
+    struct rc_texture *dosetex; /* If not NULL, the projected dose of each
+                                pixel is written here as a float instead of
+                                being colormapped, and the target is left
+                                alone. It must be as large as the target, with
+                                a stride of sizeof (float). Colormap it with
+                                rc_raycast_recolor. Ignored when compositing */
+
+    struct rc_gbuf *gbuf;   /* If not NULL, the planes in this are written as
+                            well. Only the max has a depth and voxel; the
+                            other projections report NaN and -1. Ignored when
+                            compositing */
+
+    unsigned lod;       /* Sample at least this mip level of the dose, zero
+                        for the dose itself. Raise it while the camera moves
+                        to trade detail for speed. Levels keep the max, so
+                        hot spots stay visible but the mean and integral read
+                        high */
+    bool     autolod;   /* Also sample a coarser level when every pixel is
+                        wider than two of its voxels where the dose is
+                        nearest the camera */
+    double step;        /* Ambient distance between samples along each ray
+                        (millimetres for DICOM doses), or zero for one unit of
+                        pixel coordinates. Ignored by dda and compositing */
+    bool   adaptive;    /* Lengthen the step up to fourfold where the dose
+                        changes slowly and shorten it down to a quarter near
+                        steep falloff. Only applies to the max without dda,
+                        and ignores reprojected seeds */
+};
+
+
+/** @brief Parse the name of a projection
+ *  @param name
+ *      One of "max", "min", "mean" or "integral"
+ *  @param[out] proj
+ *      The projection named by @p name
+ *  @returns Nonzero if @p name is not recognized, in which case errno(3) is
+ *      set
+ */
+int rc_raycast_proj_parse(const char *name, enum rc_raycast_proj *proj);
+
+
+/** @brief Find the projected dose that a colormap should treat as its max
+ *  @param dose
+ *      Dose volume
+ *  @param proj
+ *      Projection
+ *  @returns The max dose, or for integrals, the max dose times the shortest
+ *      extent of the volume
+ */
+double rc_raycast_proj_max(const struct rc_dose *dose,
+                           enum rc_raycast_proj  proj);
+
+
+/** @brief Find the mip level of @p dose that rc_raycast_dose samples
+ *  @param dose
+ *      Dose volume
+ *  @param target
+ *      Render target
+ *  @param camera
+ *      Camera information
+ *  @param opts
+ *      Optional settings. If NULL, the defaults are used
+ *  @returns @p dose itself, or one of its mip levels
+ */
+const struct rc_dose *rc_raycast_lod(const struct rc_dose         *dose,
+                                     const struct rc_target       *target,
+                                     const struct rc_cam          *camera,
+                                     const struct rc_raycast_opts *opts);
+
+
 /** @brief Volume raycast @p dose to @p target using maximum-intensity
- *      (perspective) projection
+ *      (perspective) projection, another projection in @p opts, or by
+ *      compositing with a transfer function if @p opts has one
  *  @param dose
  *      Dose volume
  *  @param target
@@ -147,12 +310,30 @@ void rc_target_update(struct rc_target *target, const struct rc_screen *screen);
  *      Camera information
  *  @param dosefn
  *      Interpolator function applied to @p dose
+ *  @param opts
+ *      Optional settings. If NULL, the defaults are used
+ */
+void rc_raycast_dose(const struct rc_dose         *dose,
+                     struct rc_target             *target,
+                     struct rc_colormap           *cmap,
+                     const struct rc_cam          *camera,
+                     rc_dose_interpfn_t           *dosefn,
+                     const struct rc_raycast_opts *opts);
+
+
+/** @brief Colormap the doses written to rc_raycast_opts.dosetex by
+ *      rc_raycast_dose. Changing the colormap only needs this, not another
+ *      raycast. Colormap tables map eight pixels at a time
+ *  @param dosetex
+ *      Projected doses
+ *  @param target
+ *      Render target, as large as @p dosetex
+ *  @param cmap
+ *      Colormap
  */
-void rc_raycast_dose(const struct rc_dose *dose,
-                     struct rc_target     *target,
-                     struct rc_colormap   *cmap,
-                     const struct rc_cam  *camera,
-                     rc_dose_interpfn_t   *dosefn);
+void rc_raycast_recolor(const struct rc_texture *dosetex,
+                        struct rc_target        *target,
+                        struct rc_colormap      *cmap);
 
 
 #endif /* RAYCAST_H */
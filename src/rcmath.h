@@ -23,6 +23,16 @@ typedef float scal_t;
 typedef __m128 vec_t;
 
 
+/** Eight three-dimensional vectors in structure-of-arrays form. These are used
+ *  to march rays in packets of eight
+ */
+struct rc_packet {
+    __m256 x;
+    __m256 y;
+    __m256 z;
+};
+
+
 /** Force proper alignment of spill arrays */
 #define RC_ALIGN alignas (alignof (vec_t))
 
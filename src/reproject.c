@@ -0,0 +1,279 @@
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reproject.h"
+
+
+/** Marks a pixel without a reprojected max */
+#define RC_REPROJ_NONE UINT_MAX
+
+
+void rc_reproj_init(struct rc_reproj *reproj)
+{
+    memset(reproj, 0, sizeof *reproj);
+}
+
+
+/** @brief Resize the buffers, discarding the cached frame if the dimensions
+ *      changed
+ *  @param reproj
+ *      Cache
+ *  @param dim
+ *      Frame dimensions
+ *  @returns Nonzero if there is not enough memory
+ */
+static int rc_reproj_resize(struct rc_reproj *reproj, const unsigned dim[])
+{
+    const size_t len = (size_t)dim[0] * dim[1];
+    size_t n;
+
+    if (reproj->value
+     && reproj->dim[0] == dim[0]
+     && reproj->dim[1] == dim[1]) {
+        return 0;
+    }
+    rc_reproj_clear(reproj);
+    reproj->value = malloc(sizeof *reproj->value * len);
+    reproj->depth = malloc(sizeof *reproj->depth * len);
+    reproj->seed = malloc(sizeof *reproj->seed * len);
+    reproj->dst = malloc(sizeof *reproj->dst * len);
+    reproj->src = malloc(sizeof *reproj->src * len);
+    if (!reproj->value || !reproj->depth || !reproj->seed
+     || !reproj->dst || !reproj->src) {
+        rc_reproj_clear(reproj);
+        errno = ENOMEM;
+        return 1;
+    }
+    reproj->dim[0] = dim[0];
+    reproj->dim[1] = dim[1];
+    for (n = 0; n < len; n++) {
+        reproj->value[n] = 0.0f;
+        reproj->depth[n] = NAN;
+    }
+    return 0;
+}
+
+
+/** @brief Find the dot product of the first three components
+ *  @param a
+ *      Left operand
+ *  @param b
+ *      Right operand
+ *  @returns @p a · @p b
+ */
+static scal_t rc_reproj_dot(vec_t a, vec_t b)
+{
+    return rc_cvtsf(rc_dp(a, b, 0x71));
+}
+
+
+/** @brief Find the ambient position of pixel @p n
+ *  @param view
+ *      Pixel grid
+ *  @param dim
+ *      Frame dimensions
+ *  @param n
+ *      Linear pixel index
+ *  @returns The position of the pixel on the image plane
+ */
+static vec_t rc_reproj_pixel(const struct rc_reproj_view *view,
+                             const unsigned               dim[],
+                             size_t                       n)
+{
+    vec_t res;
+
+    res = rc_fmadd(view->x, rc_set1((scal_t)(n % dim[0])), view->org);
+    return rc_fmadd(view->y, rc_set1((scal_t)(n / dim[0])), res);
+}
+
+
+/** @brief Find the direction of the ray through a pixel
+ *  @param view
+ *      Pixel grid
+ *  @param px
+ *      Position of the pixel
+ *  @returns The tangent of its ray, which is not normalized
+ */
+static vec_t rc_reproj_ray(const struct rc_reproj_view *view, vec_t px)
+{
+    return view->ortho ? view->dir : rc_sub(px, view->cam);
+}
+
+
+/** @brief Find the ambient position of the max of cached pixel @p n
+ *  @param reproj
+ *      Cache
+ *  @param dose
+ *      Dose volume. Depths are measured in its pixel units
+ *  @param n
+ *      Linear pixel index. Its depth must not be NaN
+ *  @returns The position of the max
+ */
+static vec_t rc_reproj_point(const struct rc_reproj *reproj,
+                             const struct rc_dose   *dose,
+                             size_t                  n)
+{
+    vec_t px, dir, len;
+
+    px = rc_reproj_pixel(&reproj->view, reproj->dim, n);
+    dir = rc_reproj_ray(&reproj->view, px);
+    len = rc_rsqrt(rc_vsqrnorm(rc_mvmul3(dose->inv, dir)));
+    return rc_fmadd(dir, rc_mul(len, rc_set1(reproj->depth[n])), px);
+}
+
+
+/** @brief Find the pixel of @p view that @p pt projects to
+ *  @param view
+ *      Pixel grid
+ *  @param dim
+ *      Frame dimensions
+ *  @param pt
+ *      Ambient position
+ *  @returns The linear pixel index, or RC_REPROJ_NONE if @p pt is behind the
+ *      image plane or off of the frame
+ */
+static unsigned rc_reproj_project(const struct rc_reproj_view *view,
+                                  const unsigned               dim[],
+                                  vec_t                        pt)
+{
+    vec_t normal, dir, hit;
+    scal_t s, u, v;
+    long i, j;
+
+    normal = rc_cross(view->x, view->y);
+    if (view->ortho) {
+        /* Slide pt back along the axis onto the plane */
+        dir = view->dir;
+        s = -rc_reproj_dot(normal, rc_sub(pt, view->org))
+          / rc_reproj_dot(normal, dir);
+        if (!(s <= 0.0f) || !isfinite(s)) {
+            return RC_REPROJ_NONE;
+        }
+        hit = rc_sub(rc_fmadd(dir, rc_set1(s), pt), view->org);
+    } else {
+        dir = rc_sub(pt, view->cam);
+        s = rc_reproj_dot(normal, rc_sub(view->org, view->cam))
+          / rc_reproj_dot(normal, dir);
+        if (!(s > 0.0f) || !isfinite(s)) {
+            return RC_REPROJ_NONE;
+        }
+        hit = rc_sub(rc_fmadd(dir, rc_set1(s), view->cam), view->org);
+    }
+    u = rc_reproj_dot(hit, view->x) / rc_reproj_dot(view->x, view->x);
+    v = rc_reproj_dot(hit, view->y) / rc_reproj_dot(view->y, view->y);
+    i = lrintf(u);
+    j = lrintf(v);
+    if (i < 0 || j < 0 || i >= (long)dim[0] || j >= (long)dim[1]) {
+        return RC_REPROJ_NONE;
+    }
+    return (unsigned)i + dim[0] * (unsigned)j;
+}
+
+
+/** @brief Seed every pixel of the next frame that a cached max lands on
+ *  @param reproj
+ *      Cache
+ *  @param dose
+ *      Dose volume
+ *  @param view
+ *      Pixel grid of the next frame
+ */
+static void rc_reproj_seed(struct rc_reproj            *reproj,
+                           const struct rc_dose        *dose,
+                           const struct rc_reproj_view *view)
+{
+    const long len = (long)reproj->dim[0] * reproj->dim[1];
+    vec_t px, dir, pt;
+    unsigned m;
+    long n;
+
+    /* Where does each max land? */
+#if _OPENMP
+#   pragma omp parallel for private(m, pt)
+#endif /* _OPENMP */
+    for (n = 0; n < len; n++) {
+        m = RC_REPROJ_NONE;
+        if (!isnan(reproj->depth[n])) {
+            pt = rc_reproj_point(reproj, dose, n);
+            m = rc_reproj_project(view, reproj->dim, pt);
+        }
+        reproj->dst[n] = m;
+        reproj->src[n] = RC_REPROJ_NONE;
+    }
+
+    /* Resolve collisions in favor of the larger max. This is cheap enough to
+    leave serial */
+    for (n = 0; n < len; n++) {
+        m = reproj->dst[n];
+        if (m != RC_REPROJ_NONE
+         && (reproj->src[m] == RC_REPROJ_NONE
+          || reproj->value[n] > reproj->value[reproj->src[m]])) {
+            reproj->src[m] = n;
+        }
+    }
+
+    /* Find the parameter of each landed max on its new ray */
+#if _OPENMP
+#   pragma omp parallel for private(px, dir, pt)
+#endif /* _OPENMP */
+    for (n = 0; n < len; n++) {
+        reproj->seed[n] = NAN;
+        if (reproj->src[n] != RC_REPROJ_NONE) {
+            pt = rc_reproj_point(reproj, dose, reproj->src[n]);
+            px = rc_reproj_pixel(view, reproj->dim, n);
+            dir = rc_vnorm(rc_mvmul3(dose->inv, rc_reproj_ray(view, px)));
+            pt = rc_mvmul3(dose->inv, rc_sub(pt, px));
+            reproj->seed[n] = rc_reproj_dot(pt, dir);
+        }
+    }
+}
+
+
+int rc_reproj_begin(struct rc_reproj            *reproj,
+                    const struct rc_dose        *dose,
+                    const unsigned               dim[],
+                    const struct rc_reproj_view *view)
+{
+    const size_t len = (size_t)dim[0] * dim[1];
+    size_t n;
+
+    if (rc_reproj_resize(reproj, dim)) {
+        return 1;
+    }
+    if (reproj->valid) {
+        rc_reproj_seed(reproj, dose, view);
+    } else {
+        for (n = 0; n < len; n++) {
+            reproj->seed[n] = NAN;
+        }
+    }
+    reproj->view = *view;
+    reproj->valid = true;
+    return 0;
+}
+
+
+void rc_reproj_reset(struct rc_reproj *reproj)
+{
+    reproj->valid = false;
+}
+
+
+void rc_reproj_clear(struct rc_reproj *reproj)
+{
+    free(reproj->value);
+    free(reproj->depth);
+    free(reproj->seed);
+    free(reproj->dst);
+    free(reproj->src);
+    reproj->value = NULL;
+    reproj->depth = NULL;
+    reproj->seed = NULL;
+    reproj->dst = NULL;
+    reproj->src = NULL;
+    reproj->dim[0] = 0;
+    reproj->dim[1] = 0;
+    reproj->valid = false;
+}
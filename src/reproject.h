@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef RC_REPROJECT_H
+#define RC_REPROJECT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "rcmath.h"
+#include "dose.h"
+
+#if defined(__cplusplus) && __cplusplus
+extern "C" {
+#endif
+
+
+/** The pixel grid of a frame, in ambient coordinates */
+struct rc_reproj_view {
+    vec_t cam;  /* Position of the camera pinhole */
+    vec_t org;  /* Position of pixel (0, 0) */
+    vec_t x;    /* Displacement to the next pixel on a scanline */
+    vec_t y;    /* Displacement to the next scanline */
+    vec_t dir;  /* Direction of the camera axis */
+    bool  ortho;    /* Rays point along dir, not away from cam */
+};
+
+
+/** Per-pixel results of the last frame, kept so that they can be reprojected
+ *  into the next. Each max is remembered as a point, and the ray of whichever
+ *  pixel that point lands on in the new view is seeded with the dose there.
+ *  Seeds are samples on the new rays themselves, so they never change what a
+ *  ray returns, only how much of it can be pruned. Keep one of these around
+ *  for each target
+ */
+struct rc_reproj {
+    unsigned              dim[2];   /* Frame dimensions */
+    bool                  valid;    /* The cached frame can be reprojected */
+    struct rc_reproj_view view;     /* Pixel grid of the cached frame */
+
+    float    *value;    /* Max dose of each pixel */
+    float    *depth;    /* Ray parameter of each max in pixel units from the
+                        pixel, or NaN if its ray found nothing */
+    float    *seed;     /* Seeds of the frame being drawn, in the same units,
+                        or NaN for none */
+    unsigned *dst;      /* The pixel each cached max lands on */
+    unsigned *src;      /* The cached max each pixel is seeded from */
+};
+
+
+/** @brief Initialize an empty cache
+ *  @param reproj
+ *      Cache
+ */
+void rc_reproj_init(struct rc_reproj *reproj);
+
+
+/** @brief Seed the next frame from the cached one, then cache its view. The
+ *      frame is expected to fill in the value and depth of every pixel
+ *  @param reproj
+ *      Cache. If the frame dimensions changed, the cache is reallocated and
+ *      nothing is seeded
+ *  @param dose
+ *      Dose volume
+ *  @param dim
+ *      Frame dimensions
+ *  @param view
+ *      Pixel grid of the next frame
+ *  @returns Nonzero if there is not enough memory, in which case errno(3) is
+ *      set and @p reproj is empty
+ */
+int rc_reproj_begin(struct rc_reproj            *reproj,
+                    const struct rc_dose        *dose,
+                    const unsigned               dim[],
+                    const struct rc_reproj_view *view);
+
+
+/** @brief Discard the cached frame, so that the next is not seeded
+ *  @param reproj
+ *      Cache
+ */
+void rc_reproj_reset(struct rc_reproj *reproj);
+
+
+/** @brief Free all memory
+ *  @param reproj
+ *      Cache. It is empty afterwards
+ */
+void rc_reproj_clear(struct rc_reproj *reproj);
+
+
+#if defined(__cplusplus) && __cplusplus
+}
+#endif
+
+#endif /* RC_REPROJECT_H */
@@ -0,0 +1,313 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "schedule.h"
+
+#if _OPENMP
+#   include <omp.h>
+#endif /* _OPENMP */
+
+
+/** A deque of tile indices owned by one thread. The owner pops the costliest
+ *  tiles from the head, thieves take the cheapest from the tail
+ */
+struct rc_sched_queue {
+#if _OPENMP
+    omp_lock_t lock;
+#endif /* _OPENMP */
+    unsigned   head;    /* Index of the first tile in rc_sched::queue */
+    unsigned   tail;    /* One past the last tile */
+    double     load;    /* Total cost dealt to this deque */
+    char       pad[64]; /* Keep neighboring deques off of each other's cache
+                        lines */
+};
+
+
+void rc_sched_init(struct rc_sched *sched, unsigned size)
+{
+    memset(sched, 0, sizeof *sched);
+    sched->size[0] = size;
+    sched->size[1] = size;
+}
+
+
+/** @brief Resize the tile grid, discarding all costs if it changed
+ *  @param sched
+ *      Scheduler
+ *  @param dim
+ *      New tile grid dimensions
+ *  @returns Nonzero if there is not enough memory
+ */
+static int rc_sched_resize(struct rc_sched *sched, const unsigned dim[])
+{
+    unsigned i;
+
+    if (sched->tiles && sched->dim[0] == dim[0] && sched->dim[1] == dim[1]) {
+        return 0;
+    }
+    free(sched->tiles);
+    free(sched->order);
+    free(sched->queue);
+    sched->dim[0] = dim[0];
+    sched->dim[1] = dim[1];
+    sched->ntile = dim[0] * dim[1];
+    sched->tiles = malloc(sizeof *sched->tiles * sched->ntile);
+    sched->order = malloc(sizeof *sched->order * sched->ntile);
+    sched->queue = malloc(sizeof *sched->queue * sched->ntile);
+    if (!sched->tiles || !sched->order || !sched->queue) {
+        free(sched->tiles);
+        free(sched->order);
+        free(sched->queue);
+        sched->tiles = sched->order = NULL;
+        sched->queue = NULL;
+        sched->ntile = sched->dim[0] = sched->dim[1] = 0;
+        errno = ENOMEM;
+        return 1;
+    }
+    for (i = 0; i < sched->ntile; i++) {
+        sched->tiles[i].cost = 0.0;
+        sched->tiles[i].idx = i;
+        sched->tiles[i].owner = 0;
+    }
+    return 0;
+}
+
+
+/** @brief Free the deques */
+static void rc_sched_free_deques(struct rc_sched *sched)
+{
+#if _OPENMP
+    int i;
+
+    for (i = 0; i < sched->nthread; i++) {
+        omp_destroy_lock(&sched->deques[i].lock);
+    }
+#endif /* _OPENMP */
+    free(sched->deques);
+    sched->deques = NULL;
+    sched->nthread = 0;
+}
+
+
+/** @brief Make one deque for each of @p nthread threads
+ *  @param sched
+ *      Scheduler
+ *  @param nthread
+ *      Thread count
+ *  @returns Nonzero if there is not enough memory
+ */
+static int rc_sched_alloc_deques(struct rc_sched *sched, int nthread)
+{
+    int i;
+
+    if (sched->deques && sched->nthread == nthread) {
+        return 0;
+    }
+    rc_sched_free_deques(sched);
+    sched->deques = calloc(nthread, sizeof *sched->deques);
+    if (!sched->deques) {
+        errno = ENOMEM;
+        return 1;
+    }
+    sched->nthread = nthread;
+    for (i = 0; i < nthread; i++) {
+#if _OPENMP
+        omp_init_lock(&sched->deques[i].lock);
+#endif /* _OPENMP */
+    }
+    return 0;
+}
+
+
+/** @brief qsort(3) comparator for tiles in descending order of cost. Ties go
+ *      in ascending order of index, so that the first frame keeps scanline
+ *      order
+ */
+static int rc_sched_compare(const void *a, const void *b)
+{
+    const struct rc_sched_tile *ta = a, *tb = b;
+
+    if (ta->cost != tb->cost) {
+        return ta->cost < tb->cost ? 1 : -1;
+    }
+    return (ta->idx > tb->idx) - (ta->idx < tb->idx);
+}
+
+
+/** @brief Deal the tiles to the deques, longest processing time first. Each
+ *      tile goes to the deque with the least total cost so far, or the fewest
+ *      tiles if those are tied
+ *  @param sched
+ *      Scheduler with its tile grid and deques allocated
+ */
+static void rc_sched_deal(struct rc_sched *sched)
+{
+    struct rc_sched_queue *q;
+    unsigned i, n;
+    int t, best;
+
+    memcpy(sched->order, sched->tiles, sizeof *sched->order * sched->ntile);
+    qsort(sched->order, sched->ntile, sizeof *sched->order, rc_sched_compare);
+    for (t = 0; t < sched->nthread; t++) {
+        sched->deques[t].load = 0.0;
+        sched->deques[t].tail = 0;
+    }
+    for (i = 0; i < sched->ntile; i++) {
+        best = 0;
+        for (t = 1; t < sched->nthread; t++) {
+            q = &sched->deques[t];
+            if (q->load < sched->deques[best].load
+             || (q->load == sched->deques[best].load
+              && q->tail < sched->deques[best].tail)) {
+                best = t;
+            }
+        }
+        sched->order[i].owner = best;
+        sched->deques[best].load += sched->order[i].cost;
+        sched->deques[best].tail++;
+    }
+    for (n = 0, t = 0; t < sched->nthread; t++) {
+        q = &sched->deques[t];
+        q->head = n;
+        n += q->tail;
+        q->tail = q->head;
+    }
+    for (i = 0; i < sched->ntile; i++) {
+        q = &sched->deques[sched->order[i].owner];
+        sched->queue[q->tail++] = sched->order[i].idx;
+    }
+}
+
+
+/** @brief Process tile @p idx
+ *  @param sched
+ *      Scheduler
+ *  @param dim
+ *      Image size in pixels
+ *  @param idx
+ *      Linear tile index
+ *  @param func
+ *      Tile function
+ *  @param data
+ *      User data
+ */
+static void rc_sched_tile(struct rc_sched   *sched,
+                          const unsigned     dim[],
+                          unsigned           idx,
+                          rc_sched_tilefn_t *func,
+                          void              *data)
+{
+    unsigned org[2], end[2], n;
+#if _OPENMP
+    double start;
+
+    start = omp_get_wtime();
+#endif /* _OPENMP */
+    org[0] = idx % sched->dim[0] * sched->size[0];
+    org[1] = idx / sched->dim[0] * sched->size[1];
+    for (n = 0; n < 2; n++) {
+        end[n] = org[n] + sched->size[n];
+        end[n] = end[n] < dim[n] ? end[n] : dim[n];
+    }
+    func(data, org, end);
+#if _OPENMP
+    sched->tiles[idx].cost = omp_get_wtime() - start;
+#endif /* _OPENMP */
+}
+
+
+#if _OPENMP
+
+/** @brief Take the next tile for thread @p t, from its own deque if it still
+ *      has any, or else from the tail of another
+ *  @param sched
+ *      Scheduler
+ *  @param t
+ *      Thread number
+ *  @param[out] idx
+ *      The tile taken
+ *  @returns false if there are no tiles left anywhere
+ */
+static bool rc_sched_pop(struct rc_sched *sched, int t, unsigned *idx)
+{
+    struct rc_sched_queue *q;
+    bool found = false;
+    int i;
+
+    q = &sched->deques[t];
+    omp_set_lock(&q->lock);
+    if (q->head < q->tail) {
+        *idx = sched->queue[q->head++];
+        found = true;
+    }
+    omp_unset_lock(&q->lock);
+    for (i = 1; !found && i < sched->nthread; i++) {
+        q = &sched->deques[(t + i) % sched->nthread];
+        omp_set_lock(&q->lock);
+        if (q->head < q->tail) {
+            *idx = sched->queue[--q->tail];
+            found = true;
+        }
+        omp_unset_lock(&q->lock);
+    }
+    return found;
+}
+
+#endif /* _OPENMP */
+
+
+int rc_sched_run(struct rc_sched   *sched,
+                 const unsigned     dim[],
+                 rc_sched_tilefn_t *func,
+                 void              *data)
+{
+    unsigned grid[2];
+    int nthread = 1;
+
+    if (!sched->size[0] || !sched->size[1]) {
+        sched->size[0] = sched->size[1] = RC_SCHED_TILE;
+    }
+    grid[0] = (dim[0] + sched->size[0] - 1) / sched->size[0];
+    grid[1] = (dim[1] + sched->size[1] - 1) / sched->size[1];
+#if _OPENMP
+    nthread = omp_get_max_threads();
+#endif /* _OPENMP */
+    if (rc_sched_resize(sched, grid) || rc_sched_alloc_deques(sched, nthread)) {
+        return 1;
+    }
+    rc_sched_deal(sched);
+
+#if _OPENMP
+#   pragma omp parallel
+    {
+        const int t = omp_get_thread_num();
+        unsigned idx;
+
+        while (rc_sched_pop(sched, t, &idx)) {
+            rc_sched_tile(sched, dim, idx, func, data);
+        }
+    }
+#else
+    {
+        unsigned i;
+
+        for (i = 0; i < sched->ntile; i++) {
+            rc_sched_tile(sched, dim, sched->queue[i], func, data);
+        }
+    }
+#endif /* _OPENMP */
+    return 0;
+}
+
+
+void rc_sched_clear(struct rc_sched *sched)
+{
+    rc_sched_free_deques(sched);
+    free(sched->tiles);
+    free(sched->order);
+    free(sched->queue);
+    sched->tiles = sched->order = NULL;
+    sched->queue = NULL;
+    sched->ntile = sched->dim[0] = sched->dim[1] = 0;
+}
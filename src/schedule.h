@@ -0,0 +1,100 @@
+#pragma once
+
+#ifndef RC_SCHEDULE_H
+#define RC_SCHEDULE_H
+
+#if defined(__cplusplus) && __cplusplus
+extern "C" {
+#endif
+
+
+/** Default tile edge length in pixels */
+#define RC_SCHED_TILE 16
+
+
+struct rc_sched_queue;
+
+
+/** Per-tile bookkeeping */
+struct rc_sched_tile {
+    double   cost;      /* Seconds spent on this tile last frame */
+    unsigned idx;       /* Linear tile index */
+    int      owner;     /* The thread this tile is dealt to */
+};
+
+
+/** A work-stealing tile scheduler. Tiles are dealt to threads costliest first
+ *  by the time they took in the previous frame, and threads that run out of
+ *  their own tiles steal the cheapest remaining tiles of the others. Keep one
+ *  of these around for each target, so that the costs carry over
+ */
+struct rc_sched {
+    unsigned size[2];   /* Tile size in pixels. Set this yourself. Widths that
+                        are multiples of eight keep whole packets of rays
+                        together */
+
+    unsigned              dim[2];   /* Tile grid dimensions */
+    unsigned              ntile;    /* Tile count */
+    struct rc_sched_tile *tiles;    /* Tiles, indexed by linear index */
+    struct rc_sched_tile *order;    /* Tiles sorted by descending cost */
+    unsigned             *queue;    /* Backing storage for the deques */
+
+    int                    nthread; /* Thread count of the deques */
+    struct rc_sched_queue *deques;  /* One deque for each thread */
+};
+
+
+/** @brief Signature for a function that processes one tile
+ *  @param data
+ *      User data passed to rc_sched_run
+ *  @param org
+ *      Pixel coordinates of the top left corner of the tile
+ *  @param end
+ *      Pixel coordinates one past the bottom right corner of the tile
+ */
+typedef void rc_sched_tilefn_t(void           *data,
+                               const unsigned  org[],
+                               const unsigned  end[]);
+
+
+/** @brief Initialize @p sched with square tiles
+ *  @param sched
+ *      Scheduler
+ *  @param size
+ *      Tile edge length in pixels
+ */
+void rc_sched_init(struct rc_sched *sched, unsigned size);
+
+
+/** @brief Split an image into tiles and process all of them in parallel. The
+ *      time spent on each tile is recorded for the next call
+ *  @param sched
+ *      Scheduler. If the tile grid changes from the last call, the previous
+ *      costs are discarded
+ *  @param dim
+ *      Image size in pixels
+ *  @param func
+ *      Tile function. This is called concurrently
+ *  @param data
+ *      User data passed to @p func
+ *  @returns Nonzero if there is not enough memory for the tile grid, in
+ *      which case errno(3) is set and nothing is processed
+ */
+int rc_sched_run(struct rc_sched   *sched,
+                 const unsigned     dim[],
+                 rc_sched_tilefn_t *func,
+                 void              *data);
+
+
+/** @brief Free the tile grid
+ *  @param sched
+ *      Scheduler. The tile size is kept
+ */
+void rc_sched_clear(struct rc_sched *sched);
+
+
+#if defined(__cplusplus) && __cplusplus
+}
+#endif
+
+#endif /* RC_SCHEDULE_H */
@@ -0,0 +1,548 @@
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shearwarp.h"
+
+#if _OPENMP
+#   include <omp.h>
+#endif /* _OPENMP */
+
+
+/** How the volume is sheared for a view. Slices are stacked along the
+ *  principal axis, and each is displaced in the intermediate image so that
+ *  every ray runs straight through the stack
+ */
+struct rc_shear {
+    unsigned axis[3];   /* Axes along slice rows, across them, and between
+                        slices */
+    size_t   stride[3]; /* Linear index displacement along each of those */
+    float    shear[2];  /* Intermediate image displacement per slice */
+    float    lo[2];     /* The least displacement of any slice */
+    bool     nearest;   /* Resample slices with the nearest voxel */
+};
+
+
+void rc_shearwarp_init(struct rc_shearwarp *sw)
+{
+    memset(sw, 0, sizeof *sw);
+}
+
+
+/** @brief Pick the principal axis of @p dir and find the shear
+ *  @param[out] sh
+ *      Shear
+ *  @param dose
+ *      Dose volume
+ *  @param dir
+ *      View direction in pixel coordinates
+ *  @param nearest
+ *      Resample slices with the nearest voxel instead of bilinearly
+ *  @param[out] dim
+ *      Dimensions of the intermediate image
+ */
+static void rc_shearwarp_setup(struct rc_shear      *sh,
+                               const struct rc_dose *dose,
+                               vec_t                 dir,
+                               bool                  nearest,
+                               unsigned              dim[])
+{
+    const size_t stride[3] = {
+        1,
+        dose->sdim[0] + RC_DOSE_PAD,
+        (size_t)(dose->sdim[0] + RC_DOSE_PAD) * (dose->sdim[1] + RC_DOSE_PAD)
+    };
+    RC_ALIGN scal_t d[4];
+    unsigned c, k = 0, last;
+    float span;
+
+    rc_spill(d, dir);
+    for (c = 1; c < 3; c++) {
+        k = fabsf(d[c]) > fabsf(d[k]) ? c : k;
+    }
+    sh->axis[0] = k == 0 ? 1 : 0;
+    sh->axis[1] = k == 2 ? 1 : 2;
+    sh->axis[2] = k;
+    last = dose->dim[k] ? dose->dim[k] - 1 : 0;
+    for (c = 0; c < 3; c++) {
+        sh->stride[c] = stride[sh->axis[c]];
+    }
+    for (c = 0; c < 2; c++) {
+        sh->shear[c] = -d[sh->axis[c]] / d[k];
+        span = sh->shear[c] * (float)last;
+        sh->lo[c] = rc_fminf(span, 0.0f);
+        /* One more for the bilinear spill and one for rounding */
+        dim[c] = dose->dim[sh->axis[c]] + (unsigned)ceilf(fabsf(span)) + 2;
+    }
+    sh->nearest = nearest;
+}
+
+
+/** @brief Make sure there is room for every partial image and row buffer
+ *  @param sw
+ *      Buffers
+ *  @param nthread
+ *      Thread count
+ *  @param rowlen
+ *      Floats in the row buffers of each thread
+ *  @returns Nonzero if there is not enough memory
+ */
+static int rc_shearwarp_reserve(struct rc_shearwarp *sw,
+                                int                  nthread,
+                                size_t               rowlen)
+{
+    const size_t len = (size_t)sw->dim[0] * sw->dim[1];
+    const size_t need = nthread * (len + rowlen);
+    float *buf;
+
+    sw->nthread = nthread;
+    if (need <= sw->cap) {
+        return 0;
+    }
+    buf = malloc(sizeof *buf * need);
+    if (!buf) {
+        errno = ENOMEM;
+        return 1;
+    }
+    free(sw->buf);
+    sw->buf = buf;
+    sw->cap = need;
+    return 0;
+}
+
+
+/** @brief Convert a row of @p n voxels to single precision
+ *  @param dst
+ *      Destination
+ *  @param dose
+ *      Dose volume
+ *  @param sh
+ *      Shear
+ *  @param s
+ *      Slice index
+ *  @param r
+ *      Row index within the slice
+ *  @param n
+ *      Voxel count
+ */
+static void rc_shearwarp_load(float                 *dst,
+                              const struct rc_dose  *dose,
+                              const struct rc_shear *sh,
+                              unsigned               s,
+                              unsigned               r,
+                              unsigned               n)
+{
+    const size_t stride = sh->stride[0];
+    const double *f64;
+    const float *f32;
+    unsigned t = 0, c[3];
+    size_t src, off;
+
+    c[sh->axis[0]] = 0;
+    c[sh->axis[1]] = r;
+    c[sh->axis[2]] = s;
+    src = rc_dose_offset(dose, c[0], c[1], c[2]);
+    f64 = (const double *)dose->data + src;
+    f32 = (const float *)dose->data + src;
+    if (dose->layout == RC_DOSE_BRICKED) {
+        for (; t < n; t++) {
+            c[sh->axis[0]] = t;
+            off = rc_dose_offset(dose, c[0], c[1], c[2]);
+            dst[t] = (float)rc_dose_voxel(dose, off);
+        }
+        return;
+    }
+    if (stride == 1) {
+        /* Rows along the first axis are contiguous */
+        switch (dose->fmt) {
+        case RC_DOSE_F64:
+            for (; t + 4 <= n; t += 4) {
+                _mm_storeu_ps(dst + t,
+                              _mm256_cvtpd_ps(_mm256_loadu_pd(f64 + t)));
+            }
+            break;
+        case RC_DOSE_F32:
+            memcpy(dst, f32, sizeof *dst * n);
+            return;
+        default:
+            break;
+        }
+    }
+    for (; t < n; t++) {
+        dst[t] = (float)rc_dose_voxel(dose, src + stride * t);
+    }
+}
+
+
+/** @brief Interpolate between two rows
+ *  @param dst
+ *      Destination
+ *  @param a
+ *      First row
+ *  @param b
+ *      Second row
+ *  @param w
+ *      Weight of @p b
+ *  @param n
+ *      Row length
+ */
+static void rc_shearwarp_lerp(float       *dst,
+                              const float *a,
+                              const float *b,
+                              float        w,
+                              unsigned     n)
+{
+    const __m256 w8 = _mm256_set1_ps(w);
+    __m256 a8, b8;
+    unsigned t;
+
+    for (t = 0; t + 8 <= n; t += 8) {
+        a8 = _mm256_loadu_ps(a + t);
+        b8 = _mm256_loadu_ps(b + t);
+        a8 = _mm256_fmadd_ps(w8, _mm256_sub_ps(b8, a8), a8);
+        _mm256_storeu_ps(dst + t, a8);
+    }
+    for (; t < n; t++) {
+        dst[t] = a[t] + w * (b[t] - a[t]);
+    }
+}
+
+
+/** @brief Interpolate between two rows and take the max with @p dst
+ *  @param dst
+ *      Intermediate image row
+ *  @param a
+ *      First row
+ *  @param b
+ *      Second row
+ *  @param w
+ *      Weight of @p b
+ *  @param n
+ *      Row length
+ */
+static void rc_shearwarp_accum(float       *dst,
+                               const float *a,
+                               const float *b,
+                               float        w,
+                               unsigned     n)
+{
+    const __m256 w8 = _mm256_set1_ps(w);
+    __m256 a8, b8;
+    unsigned t;
+
+    for (t = 0; t + 8 <= n; t += 8) {
+        a8 = _mm256_loadu_ps(a + t);
+        b8 = _mm256_loadu_ps(b + t);
+        a8 = _mm256_fmadd_ps(w8, _mm256_sub_ps(b8, a8), a8);
+        a8 = _mm256_max_ps(a8, _mm256_loadu_ps(dst + t));
+        _mm256_storeu_ps(dst + t, a8);
+    }
+    for (; t < n; t++) {
+        dst[t] = rc_fmaxf(dst[t], a[t] + w * (b[t] - a[t]));
+    }
+}
+
+
+/** @brief Resample slice @p s into the intermediate image and take the max
+ *  @param dose
+ *      Dose volume
+ *  @param sh
+ *      Shear
+ *  @param s
+ *      Slice index
+ *  @param img
+ *      Intermediate image
+ *  @param width
+ *      Intermediate image width
+ *  @param rows
+ *      Room for three rows of the slice and four more floats
+ */
+static void rc_shearwarp_slice(const struct rc_dose  *dose,
+                               const struct rc_shear *sh,
+                               unsigned               s,
+                               float                 *img,
+                               unsigned               width,
+                               float                 *rows)
+{
+    const unsigned len = dose->dim[sh->axis[0]];
+    const unsigned cnt = dose->dim[sh->axis[1]];
+    float *src = rows, *cur = src + len + 2, *prev = cur + len + 1, *tmp;
+    unsigned org[2], c, r;
+    float off, w[2];
+
+    for (c = 0; c < 2; c++) {
+        off = rc_fmaxf((float)s * sh->shear[c] - sh->lo[c], 0.0f);
+        org[c] = (unsigned)(sh->nearest ? off + 0.5f : off);
+        w[c] = sh->nearest ? 0.0f : off - (float)org[c];
+    }
+
+    /* Voxel t of a row lands between columns t and t + 1, so src is padded
+    with a zero on each end */
+    src[0] = src[len + 1] = 0.0f;
+    memset(prev, 0, sizeof *prev * (len + 1));
+    for (r = 0; r < cnt || (r == cnt && w[1] > 0.0f); r++) {
+        if (r < cnt) {
+            rc_shearwarp_load(src + 1, dose, sh, s, r, len);
+            rc_shearwarp_lerp(cur, src + 1, src, w[0], len + 1);
+        } else {
+            memset(cur, 0, sizeof *cur * (len + 1));
+        }
+        rc_shearwarp_accum(img + (size_t)width * (org[1] + r) + org[0],
+                           cur,
+                           prev,
+                           w[1],
+                           len + 1);
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+}
+
+
+/** @brief Shear every slice into per-thread partial images and reduce them
+ *      into the first
+ *  @param dose
+ *      Dose volume
+ *  @param sh
+ *      Shear
+ *  @param sw
+ *      Buffers, with room reserved for as many threads as are started
+ *  @param rowlen
+ *      Floats in the row buffers of each thread
+ */
+static void rc_shearwarp_shear(const struct rc_dose  *dose,
+                               const struct rc_shear *sh,
+                               struct rc_shearwarp   *sw,
+                               size_t                 rowlen)
+{
+    const size_t len = (size_t)sw->dim[0] * sw->dim[1];
+    const int nslice = (int)dose->dim[sh->axis[2]];
+    float *img, *rows;
+    int tid = 0, nimg = 1, t, s;
+    long n, nend = (long)len;
+
+#if _OPENMP
+#   pragma omp parallel private(img, rows, tid, t, s, n) \
+                        num_threads(sw->nthread)
+#endif /* _OPENMP */
+    {
+#if _OPENMP
+        tid = omp_get_thread_num();
+#endif /* _OPENMP */
+        img = sw->buf + len * tid;
+        rows = sw->buf + len * sw->nthread + rowlen * tid;
+        memset(img, 0, sizeof *img * len);
+        /* The team may be smaller than the images reserved for it, and only
+        the images of threads that ran are cleared */
+#if _OPENMP
+#   pragma omp single
+        nimg = omp_get_num_threads();
+#   pragma omp for schedule(static)
+#endif /* _OPENMP */
+        for (s = 0; s < nslice; s++) {
+            rc_shearwarp_slice(dose, sh, s, img, sw->dim[0], rows);
+        }
+#if _OPENMP
+#   pragma omp for schedule(static)
+#endif /* _OPENMP */
+        for (n = 0; n < nend; n++) {
+            for (t = 1; t < nimg; t++) {
+                sw->buf[n] = rc_fmaxf(sw->buf[n], sw->buf[len * t + n]);
+            }
+        }
+    }
+}
+
+
+/** @brief Fetch a pixel of the intermediate image
+ *  @param img
+ *      Intermediate image
+ *  @param dim
+ *      Its dimensions
+ *  @param i
+ *      Column
+ *  @param j
+ *      Row
+ *  @returns The pixel, or zero if it is out of bounds
+ */
+static float rc_shearwarp_texel(const float    *img,
+                                const unsigned  dim[],
+                                long            i,
+                                long            j)
+{
+    if (i < 0 || j < 0 || i >= (long)dim[0] || j >= (long)dim[1]) {
+        return 0.0f;
+    }
+    return img[(size_t)dim[0] * j + i];
+}
+
+
+/** @brief Sample the intermediate image
+ *  @param img
+ *      Intermediate image
+ *  @param dim
+ *      Its dimensions
+ *  @param u
+ *      Horizontal coordinate
+ *  @param v
+ *      Vertical coordinate
+ *  @param nearest
+ *      Take the nearest pixel instead of interpolating bilinearly
+ *  @returns The sample
+ */
+static float rc_shearwarp_sample(const float    *img,
+                                 const unsigned  dim[],
+                                 float           u,
+                                 float           v,
+                                 bool            nearest)
+{
+    float fu, fv, a, b;
+    long i, j;
+
+    if (nearest) {
+        return rc_shearwarp_texel(img, dim, lrintf(u), lrintf(v));
+    }
+    fu = floorf(u);
+    fv = floorf(v);
+    i = (long)fu;
+    j = (long)fv;
+    fu = u - fu;
+    fv = v - fv;
+    a = rc_shearwarp_texel(img, dim, i, j);
+    a += fu * (rc_shearwarp_texel(img, dim, i + 1, j) - a);
+    b = rc_shearwarp_texel(img, dim, i, j + 1);
+    b += fu * (rc_shearwarp_texel(img, dim, i + 1, j + 1) - b);
+    return a + fv * (b - a);
+}
+
+
+/** @brief Warp the intermediate image onto the target
+ *  @param dose
+ *      Dose volume
+ *  @param sh
+ *      Shear
+ *  @param sw
+ *      Buffers holding the intermediate image
+ *  @param basis
+ *      Image plane basis
+ *  @param target
+ *      Render target
+ *  @param cmap
+ *      Colormap
+ */
+static void rc_shearwarp_warp(const struct rc_dose      *dose,
+                              const struct rc_shear     *sh,
+                              const struct rc_shearwarp *sw,
+                              const struct rc_basis     *basis,
+                              struct rc_target          *target,
+                              struct rc_colormap        *cmap)
+{
+    const size_t pitch = (size_t)target->tex.stride * target->tex.dim[0];
+    const unsigned *ax = sh->axis;
+    const struct rc_cmap_lut *lut = NULL;
+    RC_ALIGN scal_t p[3][4];
+    alignas (__m256) float res[8];
+    float u[3], v[3];
+    unsigned c, i, k;
+    char *ptr;
+    int j, jend = (int)target->tex.dim[1];
+
+    /* Pixel coordinates of the origin and steps, sheared onto the image.
+    Everything along the principal axis lands on the same point */
+    rc_spill(p[0], rc_mvmul4(dose->inv, basis->org));
+    rc_spill(p[1], rc_mvmul3(dose->inv, basis->x));
+    rc_spill(p[2], rc_mvmul3(dose->inv, basis->y));
+    for (c = 0; c < 3; c++) {
+        u[c] = p[c][ax[0]] + p[c][ax[2]] * sh->shear[0];
+        v[c] = p[c][ax[1]] + p[c][ax[2]] * sh->shear[1];
+    }
+    u[0] -= sh->lo[0];
+    v[0] -= sh->lo[1];
+    if (target->tex.stride == 4) {
+        lut = rc_cmap_lut_cast(cmap);
+    }
+
+#if _OPENMP
+#   pragma omp parallel for private(i, k, ptr, res)
+#endif /* _OPENMP */
+    for (j = 0; j < jend; j++) {
+        ptr = (char *)target->tex.pixels + pitch * j;
+        i = 0;
+        /* Tables colormap eight pixels at a time */
+        for (; lut && i + 8 <= target->tex.dim[0]; i += 8) {
+            for (k = 0; k < 8; k++) {
+                res[k] = rc_shearwarp_sample(sw->buf,
+                                             sw->dim,
+                                             u[0] + u[1] * (i + k) + u[2] * j,
+                                             v[0] + v[1] * (i + k) + v[2] * j,
+                                             sh->nearest);
+            }
+            _mm256_storeu_si256((__m256i *)ptr,
+                                rc_cmap_lut_map8(lut, _mm256_load_ps(res)));
+            ptr += 8 * target->tex.stride;
+        }
+        for (; i < target->tex.dim[0]; i++) {
+            cmap->func(cmap,
+                       rc_shearwarp_sample(sw->buf,
+                                           sw->dim,
+                                           u[0] + u[1] * i + u[2] * j,
+                                           v[0] + v[1] * i + v[2] * j,
+                                           sh->nearest),
+                       ptr);
+            ptr += target->tex.stride;
+        }
+    }
+}
+
+
+int rc_shearwarp_dose(const struct rc_dose *dose,
+                      struct rc_target     *target,
+                      struct rc_colormap   *cmap,
+                      const struct rc_cam  *camera,
+                      rc_dose_interpfn_t   *dosefn,
+                      struct rc_shearwarp  *sw)
+{
+    struct rc_basis basis;
+    struct rc_shear sh;
+    size_t rowlen;
+    vec_t dir;
+    int nthread = 1;
+
+    if (!target->ortho) {
+        errno = EINVAL;
+        return 1;
+    }
+#if _OPENMP
+    nthread = omp_get_max_threads();
+#endif /* _OPENMP */
+    rc_raycast_basis(&basis, target, camera);
+    if (dose->data) {
+        dir = rc_qrot(camera->quat, rc_set(0.0, 0.0, 1.0, 0.0));
+        dir = rc_mvmul3(dose->inv, dir);
+        rc_shearwarp_setup(&sh, dose, dir, dosefn != rc_dose_linear, sw->dim);
+        rowlen = 3 * (size_t)dose->dim[sh.axis[0]] + 4;
+    } else {
+        /* No dose in sight, so warp a single empty pixel */
+        memset(&sh, 0, sizeof sh);
+        sw->dim[0] = sw->dim[1] = 1;
+        rowlen = 0;
+    }
+    if (rc_shearwarp_reserve(sw, nthread, rowlen)) {
+        return 1;
+    }
+    if (dose->data) {
+        rc_shearwarp_shear(dose, &sh, sw, rowlen);
+    } else {
+        sw->buf[0] = 0.0f;
+    }
+    rc_shearwarp_warp(dose, &sh, sw, &basis, target, cmap);
+    return 0;
+}
+
+
+void rc_shearwarp_clear(struct rc_shearwarp *sw)
+{
+    free(sw->buf);
+    rc_shearwarp_init(sw);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef RC_SHEARWARP_H
+#define RC_SHEARWARP_H
+
+#include <stddef.h>
+#include "raycast.h"
+
+#if defined(__cplusplus) && __cplusplus
+extern "C" {
+#endif
+
+
+/** Buffers for the shear-warp renderer. Maximum-intensity projection onto an
+ *  orthographic target factors into a shear of the volume, so that every ray
+ *  runs along the principal axis closest to the view, and a 2D warp of the
+ *  sheared image onto the target. The shear pass sweeps whole slices in
+ *  memory order, and each thread keeps a partial image of its own slices.
+ *  Keep one of these around for each target
+ */
+struct rc_shearwarp {
+    unsigned dim[2];    /* Intermediate image dimensions */
+    int      nthread;   /* Number of partial images */
+    size_t   cap;       /* Floats allocated */
+    float   *buf;       /* The partial images, then the row buffers of each
+                        thread. The first image holds the result */
+};
+
+
+/** @brief Initialize empty buffers
+ *  @param sw
+ *      Shear-warp buffers
+ */
+void rc_shearwarp_init(struct rc_shearwarp *sw);
+
+
+/** @brief Render @p dose to @p target by maximum-intensity projection,
+ *      exactly like rc_raycast_dose with no options. Each ray is sampled once
+ *      per slice of the volume instead of at unit steps, so results differ
+ *      slightly
+ *  @param dose
+ *      Dose volume
+ *  @param target
+ *      Render target. This must be orthographic
+ *  @param cmap
+ *      Colormap
+ *  @param camera
+ *      Camera information
+ *  @param dosefn
+ *      rc_dose_nearest or rc_dose_linear. Slices are resampled with the
+ *      nearest voxel or bilinearly to match
+ *  @param sw
+ *      Buffers, grown as needed
+ *  @returns Nonzero if @p target is not orthographic or there is not enough
+ *      memory, in which case errno(3) is set and @p target is untouched
+ */
+int rc_shearwarp_dose(const struct rc_dose *dose,
+                      struct rc_target     *target,
+                      struct rc_colormap   *cmap,
+                      const struct rc_cam  *camera,
+                      rc_dose_interpfn_t   *dosefn,
+                      struct rc_shearwarp  *sw);
+
+
+/** @brief Free all memory
+ *  @param sw
+ *      Shear-warp buffers. They are empty afterwards
+ */
+void rc_shearwarp_clear(struct rc_shearwarp *sw);
+
+
+#if defined(__cplusplus) && __cplusplus
+}
+#endif
+
+#endif /* RC_SHEARWARP_H */
@@ -0,0 +1,61 @@
+#include <errno.h>
+#include <stdlib.h>
+#include "rcmath.h"
+#include "transfer.h"
+
+
+int rc_transfer_shells(struct rc_transfer *tf,
+                       struct rc_colormap *cmap,
+                       double              dmax,
+                       const double        levels[],
+                       unsigned            count,
+                       double              width,
+                       double              opacity)
+{
+    const unsigned len = RC_TRANSFER_LEN;
+    unsigned char px[4];
+    double rel, alpha, tent;
+    unsigned i, k, first = len;
+    float *row;
+
+    rc_transfer_clear(tf);
+    tf->lut = malloc(sizeof *tf->lut * 4 * len);
+    if (!tf->lut) {
+        errno = ENOMEM;
+        return 1;
+    }
+    tf->len = len;
+    tf->scale = (float)((len - 1) / dmax);
+    tf->cutoff = 0.99f;
+    for (i = 0; i < len; i++) {
+        rel = (double)i / (len - 1);
+        alpha = 0.0;
+        for (k = 0; k < count; k++) {
+            tent = 1.0 - fabs(rel - levels[k]) / width;
+            alpha = rc_fmax(alpha, opacity * tent);
+        }
+        cmap->func(cmap, rel * dmax, px);
+        row = tf->lut + i;
+        row[0 * len] = (float)(alpha * px[0] / 255.0);
+        row[1 * len] = (float)(alpha * px[1] / 255.0);
+        row[2 * len] = (float)(alpha * px[2] / 255.0);
+        row[3 * len] = (float)alpha;
+        first = (alpha > 0.0 && first == len) ? i : first;
+    }
+    /* Lookups round to the nearest entry, so every dose up to the entry below
+    the first opaque one is transparent */
+    if (first == len) {
+        tf->lo = (float)dmax;
+    } else {
+        tf->lo = first ? (float)(first - 1) / tf->scale : -1.0f;
+    }
+    return 0;
+}
+
+
+void rc_transfer_clear(struct rc_transfer *tf)
+{
+    free(tf->lut);
+    tf->lut = NULL;
+    tf->len = 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef RC_TRANSFER_H
+#define RC_TRANSFER_H
+
+#include "cmap.h"
+
+#if defined(__cplusplus) && __cplusplus
+extern "C" {
+#endif
+
+
+/** Default number of table entries */
+#define RC_TRANSFER_LEN 1024
+
+
+/** A 1D transfer function from dose to colour and opacity, for direct volume
+ *  rendering. The table is stored as four rows of len entries each: red,
+ *  green and blue premultiplied by opacity, then opacity. Opacities are per
+ *  unit step along a ray, in pixel units
+ */
+struct rc_transfer {
+    unsigned len;       /* Entries in each row */
+    float    scale;     /* Entries per unit dose */
+    float    lo;        /* Dose at or below which every entry is transparent */
+    float    cutoff;    /* Rays stop once their opacity reaches this */
+    float   *lut;       /* The table */
+};
+
+
+/** @brief Build a transfer function of translucent isodose shells. Each
+ *      shell is coloured like @p cmap and fades linearly to transparent
+ *      within @p width of its level
+ *  @param tf
+ *      Transfer function. Any previous table is freed
+ *  @param cmap
+ *      Colormap giving the colour of each dose. Its alpha is ignored
+ *  @param dmax
+ *      Maximum dose. The table spans zero to this
+ *  @param levels
+ *      PROPORTIONS of @p dmax at which shells are drawn
+ *  @param count
+ *      Number of @p levels
+ *  @param width
+ *      Half of the thickness of each shell, as a PROPORTION of @p dmax
+ *  @param opacity
+ *      Opacity per unit step at the center of each shell
+ *  @returns Nonzero if there is not enough memory, in which case errno(3) is
+ *      set and @p tf is empty
+ */
+int rc_transfer_shells(struct rc_transfer *tf,
+                       struct rc_colormap *cmap,
+                       double              dmax,
+                       const double        levels[],
+                       unsigned            count,
+                       double              width,
+                       double              opacity);
+
+
+/** @brief Free the table
+ *  @param tf
+ *      Transfer function
+ */
+void rc_transfer_clear(struct rc_transfer *tf);
+
+
+#if defined(__cplusplus) && __cplusplus
+}
+#endif
+
+#endif /* RC_TRANSFER_H */